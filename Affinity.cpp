@@ -0,0 +1,124 @@
+//
+//    Affinity.cpp: CPU affinity of the forwarding threads
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "Affinity.h"
+#include <cstdlib>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif // __linux__
+
+bool
+parseCpuList(std::string const &list, std::vector<int> &cpus)
+{
+  size_t pos = 0;
+
+  cpus.clear();
+
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    std::string item;
+    char *tail;
+    long first, last;
+
+    if (end == std::string::npos)
+      end = list.size();
+
+    item  = list.substr(pos, end - pos);
+    pos   = end + 1;
+
+    if (item.empty())
+      continue;
+
+    first = strtol(item.c_str(), &tail, 10);
+    last  = first;
+
+    if (*tail == '-')
+      last = strtol(tail + 1, &tail, 10);
+
+    if (*tail != '\0' || first < 0 || last < first)
+      return false;
+
+    for (long cpu = first; cpu <= last; ++cpu)
+      cpus.push_back(static_cast<int>(cpu));
+  }
+
+  return true;
+}
+
+#ifdef __linux__
+static cpu_set_t
+initialAffinity()
+{
+  cpu_set_t set;
+
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &set) != 0) {
+    unsigned int count = std::thread::hardware_concurrency();
+
+    CPU_ZERO(&set);
+    for (unsigned int i = 0; i < count && i < CPU_SETSIZE; ++i)
+      CPU_SET(i, &set);
+  }
+
+  return set;
+}
+
+// Mask of the thread that loads the plugin, which may have been narrowed
+// by the user (e.g. with taskset). Empty lists go back to it.
+static const cpu_set_t g_initialAffinity = initialAffinity();
+
+static bool
+setAffinity(pthread_t thread, std::vector<int> const &cpus)
+{
+  cpu_set_t set = g_initialAffinity;
+
+  if (!cpus.empty()) {
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+      if (cpu < CPU_SETSIZE)
+        CPU_SET(cpu, &set);
+  }
+
+  return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+}
+#endif // __linux__
+
+bool
+setThreadAffinity(std::thread &thread, std::vector<int> const &cpus)
+{
+#ifdef __linux__
+  return setAffinity(thread.native_handle(), cpus);
+#else
+  (void) thread;
+  (void) cpus;
+  return false;
+#endif // __linux__
+}
+
+bool
+setCurrentThreadAffinity(std::vector<int> const &cpus)
+{
+#ifdef __linux__
+  return setAffinity(pthread_self(), cpus);
+#else
+  (void) cpus;
+  return false;
+#endif // __linux__
+}
@@ -0,0 +1,38 @@
+//
+//    Affinity.h: CPU affinity of the forwarding threads
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// CPU lists are written as in taskset(1): "0-3,8,10-11". An empty list
+// means no restriction beyond the affinity the process was started with.
+// Affinity is only supported on Linux; elsewhere these functions do
+// nothing and return false.
+//
+bool parseCpuList(std::string const &, std::vector<int> &);
+
+bool setThreadAffinity(std::thread &, std::vector<int> const &);
+bool setCurrentThreadAffinity(std::vector<int> const &);
+
+#endif // AFFINITY_H
@@ -0,0 +1,833 @@
+//
+//    Channelizer.cpp: Plugin-side channelizer engines
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "Channelizer.h"
+#include "SpectrumMonitor.h"
+#include "Demodulator.h"
+#include <algorithm>
+#include <cmath>
+
+////////////////////////////////// Channelizer /////////////////////////////////
+SUFLOAT
+Channelizer::inputRate() const
+{
+  return m_inputRate;
+}
+
+SUFREQ
+Channelizer::center() const
+{
+  return m_center;
+}
+
+void
+Channelizer::setCenter(SUFREQ center)
+{
+  m_center = center;
+}
+
+void
+Channelizer::setWorkerPool(WorkerPool *pool)
+{
+  m_pool = pool;
+}
+
+std::mutex &
+Channelizer::mutex()
+{
+  return m_mutex;
+}
+
+void
+Channelizer::queue(
+    ChannelDescription *channel,
+    std::vector<SUCOMPLEX> &buffer,
+    ChannelFilter *filter)
+{
+  ChannelizerDelivery delivery;
+
+  delivery.channel = channel;
+  delivery.buffer  = &buffer;
+  delivery.filter  = filter;
+
+  m_deliveries.push_back(delivery);
+}
+
+void
+Channelizer::deliver()
+{
+  std::vector<WorkerTask> tasks;
+
+  for (auto &d : m_deliveries) {
+    Demodulator *demod = d.channel->demodulator;
+    ChannelFilter *filter = d.filter;
+    std::vector<SUCOMPLEX> *buffer = d.buffer;
+
+    if (demod != nullptr || filter != nullptr)
+      tasks.push_back(
+            [demod, filter, buffer] () {
+              if (filter != nullptr)
+                filter->process(*buffer);
+              if (demod != nullptr)
+                demod->process(buffer->data(), buffer->size());
+            });
+  }
+
+  if (m_pool != nullptr && tasks.size() > 1) {
+    m_pool->run(tasks);
+  } else {
+    for (auto &t : tasks)
+      t();
+  }
+
+  for (auto &d : m_deliveries) {
+    Demodulator *demod = d.channel->demodulator;
+
+    if (demod != nullptr)
+      d.channel->consumer->samples(demod->output(), demod->size());
+    else
+      d.channel->consumer->samples(d.buffer->data(), d.buffer->size());
+
+    d.buffer->clear();
+  }
+
+  m_deliveries.clear();
+}
+
+Channelizer::~Channelizer()
+{
+}
+
+/////////////////////////////// ChannelFilter //////////////////////////////////
+void
+ChannelFilter::design(SUFLOAT sampRate, SUFLOAT bandwidth)
+{
+  // The transition band of the Blackman window is about 5.5 / len
+  SUFLOAT transition = CHANNEL_FILTER_TRANSITION * bandwidth / sampRate;
+  unsigned int len = static_cast<unsigned>(std::ceil(5.5f / transition)) | 1;
+  SUFLOAT fc, mid;
+  SUFLOAT sum = 0;
+
+  len = std::max<unsigned>(len, CHANNEL_FILTER_MIN_TAPS);
+  len = std::min<unsigned>(len, CHANNEL_FILTER_MAX_TAPS);
+  fc  = .5f * bandwidth / sampRate + 2.75f / len;
+  mid = .5f * (len - 1);
+
+  m_taps.resize(len);
+
+  for (unsigned int i = 0; i < len; ++i) {
+    SUFLOAT t = i - mid;
+    SUFLOAT x = 2 * PI * i / (len - 1);
+    SUFLOAT sinc = t == 0 ? 1 : SU_SIN(2 * PI * fc * t) / (2 * PI * fc * t);
+    SUFLOAT window = .42f - .5f * SU_COS(x) + .08f * SU_COS(2 * x);
+
+    m_taps[i] = sinc * window;
+    sum += m_taps[i];
+  }
+
+  for (auto &h : m_taps)
+    h /= sum;
+
+  m_buffer.assign(len - 1, SUCOMPLEX(0, 0));
+}
+
+//
+// The taps are symmetric, so the convolution is written as a correlation
+// over the buffer (no sample-to-sample dependencies in the inner loop).
+//
+void
+ChannelFilter::process(std::vector<SUCOMPLEX> &samples)
+{
+  size_t len  = m_taps.size();
+  size_t size = samples.size();
+  const SUFLOAT *h = m_taps.data();
+  const SUCOMPLEX *x;
+
+  m_buffer.insert(m_buffer.end(), samples.begin(), samples.end());
+  x = m_buffer.data();
+
+  for (size_t i = 0; i < size; ++i) {
+    SUCOMPLEX acc = 0;
+
+    for (size_t k = 0; k < len; ++k)
+      acc += h[k] * x[i + k];
+
+    samples[i] = acc;
+  }
+
+  m_buffer.erase(m_buffer.begin(), m_buffer.begin() + size);
+}
+
+//////////////////////////////// ChannelizerTap ////////////////////////////////
+ChannelizerTap::ChannelizerTap(Channelizer *channelizer)
+{
+  m_channelizer = channelizer;
+}
+
+ChannelizerTap::~ChannelizerTap()
+{
+  delete m_monitor;
+}
+
+void
+ChannelizerTap::setMonitor(SpectrumMonitor *monitor)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  delete m_monitor;
+  m_monitor = monitor;
+
+  if (m_monitor != nullptr && m_sampRate > 0)
+    m_monitor->setInputRate(m_sampRate);
+}
+
+void
+ChannelizerTap::setForward(ChannelConsumer *consumer)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_forward = consumer;
+
+  // Late start. Under the lock: samples() cannot reach it before this.
+  if (m_forward != nullptr && m_tap != nullptr)
+    m_forward->opened(m_analyzer, m_handle, *m_tap, m_config);
+}
+
+void
+ChannelizerTap::opened(
+    Suscan::Analyzer *analyzer,
+    Suscan::Handle handle,
+    ChannelDescription const &channel,
+    Suscan::Config const &config)
+{
+  if (m_channelizer != nullptr) {
+    std::lock_guard<std::mutex> guard(m_channelizer->mutex());
+    m_channelizer->setInputRate(channel.sampRate);
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_analyzer = analyzer;
+  m_handle   = handle;
+  m_tap      = &channel;
+  m_config   = config;
+
+  m_sampRate = channel.sampRate;
+  if (m_monitor != nullptr)
+    m_monitor->setInputRate(m_sampRate);
+
+  if (m_forward != nullptr)
+    m_forward->opened(analyzer, handle, channel, config);
+}
+
+void
+ChannelizerTap::samples(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  if (m_channelizer != nullptr) {
+    std::lock_guard<std::mutex> guard(m_channelizer->mutex());
+    m_channelizer->feed(samples, size);
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if (m_monitor != nullptr)
+    m_monitor->feed(samples, size);
+
+  if (m_forward != nullptr)
+    m_forward->samples(samples, size);
+}
+
+void
+ChannelizerTap::dropped(SUSCOUNT size)
+{
+  if (m_channelizer != nullptr) {
+    std::lock_guard<std::mutex> guard(m_channelizer->mutex());
+    m_channelizer->dropped(size);
+  }
+
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if (m_forward != nullptr)
+    m_forward->dropped(size);
+}
+
+void
+ChannelizerTap::closed()
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  m_tap = nullptr;
+
+  if (m_forward != nullptr)
+    m_forward->closed();
+}
+
+void
+ChannelizerTap::enableStateChanged(bool)
+{
+}
+
+//////////////////////////////// PfbChannelizer ////////////////////////////////
+PfbChannelizer::PfbChannelizer(SUFLOAT spacing)
+{
+  m_spacing = spacing;
+}
+
+PfbChannelizer::~PfbChannelizer()
+{
+  clear();
+}
+
+void
+PfbChannelizer::clear()
+{
+  if (m_plan != nullptr)
+    SU_FFTW(_destroy_plan)(m_plan);
+
+  if (m_fftBuf != nullptr)
+    SU_FFTW(_free)(m_fftBuf);
+
+  m_plan       = nullptr;
+  m_fftBuf     = nullptr;
+  m_bins       = 0;
+  m_decimation = 0;
+  m_fill       = 0;
+  m_pos        = 0;
+  m_blocks     = 0;
+
+  m_taps.clear();
+  m_history.clear();
+  m_outputs.clear();
+}
+
+unsigned int
+PfbChannelizer::bins() const
+{
+  return m_bins;
+}
+
+SUFLOAT
+PfbChannelizer::binWidth() const
+{
+  return m_bins > 0 ? m_inputRate / m_bins : 0;
+}
+
+//
+// Blackman-windowed sinc. The cutoff is placed at 3/4 of the bin width, so
+// the outputs (2 bins wide) are free of aliasing and channels slightly off
+// the bin center (see addChannel) are not attenuated.
+//
+void
+PfbChannelizer::designPrototype()
+{
+  unsigned int len = m_bins * PFB_TAPS_PER_BRANCH;
+  SUFLOAT fc = .75f / m_bins;
+  SUFLOAT mid = .5f * (len - 1);
+  SUFLOAT sum = 0;
+
+  m_taps.resize(len);
+
+  for (unsigned int i = 0; i < len; ++i) {
+    SUFLOAT t = i - mid;
+    SUFLOAT x = 2 * PI * i / (len - 1);
+    SUFLOAT sinc = t == 0 ? 1 : SU_SIN(2 * PI * fc * t) / (2 * PI * fc * t);
+    SUFLOAT window = .42f - .5f * SU_COS(x) + .08f * SU_COS(2 * x);
+
+    m_taps[i] = sinc * window;
+    sum += m_taps[i];
+  }
+
+  for (auto &h : m_taps)
+    h /= sum;
+}
+
+bool
+PfbChannelizer::setInputRate(SUFLOAT rate)
+{
+  unsigned int bins;
+
+  clear();
+
+  if (m_spacing <= 0 || rate < 2 * m_spacing)
+    return false;
+
+  // Bins are never wider than the requested spacing
+  bins = static_cast<unsigned>(std::ceil(rate / m_spacing));
+  if (bins & 1)
+    ++bins;
+
+  m_inputRate  = rate;
+  m_bins       = bins;
+  m_decimation = bins / 2;
+
+  designPrototype();
+
+  m_history.resize(2 * m_taps.size());
+  m_fftBuf = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(m_bins * sizeof(SU_FFTW(_complex))));
+  m_plan = SU_FFTW(_plan_dft_1d)(
+        static_cast<int>(m_bins),
+        m_fftBuf,
+        m_fftBuf,
+        FFTW_BACKWARD,
+        FFTW_ESTIMATE);
+
+  return m_plan != nullptr;
+}
+
+bool
+PfbChannelizer::addChannel(ChannelDescription *channel)
+{
+  PfbOutput output;
+  SUFLOAT width  = binWidth();
+  SUFLOAT rate   = 2 * width;
+  SUFREQ  offset = channel->offset - m_center;
+  SUFREQ residual;
+  int bin;
+
+  // The passband of each output is 1.5 bins wide
+  if (m_bins == 0 || channel->bandwidth > 1.5f * width)
+    return false;
+
+  if (std::fabs(offset) + channel->bandwidth / 2 > m_inputRate / 2)
+    return false;
+
+  bin      = static_cast<int>(std::floor(offset / width + .5));
+  residual = offset - bin * width;
+
+  // ... around the bin center, not around the channel
+  if (std::fabs(residual) + channel->bandwidth / 2 > .75f * width)
+    return false;
+
+  output.channel = channel;
+  output.bin     = static_cast<unsigned>(bin < 0 ? bin + m_bins : bin);
+  output.phase   = 1;
+  output.step    = SU_C_EXP(SUCOMPLEX(0, -2 * PI * residual / rate));
+  output.filter.design(rate, channel->bandwidth);
+
+  channel->sampRate = rate;
+
+  removeChannel(channel);
+  m_outputs.push_back(output);
+
+  return true;
+}
+
+void
+PfbChannelizer::removeChannel(ChannelDescription *channel)
+{
+  m_outputs.erase(
+        std::remove_if(
+          m_outputs.begin(),
+          m_outputs.end(),
+          [channel] (PfbOutput const &o) { return o.channel == channel; }),
+        m_outputs.end());
+}
+
+//
+// With x[m] the m-th most recent sample and h the prototype, bin k is
+//
+//   y_k[n] = e^(-j2pi kn/N) sum_r e^(j2pi kr/N) sum_q h[qN + r] x[qN + r]
+//
+// i.e. a polyphase sum followed by an inverse FFT. Since n advances N/2
+// samples per block, the leading factor is just (-1)^(k * block).
+//
+void
+PfbChannelizer::computeBlock()
+{
+  SUCOMPLEX *u = reinterpret_cast<SUCOMPLEX *>(m_fftBuf);
+  const SUCOMPLEX *x = m_history.data() + m_pos;
+  const SUFLOAT *h = m_taps.data();
+  bool odd = m_blocks & 1;
+
+  std::fill(u, u + m_bins, SUCOMPLEX(0, 0));
+
+  for (unsigned int q = 0; q < PFB_TAPS_PER_BRANCH; ++q) {
+    for (unsigned int r = 0; r < m_bins; ++r)
+      u[r] += h[r] * x[r];
+
+    h += m_bins;
+    x += m_bins;
+  }
+
+  SU_FFTW(_execute)(m_plan);
+
+  for (auto &o : m_outputs) {
+    if (!o.channel->consumer->isEnabled())
+      continue;
+
+    SUCOMPLEX y = u[o.bin];
+
+    if (odd && (o.bin & 1))
+      y = -y;
+
+    o.buffer.push_back(y * o.phase);
+    o.phase *= o.step;
+
+    // Keep the residual mixer on the unit circle
+    if ((m_blocks & 0xff) == 0)
+      o.phase /= SU_C_ABS(o.phase);
+  }
+
+  ++m_blocks;
+}
+
+void
+PfbChannelizer::feed(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  unsigned int len = static_cast<unsigned>(m_taps.size());
+
+  if (m_bins == 0)
+    return;
+
+  for (SUSCOUNT i = 0; i < size; ++i) {
+    if (m_pos == 0)
+      m_pos = len;
+    --m_pos;
+
+    m_history[m_pos] = m_history[m_pos + len] = samples[i];
+
+    if (++m_fill == m_decimation) {
+      m_fill = 0;
+      computeBlock();
+    }
+  }
+
+  for (auto &o : m_outputs)
+    if (!o.buffer.empty())
+      queue(o.channel, o.buffer, &o.filter);
+
+  deliver();
+}
+
+void
+PfbChannelizer::dropped(SUSCOUNT size)
+{
+  if (m_inputRate <= 0)
+    return;
+
+  for (auto &o : m_outputs)
+    o.channel->consumer->dropped(
+          static_cast<SUSCOUNT>(size * o.channel->sampRate / m_inputRate));
+}
+
+//////////////////////////////// OlsChannelizer ////////////////////////////////
+OlsChannelizer::OlsChannelizer(SUFLOAT resolution)
+{
+  m_resolution = resolution;
+}
+
+OlsChannelizer::~OlsChannelizer()
+{
+  clear();
+}
+
+void
+OlsChannelizer::destroyOutput(OlsOutput &output)
+{
+  if (output.plan != nullptr)
+    SU_FFTW(_destroy_plan)(output.plan);
+
+  if (output.fftBuf != nullptr)
+    SU_FFTW(_free)(output.fftBuf);
+
+  output.plan   = nullptr;
+  output.fftBuf = nullptr;
+}
+
+void
+OlsChannelizer::clear()
+{
+  for (auto &o : m_outputs)
+    destroyOutput(o);
+
+  if (m_plan != nullptr)
+    SU_FFTW(_destroy_plan)(m_plan);
+
+  if (m_timeBuf != nullptr)
+    SU_FFTW(_free)(m_timeBuf);
+
+  if (m_freqBuf != nullptr)
+    SU_FFTW(_free)(m_freqBuf);
+
+  m_plan    = nullptr;
+  m_timeBuf = nullptr;
+  m_freqBuf = nullptr;
+  m_size    = 0;
+  m_overlap = 0;
+  m_fill    = 0;
+
+  m_outputs.clear();
+}
+
+unsigned int
+OlsChannelizer::size() const
+{
+  return m_size;
+}
+
+//
+// Channel filters are N / 4 + 1 taps long, so their transition band is
+// about 22 fs / N wide (Blackman window). The FFT size is chosen so this
+// is at most half the bandwidth of the narrowest channel.
+//
+bool
+OlsChannelizer::setInputRate(SUFLOAT rate)
+{
+  unsigned int size = OLS_MIN_FFT_SIZE;
+
+  clear();
+
+  if (m_resolution <= 0 || rate <= 0)
+    return false;
+
+  while (size < OLS_MAX_FFT_SIZE && size * m_resolution < 44 * rate)
+    size <<= 1;
+
+  m_inputRate = rate;
+  m_size      = size;
+  m_overlap   = size / 4;
+  m_timeBuf   = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(m_size * sizeof(SU_FFTW(_complex))));
+  m_freqBuf   = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(m_size * sizeof(SU_FFTW(_complex))));
+
+  std::fill(
+        reinterpret_cast<SUCOMPLEX *>(m_timeBuf),
+        reinterpret_cast<SUCOMPLEX *>(m_timeBuf) + m_size,
+        SUCOMPLEX(0, 0));
+
+  m_plan = SU_FFTW(_plan_dft_1d)(
+        static_cast<int>(m_size),
+        m_timeBuf,
+        m_freqBuf,
+        FFTW_FORWARD,
+        FFTW_ESTIMATE | FFTW_PRESERVE_INPUT);
+
+  return m_plan != nullptr;
+}
+
+// Lowpass flat up to bw / 2. Only the bins kept by the output are stored.
+void
+OlsChannelizer::designFilter(OlsOutput &output, SUFLOAT bw)
+{
+  unsigned int len = m_overlap + 1;
+  SUFLOAT fc  = .5f * bw / m_inputRate + 2.75f / len;
+  SUFLOAT mid = .5f * (len - 1);
+  SUFLOAT sum = 0;
+  SU_FFTW(_complex) *buf;
+  SU_FFTW(_plan) plan;
+  SUCOMPLEX *h;
+
+  buf  = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(m_size * sizeof(SU_FFTW(_complex))));
+  plan = SU_FFTW(_plan_dft_1d)(
+        static_cast<int>(m_size),
+        buf,
+        buf,
+        FFTW_FORWARD,
+        FFTW_ESTIMATE);
+  h    = reinterpret_cast<SUCOMPLEX *>(buf);
+
+  std::fill(h, h + m_size, SUCOMPLEX(0, 0));
+
+  for (unsigned int i = 0; i < len; ++i) {
+    SUFLOAT t = i - mid;
+    SUFLOAT x = 2 * PI * i / (len - 1);
+    SUFLOAT sinc = t == 0 ? 1 : SU_SIN(2 * PI * fc * t) / (2 * PI * fc * t);
+    SUFLOAT window = .42f - .5f * SU_COS(x) + .08f * SU_COS(2 * x);
+
+    h[i] = sinc * window;
+    sum += sinc * window;
+  }
+
+  SU_FFTW(_execute)(plan);
+
+  output.filter.resize(output.size);
+
+  for (unsigned int m = 0; m < output.size; ++m) {
+    int k = m < output.size / 2
+        ? static_cast<int>(m)
+        : static_cast<int>(m) - static_cast<int>(output.size);
+
+    output.filter[m] = h[(k + m_size) % m_size] / sum;
+  }
+
+  SU_FFTW(_destroy_plan)(plan);
+  SU_FFTW(_free)(buf);
+}
+
+bool
+OlsChannelizer::addChannel(ChannelDescription *channel)
+{
+  OlsOutput output;
+  SUFREQ  offset = channel->offset - m_center;
+  SUFLOAT binWidth = m_inputRate / m_size;
+  SUFLOAT edge;
+  SUFLOAT rate;
+  SUFREQ  residual;
+  unsigned int decimation;
+  unsigned int step = m_size - m_overlap;
+  uint64_t shift;
+
+  if (m_size == 0)
+    return false;
+
+  if (std::fabs(offset) + channel->bandwidth / 2 > m_inputRate / 2)
+    return false;
+
+  // Stopband edge of the channel filter, including the residual offset.
+  // The decimated band must contain it.
+  edge = .5f * channel->bandwidth
+      + 5.5f * m_inputRate / (m_overlap + 1)
+      + .5f * binWidth;
+
+  decimation = m_overlap;
+  while (decimation > 1 && m_inputRate / (2 * decimation) < edge)
+    decimation >>= 1;
+
+  removeChannel(channel);
+
+  rate     = m_inputRate / decimation;
+  output.channel    = channel;
+  output.bin        = static_cast<int>(std::floor(offset / binWidth + .5));
+  output.size       = m_size / decimation;
+  output.decimation = decimation;
+  residual = offset - output.bin * binWidth;
+
+  output.phase      = 1;
+  output.step       = SU_C_EXP(SUCOMPLEX(0, -2 * PI * residual / rate));
+  output.blockPhase = 1;
+  // Mixer phase advance per block. Reduced modulo N to keep precision.
+  shift = static_cast<uint64_t>(output.bin % static_cast<int>(m_size) + m_size);
+  output.blockStep  = SU_C_EXP(
+        SUCOMPLEX(
+          0,
+          -2 * PI * static_cast<SUFLOAT>((shift * step) % m_size) / m_size));
+
+  designFilter(output, channel->bandwidth);
+
+  m_outputs.push_back(output);
+
+  OlsOutput &o = m_outputs.back();
+  o.fftBuf = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(o.size * sizeof(SU_FFTW(_complex))));
+  o.plan = SU_FFTW(_plan_dft_1d)(
+        static_cast<int>(o.size),
+        o.fftBuf,
+        o.fftBuf,
+        FFTW_BACKWARD,
+        FFTW_ESTIMATE);
+
+  channel->sampRate = rate;
+
+  return true;
+}
+
+void
+OlsChannelizer::removeChannel(ChannelDescription *channel)
+{
+  auto it = m_outputs.begin();
+
+  while (it != m_outputs.end()) {
+    if (it->channel == channel) {
+      destroyOutput(*it);
+      it = m_outputs.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void
+OlsChannelizer::computeBlock()
+{
+  const SUCOMPLEX *X = reinterpret_cast<const SUCOMPLEX *>(m_freqBuf);
+  SUFLOAT scale = 1.f / m_size;
+
+  SU_FFTW(_execute)(m_plan);
+
+  for (auto &o : m_outputs) {
+    SUCOMPLEX *y = reinterpret_cast<SUCOMPLEX *>(o.fftBuf);
+    unsigned int half = o.size / 2;
+    unsigned int skip = m_overlap / o.decimation;
+    unsigned int base = static_cast<unsigned>(
+          (o.bin % static_cast<int>(m_size)) + static_cast<int>(m_size));
+
+    if (o.channel->consumer->isEnabled()) {
+      SUCOMPLEX gain = scale * o.blockPhase;
+
+      // Bins [bin - size / 2, bin + size / 2), with negative ones at the end
+      for (unsigned int m = 0; m < half; ++m)
+        y[m] = X[(base + m) % m_size] * o.filter[m];
+
+      for (unsigned int m = half; m < o.size; ++m)
+        y[m] = X[(base + m_size + m - o.size) % m_size] * o.filter[m];
+
+      SU_FFTW(_execute)(o.plan);
+
+      for (unsigned int j = skip; j < o.size; ++j) {
+        o.buffer.push_back(y[j] * gain * o.phase);
+        o.phase *= o.step;
+      }
+
+      o.phase /= SU_C_ABS(o.phase);
+    }
+
+    o.blockPhase *= o.blockStep;
+    o.blockPhase /= SU_C_ABS(o.blockPhase);
+  }
+}
+
+void
+OlsChannelizer::feed(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  SUCOMPLEX *x = reinterpret_cast<SUCOMPLEX *>(m_timeBuf);
+  unsigned int step = m_size - m_overlap;
+
+  if (m_size == 0)
+    return;
+
+  for (SUSCOUNT i = 0; i < size; ++i) {
+    x[m_overlap + m_fill] = samples[i];
+
+    if (++m_fill == step) {
+      computeBlock();
+      std::copy(x + step, x + m_size, x);
+      m_fill = 0;
+    }
+  }
+
+  for (auto &o : m_outputs)
+    if (!o.buffer.empty())
+      queue(o.channel, o.buffer);
+
+  deliver();
+}
+
+void
+OlsChannelizer::dropped(SUSCOUNT size)
+{
+  if (m_inputRate <= 0)
+    return;
+
+  for (auto &o : m_outputs)
+    o.channel->consumer->dropped(
+          static_cast<SUSCOUNT>(size * o.channel->sampRate / m_inputRate));
+}
@@ -0,0 +1,259 @@
+//
+//    Channelizer.h: Plugin-side channelizer engines
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <MultiChannelForwarder.h>
+#include <WorkerPool.h>
+#include <fftw3.h>
+#include <vector>
+#include <list>
+#include <mutex>
+
+// Taps per polyphase branch of the PFB prototype filter
+#define PFB_TAPS_PER_BRANCH 16
+
+// Forward FFT size limits of the overlap-save engine
+#define OLS_MIN_FFT_SIZE 256
+#define OLS_MAX_FFT_SIZE 65536
+
+// Channel filter of PFB outputs: transition band, as a fraction of the
+// channel bandwidth, and length limits
+#define CHANNEL_FILTER_TRANSITION .25
+#define CHANNEL_FILTER_MIN_TAPS   31
+#define CHANNEL_FILTER_MAX_TAPS   1023
+
+//
+// A channelizer takes the raw IQ of a master (delivered by a hidden raw
+// inspector, the "tap") and produces the samples of several channels at
+// once. Channels are expressed as offsets w.r.t. the center of the tap.
+//
+//
+// Lowpass FIR that takes an engine output down to the channel bandwidth,
+// for engines whose outputs are wider than their channels (the PFB).
+// Blackman-windowed sinc, with the passband edge at half the bandwidth.
+// Its length grows with the ratio between the rate and the bandwidth.
+//
+class ChannelFilter {
+  std::vector<SUFLOAT>   m_taps;
+  std::vector<SUCOMPLEX> m_buffer; // Last inputs, then the current block
+
+public:
+  void design(SUFLOAT sampRate, SUFLOAT bandwidth);
+  void process(std::vector<SUCOMPLEX> &); // In place
+};
+
+struct ChannelizerDelivery {
+  ChannelDescription     *channel;
+  std::vector<SUCOMPLEX> *buffer;
+  ChannelFilter          *filter; // Null: already filtered
+};
+
+class Channelizer {
+  std::vector<ChannelizerDelivery> m_deliveries;
+  WorkerPool *m_pool = nullptr;
+  std::mutex m_mutex;
+
+protected:
+  SUFLOAT m_inputRate = 0;
+  SUFREQ  m_center = 0; // Offset of the tap w.r.t. the master
+
+  // Outputs are queued by the engines at the end of feed(). deliver()
+  // runs the channel filters and demodulators (in the worker pool, if
+  // any) and then hands the samples to the consumers, in order, from the
+  // calling thread.
+  void queue(
+      ChannelDescription *,
+      std::vector<SUCOMPLEX> &,
+      ChannelFilter *filter = nullptr);
+  void deliver();
+
+public:
+  SUFLOAT inputRate() const;
+  SUFREQ center() const;
+  void setCenter(SUFREQ);
+  void setWorkerPool(WorkerPool *);
+
+  // Held by the tap while feeding. Channels must be added and removed
+  // with this mutex held, as samples may arrive from another thread.
+  std::mutex &mutex();
+
+  // Called when the tap is opened and its sample rate is known. Existing
+  // channels are dropped.
+  virtual bool setInputRate(SUFLOAT) = 0;
+
+  // Adds a channel to the channelizer, updating its sample rate
+  virtual bool addChannel(ChannelDescription *) = 0;
+  virtual void removeChannel(ChannelDescription *) = 0;
+
+  virtual void feed(const SUCOMPLEX *, SUSCOUNT) = 0;
+
+  // Input samples lost before the next feed(). Each channel consumer is
+  // told how many of its own samples are missing.
+  virtual void dropped(SUSCOUNT) = 0;
+
+  virtual ~Channelizer();
+};
+
+class SpectrumMonitor;
+
+// Consumer of the tap inspector: forwards everything to the channelizer,
+// the spectrum monitor and the IQ consumer of the master, if any.
+class ChannelizerTap : public ChannelConsumer {
+  Channelizer *m_channelizer;
+  SpectrumMonitor *m_monitor = nullptr;
+  ChannelConsumer *m_forward = nullptr; // Not owned
+  SUFLOAT m_sampRate = 0;
+  std::mutex m_mutex; // Protects m_monitor and m_forward
+
+  // Last opened(), replayed to forward consumers set afterwards
+  Suscan::Analyzer *m_analyzer = nullptr;
+  Suscan::Handle m_handle = SUSCAN_INVALID_HANDLE_VALUE;
+  const ChannelDescription *m_tap = nullptr; // Null: closed
+  Suscan::Config m_config;
+
+public:
+  ChannelizerTap(Channelizer *); // May be null (spectrum only)
+
+  // Takes ownership of the monitor (and deletes the previous one)
+  void setMonitor(SpectrumMonitor *);
+
+  // If the tap is open, the consumer is opened before it gets samples
+  void setForward(ChannelConsumer *);
+
+  virtual void opened(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &,
+      Suscan::Config const &) override;
+  virtual void samples(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
+  virtual void closed() override;
+  virtual void enableStateChanged(bool) override;
+
+  virtual ~ChannelizerTap() override;
+};
+
+struct PfbOutput {
+  ChannelDescription    *channel;
+  unsigned int           bin;
+  SUCOMPLEX              phase;    // Residual mixer, corrects grid errors
+  SUCOMPLEX              step;
+  ChannelFilter          filter;   // Down to the channel bandwidth
+  std::vector<SUCOMPLEX> buffer;
+};
+
+//
+// Polyphase filterbank (analysis) for channels on a regular grid. The
+// input is split in N bins of width fs / N with one filtering pass and
+// one FFT every N / 2 samples, so every bin is 2x oversampled. Each
+// channel takes the bin nearest to its center, and the remaining offset
+// (if the grid does not match fs / N exactly) is removed afterwards.
+// Bins pass 1.5 bin widths (parts of their neighbors), so each output is
+// then filtered down to the bandwidth of its channel.
+//
+class PfbChannelizer : public Channelizer {
+  SUFLOAT      m_spacing;
+  unsigned int m_bins       = 0;
+  unsigned int m_decimation = 0;
+  unsigned int m_fill       = 0;
+  unsigned int m_pos        = 0;
+  uint64_t     m_blocks     = 0;
+
+  std::vector<SUFLOAT>   m_taps;
+  std::vector<SUCOMPLEX> m_history; // Twice the filter length, newest first
+  std::vector<PfbOutput> m_outputs;
+
+  SU_FFTW(_complex) *m_fftBuf = nullptr;
+  SU_FFTW(_plan)     m_plan   = nullptr;
+
+  void clear();
+  void designPrototype();
+  void computeBlock();
+
+public:
+  PfbChannelizer(SUFLOAT spacing);
+
+  unsigned int bins() const;
+  SUFLOAT binWidth() const;
+
+  virtual bool setInputRate(SUFLOAT) override;
+  virtual bool addChannel(ChannelDescription *) override;
+  virtual void removeChannel(ChannelDescription *) override;
+  virtual void feed(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
+
+  virtual ~PfbChannelizer() override;
+};
+
+struct OlsOutput {
+  ChannelDescription     *channel;
+  int                     bin;        // Bin of the channel center
+  unsigned int            size;       // Inverse FFT size
+  unsigned int            decimation;
+  std::vector<SUCOMPLEX>  filter;     // Frequency response around the bin
+  SUCOMPLEX               blockPhase; // Mixer phase at the current block
+  SUCOMPLEX               blockStep;
+  SUCOMPLEX               phase;      // Residual mixer, below one bin
+  SUCOMPLEX               step;
+  SU_FFTW(_complex)      *fftBuf = nullptr;
+  SU_FFTW(_plan)          plan   = nullptr;
+  std::vector<SUCOMPLEX>  buffer;
+};
+
+//
+// Overlap-save fast convolution filterbank for channels at arbitrary
+// positions. The tap goes through one forward FFT of size N per block of
+// 3N/4 new samples. Every channel then multiplies the N/D bins around its
+// center by the response of its own filter and takes an inverse FFT of
+// size N/D, which filters, mixes and decimates by D in a single step.
+//
+class OlsChannelizer : public Channelizer {
+  SUFLOAT      m_resolution;
+  unsigned int m_size    = 0; // Forward FFT size
+  unsigned int m_overlap = 0; // Filter length - 1
+  unsigned int m_fill    = 0;
+
+  SU_FFTW(_complex) *m_timeBuf = nullptr;
+  SU_FFTW(_complex) *m_freqBuf = nullptr;
+  SU_FFTW(_plan)     m_plan    = nullptr;
+
+  std::list<OlsOutput> m_outputs;
+
+  void clear();
+  void destroyOutput(OlsOutput &);
+  void designFilter(OlsOutput &, SUFLOAT);
+  void computeBlock();
+
+public:
+  OlsChannelizer(SUFLOAT resolution);
+
+  unsigned int size() const;
+
+  virtual bool setInputRate(SUFLOAT) override;
+  virtual bool addChannel(ChannelDescription *) override;
+  virtual void removeChannel(ChannelDescription *) override;
+  virtual void feed(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
+
+  virtual ~OlsChannelizer() override;
+};
+
+#endif // CHANNELIZER_H
@@ -0,0 +1,208 @@
+//
+//    ConsumerPool.cpp: Worker threads for channel consumers
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "ConsumerPool.h"
+#include "Affinity.h"
+
+ConsumerPool::ConsumerPool(unsigned int threads)
+{
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency() / 2;
+    if (threads == 0)
+      threads = 1;
+  }
+
+  for (unsigned int i = 0; i < threads; ++i)
+    m_workers.push_back(new ConsumerWorker);
+
+  for (auto w : m_workers)
+    w->thread = std::thread(&ConsumerPool::run, this, w);
+}
+
+ConsumerPool::~ConsumerPool()
+{
+  for (auto w : m_workers) {
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->stop = true;
+    }
+
+    w->wakeUp.notify_all();
+  }
+
+  for (auto w : m_workers) {
+    w->thread.join();
+    delete w;
+  }
+}
+
+unsigned int
+ConsumerPool::size() const
+{
+  return static_cast<unsigned>(m_workers.size());
+}
+
+void
+ConsumerPool::run(ConsumerWorker *w)
+{
+  ConsumerJob job;
+
+  for (;;) {
+    bool repin = false;
+    int cpu = -1;
+
+    {
+      std::unique_lock<std::mutex> lock(w->mutex);
+
+      // Previous job done: give its buffer back
+      if (job.consumer != nullptr) {
+        if (w->spare.size() < CONSUMER_POOL_MAX_QUEUE)
+          w->spare.push_back(std::move(job.samples));
+        job.consumer = nullptr;
+        ++w->done;
+        w->progress.notify_all();
+      }
+
+      w->wakeUp.wait(
+            lock,
+            [w] () { return w->stop || w->repin || !w->jobs.empty(); });
+
+      if (w->repin) {
+        repin    = true;
+        cpu      = w->cpu;
+        w->repin = false;
+      }
+
+      // Stop only after draining the queue
+      if (!w->jobs.empty()) {
+        job = std::move(w->jobs.front());
+        w->jobs.pop_front();
+        w->progress.notify_all();
+      } else if (w->stop) {
+        return;
+      }
+    }
+
+    if (repin)
+      pin(w, cpu);
+
+    if (job.consumer != nullptr) {
+      if (job.dropped > 0)
+        job.consumer->dropped(job.dropped);
+      job.consumer->samples(job.samples.data(), job.samples.size());
+    }
+  }
+}
+
+//
+// Runs in the worker itself. Pages are placed in the NUMA node of the
+// thread that touches them first, so the buffers allocated by the
+// previous placement are dropped and new ones are touched from here.
+//
+void
+ConsumerPool::pin(ConsumerWorker *w, int cpu)
+{
+  std::vector<std::vector<SUCOMPLEX>> local(CONSUMER_POOL_LOCAL_BUFFERS);
+  SUSCOUNT block;
+
+  if (cpu < 0)
+    setCurrentThreadAffinity(std::vector<int>());
+  else
+    setCurrentThreadAffinity(std::vector<int>(1, cpu));
+
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    block = w->block > 0 ? w->block : CONSUMER_POOL_DEFAULT_BLOCK;
+  }
+
+  for (auto &buffer : local) {
+    buffer.resize(block);
+    buffer.clear();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(w->mutex);
+    w->spare = std::move(local);
+  }
+}
+
+void
+ConsumerPool::push(
+    unsigned int index,
+    ChannelConsumer *consumer,
+    const SUCOMPLEX *samples,
+    SUSCOUNT size,
+    SUSCOUNT dropped)
+{
+  ConsumerWorker *w = m_workers[index % m_workers.size()];
+
+  {
+    std::unique_lock<std::mutex> lock(w->mutex);
+
+    w->progress.wait(
+          lock,
+          [w] () { return w->jobs.size() < CONSUMER_POOL_MAX_QUEUE; });
+
+    w->jobs.push_back(ConsumerJob());
+
+    ConsumerJob &job = w->jobs.back();
+
+    if (!w->spare.empty()) {
+      job.samples = std::move(w->spare.back());
+      w->spare.pop_back();
+    }
+
+    job.consumer = consumer;
+    job.dropped  = dropped;
+    job.samples.assign(samples, samples + size);
+    ++w->queued;
+
+    if (size > w->block)
+      w->block = size;
+  }
+
+  w->wakeUp.notify_one();
+}
+
+void
+ConsumerPool::wait()
+{
+  for (auto w : m_workers) {
+    std::unique_lock<std::mutex> lock(w->mutex);
+    uint64_t target = w->queued;
+
+    w->progress.wait(lock, [w, target] () { return w->done >= target; });
+  }
+}
+
+void
+ConsumerPool::setAffinity(std::vector<int> const &cpus)
+{
+  for (unsigned int i = 0; i < m_workers.size(); ++i) {
+    ConsumerWorker *w = m_workers[i];
+
+    {
+      std::lock_guard<std::mutex> lock(w->mutex);
+      w->cpu   = cpus.empty() ? -1 : cpus[i % cpus.size()];
+      w->repin = true;
+    }
+
+    w->wakeUp.notify_all();
+  }
+}
@@ -0,0 +1,95 @@
+//
+//    ConsumerPool.h: Worker threads for channel consumers
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef CONSUMERPOOL_H
+#define CONSUMERPOOL_H
+
+#include <MultiChannelForwarder.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Blocks waiting in a worker before producers are made to wait
+#define CONSUMER_POOL_MAX_QUEUE 256
+
+// Sample buffers a worker allocates (and touches) itself after being
+// pinned, so that they live in its NUMA node. Size of each buffer when no
+// block has been seen yet.
+#define CONSUMER_POOL_LOCAL_BUFFERS 32
+#define CONSUMER_POOL_DEFAULT_BLOCK 4096
+
+struct ConsumerJob {
+  ChannelConsumer       *consumer = nullptr;
+  std::vector<SUCOMPLEX> samples;
+  SUSCOUNT               dropped = 0; // Reported before the samples
+};
+
+struct ConsumerWorker {
+  std::thread             thread;
+  std::mutex              mutex;
+  std::condition_variable wakeUp;   // Jobs available (or stop)
+  std::condition_variable progress; // A job was taken or finished
+  std::deque<ConsumerJob> jobs;
+  std::vector<std::vector<SUCOMPLEX>> spare; // Recycled sample buffers
+  uint64_t                queued = 0;
+  uint64_t                done   = 0;
+  SUSCOUNT                block  = 0;     // Largest block pushed so far
+  int                     cpu    = -1;    // -1: any
+  bool                    repin  = false; // cpu changed
+  bool                    stop   = false;
+};
+
+//
+// Runs ChannelConsumer::samples() asynchronously in a fixed set of
+// threads. Every channel is bound to one worker, which processes its
+// blocks in the same order they were pushed: order is kept per channel,
+// while different channels run in parallel.
+//
+class ConsumerPool {
+  std::vector<ConsumerWorker *> m_workers;
+
+  void run(ConsumerWorker *);
+  void pin(ConsumerWorker *, int cpu);
+
+public:
+  ConsumerPool(unsigned int threads = 0); // 0: half the cores
+  unsigned int size() const;
+
+  // Copies the samples. Blocks if the worker is too far behind. Samples
+  // lost right before these are reported first, with dropped().
+  void push(
+      unsigned int worker,
+      ChannelConsumer *,
+      const SUCOMPLEX *,
+      SUSCOUNT,
+      SUSCOUNT dropped = 0);
+
+  // Returns when everything pushed so far has been consumed
+  void wait();
+
+  // Worker i runs on cpus[i % cpus.size()] (empty: no restriction)
+  void setAffinity(std::vector<int> const &cpus);
+
+  ~ConsumerPool();
+};
+
+#endif // CONSUMERPOOL_H
@@ -0,0 +1,149 @@
+//
+//    ControlServer.cpp: Request / reply endpoint for channel management
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "ControlServer.h"
+#include <QJsonDocument>
+#include <QSocketNotifier>
+
+ControlServer::ControlServer(QObject *parent) : QObject(parent)
+{
+}
+
+ControlServer::~ControlServer()
+{
+  unbind();
+  m_zmq_ctx.close();
+}
+
+bool
+ControlServer::bind(const char *url)
+{
+  if (m_zmq_socket != nullptr)
+    return false;
+
+  m_zmq_socket = new zmq::socket_t(m_zmq_ctx, zmq::socket_type::rep);
+  m_zmq_socket->set(zmq::sockopt::linger, 0);
+
+  try {
+    m_zmq_socket->bind(url);
+  } catch (zmq::error_t &) {
+    delete m_zmq_socket;
+    m_zmq_socket = nullptr;
+    throw;
+  }
+
+  m_notifier = new QSocketNotifier(
+        m_zmq_socket->get(zmq::sockopt::fd),
+        QSocketNotifier::Read,
+        this);
+
+  connect(
+        m_notifier,
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        SIGNAL(activated(QSocketDescriptor,QSocketNotifier::Type)),
+#else
+        SIGNAL(activated(int)),
+#endif
+        this,
+        SLOT(onActivated()));
+
+  return true;
+}
+
+void
+ControlServer::unbind()
+{
+  if (m_notifier != nullptr) {
+    delete m_notifier;
+    m_notifier = nullptr;
+  }
+
+  if (m_zmq_socket != nullptr) {
+    delete m_zmq_socket;
+    m_zmq_socket = nullptr;
+  }
+}
+
+bool
+ControlServer::isBound() const
+{
+  return m_zmq_socket != nullptr;
+}
+
+QJsonObject
+ControlServer::process(QByteArray const &data)
+{
+  QJsonParseError parseError;
+  QJsonDocument doc = QJsonDocument::fromJson(data, &parseError);
+  QJsonObject reply;
+
+  if (!doc.isObject()) {
+    reply["ok"]    = false;
+    reply["error"] = "Malformed request: " + parseError.errorString();
+    return reply;
+  }
+
+  if (!doc.object()["command"].isString()) {
+    reply["ok"]    = false;
+    reply["error"] = QString("Malformed request: no command");
+    return reply;
+  }
+
+  emit command(doc.object(), reply);
+
+  if (!reply.contains("ok")) {
+    reply["ok"]    = false;
+    reply["error"] = "Unknown command `" + doc.object()["command"].toString() + "'";
+  }
+
+  return reply;
+}
+
+//
+// The descriptor of a ZeroMQ socket only signals that its state changed:
+// every request already queued must be served here, as no other
+// notification will arrive for them.
+//
+void
+ControlServer::onActivated()
+{
+  m_notifier->setEnabled(false);
+
+  while (m_zmq_socket != nullptr
+         && (m_zmq_socket->get(zmq::sockopt::events) & ZMQ_POLLIN)) {
+    zmq::message_t part;
+    QByteArray request, reply;
+
+    if (!m_zmq_socket->recv(part, zmq::recv_flags::dontwait))
+      break;
+
+    // Multipart requests are taken as a single one
+    request.append(static_cast<const char *>(part.data()), part.size());
+    while (part.more()) {
+      (void) m_zmq_socket->recv(part);
+      request.append(static_cast<const char *>(part.data()), part.size());
+    }
+
+    reply = QJsonDocument(process(request)).toJson(QJsonDocument::Compact);
+    m_zmq_socket->send(zmq::buffer(reply.constData(), reply.size()));
+  }
+
+  if (m_notifier != nullptr)
+    m_notifier->setEnabled(true);
+}
@@ -0,0 +1,64 @@
+//
+//    ControlServer.h: Request / reply endpoint for channel management
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <zmq.hpp>
+
+class QSocketNotifier;
+
+//
+// ZeroMQ REP endpoint to manage the channels from scripts. Every request
+// is a JSON object with a "command" field plus its arguments, and gets a
+// JSON object back with "ok" set to true or false (with an "error" message
+// in the latter case). Requests are handled in the thread of the server
+// (the GUI thread) by the slot connected to command(), which fills the
+// reply. The reply is passed by reference, so that slot must be connected
+// with Qt::DirectConnection. Replies nobody filled are reported as unknown
+// commands.
+//
+class ControlServer : public QObject
+{
+  Q_OBJECT
+
+  zmq::context_t m_zmq_ctx;
+  zmq::socket_t *m_zmq_socket = nullptr;
+  QSocketNotifier *m_notifier = nullptr;
+
+  QJsonObject process(QByteArray const &);
+
+public:
+  ControlServer(QObject *parent = nullptr);
+  ~ControlServer() override;
+
+  bool bind(const char *url); // Throws zmq::error_t
+  void unbind();
+  bool isBound() const;
+
+signals:
+  void command(QJsonObject const &request, QJsonObject &reply);
+
+public slots:
+  void onActivated();
+};
+
+#endif // CONTROLSERVER_H
@@ -0,0 +1,165 @@
+//
+//    Demodulator.cpp: Plugin-side audio demodulators
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "Demodulator.h"
+#include <algorithm>
+#include <cmath>
+
+Demodulator::Demodulator(
+    ChannelDemodulator type,
+    SUFLOAT sampRate,
+    SUFLOAT bandwidth)
+{
+  SUFLOAT shift;
+
+  m_type      = type;
+  m_sampRate  = sampRate;
+  m_bandwidth = bandwidth;
+
+  switch (type) {
+    case CHANNEL_DEMOD_USB:
+    case CHANNEL_DEMOD_LSB:
+      // USB: lower edge to DC. LSB: upper edge to DC.
+      shift = type == CHANNEL_DEMOD_USB ? .5f * bandwidth : -.5f * bandwidth;
+
+      // One extra entry: the phase advance of a full block
+      m_rotator.resize(DEMODULATOR_BLOCK_SIZE + 1);
+      for (unsigned int i = 0; i <= DEMODULATOR_BLOCK_SIZE; ++i)
+        m_rotator[i] = SU_C_EXP(SUCOMPLEX(0, 2 * PI * shift * i / sampRate));
+      break;
+
+    case CHANNEL_DEMOD_AM:
+      m_alpha = static_cast<SUFLOAT>(
+            1 - std::exp(
+              -DEMODULATOR_BLOCK_SIZE / (DEMODULATOR_AM_TAU * sampRate)));
+      break;
+
+    case CHANNEL_DEMOD_FM:
+      m_fmGain = sampRate / (PI * bandwidth);
+      break;
+
+    default:
+      break;
+  }
+
+  m_scratch.resize(DEMODULATOR_BLOCK_SIZE);
+}
+
+ChannelDemodulator
+Demodulator::type() const
+{
+  return m_type;
+}
+
+const SUCOMPLEX *
+Demodulator::output() const
+{
+  return m_output.data();
+}
+
+SUSCOUNT
+Demodulator::size() const
+{
+  return m_output.size();
+}
+
+void
+Demodulator::ssb(const SUCOMPLEX *x, SUCOMPLEX *y, SUSCOUNT size)
+{
+  const SUCOMPLEX *rot = m_rotator.data();
+  SUCOMPLEX phase = m_phase;
+
+  for (SUSCOUNT i = 0; i < size; ++i)
+    y[i] = 2 * SU_C_REAL(x[i] * rot[i] * phase);
+
+  m_phase *= rot[size];
+  m_phase /= SU_C_ABS(m_phase);
+}
+
+void
+Demodulator::am(const SUCOMPLEX *x, SUCOMPLEX *y, SUSCOUNT size)
+{
+  SUFLOAT sum = 0;
+  SUFLOAT gain;
+
+  for (SUSCOUNT i = 0; i < size; ++i) {
+    SUFLOAT re = SU_C_REAL(x[i]);
+    SUFLOAT im = SU_C_IMAG(x[i]);
+    SUFLOAT env = SU_SQRT(re * re + im * im);
+
+    y[i] = env;
+    sum += env;
+  }
+
+  if (m_level == 0)
+    m_level = sum / size;
+  else
+    m_level += m_alpha * (sum / size - m_level);
+
+  gain = m_level > 0 ? 1 / m_level : 0;
+
+  for (SUSCOUNT i = 0; i < size; ++i)
+    y[i] = SU_C_REAL(y[i]) * gain - 1;
+}
+
+void
+Demodulator::fm(const SUCOMPLEX *x, SUCOMPLEX *y, SUSCOUNT size)
+{
+  SUCOMPLEX *prod = m_scratch.data();
+
+  prod[0] = x[0] * SU_C_CONJ(m_last);
+  for (SUSCOUNT i = 1; i < size; ++i)
+    prod[i] = x[i] * SU_C_CONJ(x[i - 1]);
+
+  for (SUSCOUNT i = 0; i < size; ++i)
+    y[i] = m_fmGain * SU_ATAN2(SU_C_IMAG(prod[i]), SU_C_REAL(prod[i]));
+
+  m_last = x[size - 1];
+}
+
+void
+Demodulator::process(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  m_output.resize(size);
+
+  for (SUSCOUNT p = 0; p < size; p += DEMODULATOR_BLOCK_SIZE) {
+    SUSCOUNT chunk = std::min<SUSCOUNT>(DEMODULATOR_BLOCK_SIZE, size - p);
+    const SUCOMPLEX *x = samples + p;
+    SUCOMPLEX *y = m_output.data() + p;
+
+    switch (m_type) {
+      case CHANNEL_DEMOD_USB:
+      case CHANNEL_DEMOD_LSB:
+        ssb(x, y, chunk);
+        break;
+
+      case CHANNEL_DEMOD_AM:
+        am(x, y, chunk);
+        break;
+
+      case CHANNEL_DEMOD_FM:
+        fm(x, y, chunk);
+        break;
+
+      default:
+        std::copy(x, x + chunk, y);
+        break;
+    }
+  }
+}
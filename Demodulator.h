@@ -0,0 +1,79 @@
+//
+//    Demodulator.h: Plugin-side audio demodulators
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef DEMODULATOR_H
+#define DEMODULATOR_H
+
+#include <MultiChannelForwarder.h>
+#include <vector>
+
+// Samples processed per inner loop. Loops are written so that the
+// compiler can vectorize them (no sample-to-sample dependencies).
+#define DEMODULATOR_BLOCK_SIZE 256
+
+// Time constant of the AM carrier level estimator, in seconds
+#define DEMODULATOR_AM_TAU 0.1
+
+//
+// Demodulates the (baseband, channel-centered) output of a channelizer
+// into real audio at the same sample rate. Audio is stored in the real
+// part of the output, as the ZeroMQ sink expects from audio channels.
+//
+//   USB/LSB: the channel is shifted by +/- bw / 2 so that the suppressed
+//            carrier sits at DC and the real part is taken. This relies on
+//            the input being filtered to +/- bw / 2 (both engines do it),
+//            so that nothing is left on the other side of DC to fold.
+//   AM:      envelope, normalized by the average carrier level.
+//   FM:      quadrature discriminator, full scale at +/- bw / 2.
+//
+class Demodulator {
+  ChannelDemodulator m_type;
+  SUFLOAT m_sampRate;
+  SUFLOAT m_bandwidth;
+
+  // SSB
+  std::vector<SUCOMPLEX> m_rotator; // Mixer phasors for one block
+  SUCOMPLEX m_phase = 1;
+
+  // AM
+  SUFLOAT m_level = 0;
+  SUFLOAT m_alpha = 0;
+
+  // FM
+  SUCOMPLEX m_last = 1;
+  SUFLOAT m_fmGain = 1;
+
+  std::vector<SUCOMPLEX> m_scratch;
+  std::vector<SUCOMPLEX> m_output;
+
+  void ssb(const SUCOMPLEX *, SUCOMPLEX *, SUSCOUNT);
+  void am(const SUCOMPLEX *, SUCOMPLEX *, SUSCOUNT);
+  void fm(const SUCOMPLEX *, SUCOMPLEX *, SUSCOUNT);
+
+public:
+  Demodulator(ChannelDemodulator, SUFLOAT sampRate, SUFLOAT bandwidth);
+
+  ChannelDemodulator type() const;
+  void process(const SUCOMPLEX *, SUSCOUNT);
+
+  const SUCOMPLEX *output() const;
+  SUSCOUNT size() const;
+};
+
+#endif // DEMODULATOR_H
@@ -19,9 +19,21 @@
 //
 
 #include "MultiChannelForwarder.h"
+#include "Channelizer.h"
+#include "Demodulator.h"
+#include "WorkerPool.h"
+#include "ConsumerPool.h"
+#include "SpectrumMonitor.h"
 #include <memory>
 #include <string>
 #include <cstdio>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_set>
 
 void
 ChannelConsumer::setEnabled(bool enabled)
@@ -38,14 +50,86 @@ ChannelConsumer::isEnabled() const
   return m_enabled;
 }
 
+bool
+ChannelConsumer::syncEnableState(bool)
+{
+  return false;
+}
+
+void
+ChannelConsumer::dropped(SUSCOUNT)
+{
+}
+
+void
+ChannelConsumer::retuned(
+    Suscan::Analyzer *analyzer,
+    Suscan::Handle handle,
+    ChannelDescription const &channel)
+{
+  analyzer->setInspectorFreq(handle, channel.loFreq);
+}
+
+ChannelDemodulator
+ChannelConsumer::channelDemodulator() const
+{
+  return CHANNEL_DEMOD_NONE;
+}
+
+bool
+ChannelConsumer::canUpdateFrom(ChannelConsumer const &) const
+{
+  return false;
+}
+
+void
+ChannelConsumer::updateFrom(ChannelConsumer const &)
+{
+}
+
+bool
+ChannelConsumer::configuresInspector() const
+{
+  return false;
+}
+
+bool
+ChannelConsumer::sharesInspectorWith(ChannelConsumer const &consumer) const
+{
+  return !configuresInspector() && !consumer.configuresInspector();
+}
+
 
 ChannelConsumer::~ChannelConsumer()
 {
 }
 
+SpectrumConsumer::~SpectrumConsumer()
+{
+}
+
 ChannelDescription::~ChannelDescription()
 {
   delete consumer;
+  delete demodulator;
+}
+
+// There is no master inspector to pause the channels of a direct master,
+// so they stop demodulating instead, as disabled channels do
+bool
+ChannelDescription::inUse() const
+{
+  if (parent->direct && !parent->enabled)
+    return false;
+
+  if (consumer->isEnabled())
+    return true;
+
+  for (auto s : sharers)
+    if (s->consumer->isEnabled())
+      return true;
+
+  return false;
 }
 
 void
@@ -58,29 +142,67 @@ MasterChannel::setEnabled(bool enabled)
     }
 
     this->enabled = enabled;
+    owner->changed(this, true);
+
+    // Paused direct masters are dropped by the dispatch path
+    owner->publishDispatchTable();
   }
 }
 
+bool
+MasterChannel::hasPendingChannels() const
+{
+  for (auto &c : channels)
+    if (c.opening)
+      return true;
+
+  return tap != nullptr && tap->opening;
+}
+
 ChannelListIterator
 MultiChannelForwarder::deleteChannel(ChannelListIterator it)
 {
   ChannelDescription *channel = &*it;
   bool opened = channel->isOpen();
 
-  // First: remove channel from the channel hash
-  channelHash.erase(channel->name);
+  // Zeroth: stop sharing the inspector of its owner. Sharers left behind
+  // by an owner (only when the whole master goes) become plain channels.
+  if (channel->owner != nullptr) {
+    auto &sharers = channel->owner->sharers;
+    sharers.erase(std::find(sharers.begin(), sharers.end(), channel));
+    channel->owner = nullptr;
+    publishDispatchTable();
+  }
+
+  for (auto s : channel->sharers)
+    s->owner = nullptr;
+  channel->sharers.clear();
+
+  // First: remove channel from the channel hash, unless a new channel
+  // took its name while its removal was delayed
+  auto entry = channelHash.find(channel->name);
+  if (entry != channelHash.end() && entry->second == channel)
+    channelHash.erase(entry);
 
   // Second: If it is either in the pending or opened maps, remove from them
-  if (opened)
-    channelMap.erase(channel->handle);
-  else if (channel->opening)
-    pendingChannelMap.erase(channel->reqId);
+  if (channel->attached) {
+    std::lock_guard<std::mutex> guard(channel->parent->channelizer->mutex());
+    channel->parent->channelizer->removeChannel(channel);
+  } else if (opened) {
+    channelMap.erase(AnalyzerHandle(channel->parent->analyzer, channel->handle));
+    publishDispatchTable();
+  } else if (channel->opening) {
+    pendingChannelMap.erase(AnalyzerRequest(channel->parent->analyzer, channel->reqId));
+  }
 
   // Third: delete channel from the corresponding master. If opened, decrease counter
   // This automatically triggers the destructor
-  if (opened && channel->parent->isOpen())
+  if (opened && channel->parent->isReady())
     --channel->parent->open_count;
 
+  // Its consumer may still have samples in flight
+  synchronizeDispatch();
+
   auto next = channel->parent->channels.erase(it);
 
   // Done!
@@ -98,8 +220,18 @@ MultiChannelForwarder::deleteMaster(MasterListIterator it)
   // First: remove from the masterList
   auto next = masterList.erase(it);
 
-  // Second: remove form the master hash
-  masterHash.erase(master->name);
+  // Second: remove form the master hash. All its channels leave the
+  // dispatch path at once.
+  auto entry = masterHash.find(master->name);
+  if (entry != masterHash.end() && entry->second == master)
+    masterHash.erase(entry);
+  unmapMaster(master);
+  dropTap(master);
+
+  delete master->spectrum;
+  delete master->iq;
+  master->spectrum = nullptr;
+  master->iq       = nullptr;
 
   // Third: traverse all channels and delete them one by one
   while (!master->channels.empty()) {
@@ -109,9 +241,9 @@ MultiChannelForwarder::deleteMaster(MasterListIterator it)
 
   // Delete from the rest of maps
   if (opened)
-    masterMap.erase(master->handle);
+    masterMap.erase(AnalyzerHandle(master->analyzer, master->handle));
   else if (master->opening)
-    pendingMasterMap.erase(master->reqId);
+    pendingMasterMap.erase(AnalyzerRequest(master->analyzer, master->reqId));
 
   // Also, deleting the master implies recalculating the frequency limits
   m_freqMin = +INFINITY;
@@ -134,6 +266,11 @@ MultiChannelForwarder::reset()
 {
   auto j = masterList.begin();
 
+  // Handles are forgotten below: stop dispatching samples first
+  channelMap.clear();
+  publishDispatchTable();
+  synchronizeDispatch();
+
   while (j != masterList.end()) {
     auto p = *j;
 
@@ -146,11 +283,18 @@ MultiChannelForwarder::reset()
       p->handle     = SUSCAN_INVALID_HANDLE_VALUE;
       p->opening    = false;
       p->open_count = 0;
+      p->suspended  = false;
+      p->direct     = false;
+      p->analyzer   = nullptr;
+
+      changed(p, true);
+      dropTap(p);
 
       while (i != p->channels.end()) {
         // Channel was deleted? Delete now.
         i->handle    = SUSCAN_INVALID_HANDLE_VALUE;
         i->opening   = false;
+        i->attached  = false;
 
         if (i->deleted)
           i = deleteChannel(i);
@@ -168,6 +312,8 @@ MultiChannelForwarder::reset()
   channelMap.clear();
   pendingChannelMap.clear();
 
+  m_standby.clear();
+
   m_opening = false;
   m_opened = false;
   clearErrors();
@@ -176,15 +322,15 @@ MultiChannelForwarder::reset()
 void
 MultiChannelForwarder::updateMasterConfig(MasterChannel *master)
 {
-  if (m_analyzer != nullptr && master->isOpen())
-    m_analyzer->setInspectorConfig(master->handle, master->config);
+  if (master->analyzer != nullptr && master->isOpen())
+    master->analyzer->setInspectorConfig(master->handle, master->config);
 }
 
 void
 MultiChannelForwarder::setAnalyzer(Suscan::Analyzer *analyzer)
 {
   // NO-OP
-  if (analyzer == m_analyzer)
+  if (analyzer == m_analyzer && m_analyzers.size() <= 1)
     return;
 
   if (m_analyzer != nullptr)
@@ -193,256 +339,1380 @@ MultiChannelForwarder::setAnalyzer(Suscan::Analyzer *analyzer)
     reset();
 
   m_analyzer = analyzer;
-}
-
-void
-MultiChannelForwarder::adjustLo()
-{
-  if (m_analyzer != nullptr) {
-    Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
-    SUFREQ tunerFreq = info.getFrequency();
+  m_analyzers.clear();
 
-    for (auto p : masterList) {
-      SUFREQ lo = p->frequency - tunerFreq;
-      if (p->isOpen())
-        m_analyzer->setInspectorFreq(p->handle, lo);
-    }
-  }
+  if (analyzer != nullptr)
+    m_analyzers.push_back(analyzer);
 }
 
 bool
-MultiChannelForwarder::canOpen() const
+MultiChannelForwarder::addAnalyzer(Suscan::Analyzer *analyzer)
 {
-  if (m_analyzer != nullptr) {
-    Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
-    SUFREQ tunerFreq   = info.getFrequency();
-    SUFREQ sampleRate  = info.getSampleRate();
-    SUFREQ currFreqMin = tunerFreq - sampleRate / 2;
-    SUFREQ currFreqMax = tunerFreq + sampleRate / 2;
-
-    if (!canCenter())
-      return false;
+  if (analyzer == nullptr
+      || std::find(m_analyzers.begin(), m_analyzers.end(), analyzer)
+         != m_analyzers.end())
+    return false;
 
-    return currFreqMin < m_freqMin && m_freqMax < currFreqMax;
-  }
+  m_analyzers.push_back(analyzer);
 
-  return false;
-}
+  if (m_analyzer == nullptr)
+    m_analyzer = analyzer;
 
-SUFREQ
-MultiChannelForwarder::span() const
-{
-  return m_freqMax - m_freqMin;
-}
+  // Suspended masters may fit in the new analyzer
+  retune();
+  flushLo();
 
-SUFREQ
-MultiChannelForwarder::getCenter() const
-{
-  return .5 * (m_freqMax + m_freqMin);
+  return true;
 }
 
 bool
-MultiChannelForwarder::canCenter() const
+MultiChannelForwarder::removeAnalyzer(Suscan::Analyzer *analyzer)
 {
-  if (m_analyzer == nullptr)
+  auto it = std::find(m_analyzers.begin(), m_analyzers.end(), analyzer);
+
+  if (it == m_analyzers.end())
     return false;
 
-  Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
+  if (m_analyzers.size() == 1) {
+    setAnalyzer(nullptr);
+    return true;
+  }
 
-  if (span() > info.getSampleRate())
-    return false;
+  // Forget about everything opened (or being opened) on this analyzer.
+  // Masters are reassigned to the remaining analyzers if possible.
+  for (auto p : masterList) {
+    if (p->analyzer != analyzer)
+      continue;
 
-  return true;
-}
+    if (p->opening) {
+      pendingMasterMap.erase(AnalyzerRequest(analyzer, p->reqId));
+      p->opening = false;
+    }
 
-bool
-MultiChannelForwarder::center()
-{
-  SUFREQ tunerFreq;
+    for (auto &c : p->channels) {
+      if (c.opening) {
+        pendingChannelMap.erase(AnalyzerRequest(analyzer, c.reqId));
+        c.opening = false;
+      }
+    }
 
-  if (!canCenter())
-    return false;
+    if (p->isReady())
+      suspendMaster(p);
+
+    p->analyzer  = nullptr;
+    p->suspended = true;
+    changed(p, true);
+  }
 
-  tunerFreq = .5 * (m_freqMax + m_freqMin);
+  m_analyzers.erase(it);
+  m_analyzer = m_analyzers.front();
 
-  m_analyzer->setFrequency(tunerFreq);
+  retune();
+  flushLo();
 
   return true;
 }
 
-bool
-MultiChannelForwarder::isOpen() const
+std::vector<Suscan::Analyzer *> const &
+MultiChannelForwarder::analyzers() const
 {
-  return m_opened;
+  return m_analyzers;
 }
 
-bool
-MultiChannelForwarder::isPartiallyOpen() const
+SourceInfoMap
+MultiChannelForwarder::sourceInfos() const
 {
-  return m_opened || m_opening;
+  SourceInfoMap infos;
+
+  for (auto a : m_analyzers)
+    infos.insert(std::make_pair(a, a->getSourceInfo()));
+
+  return infos;
 }
 
-MasterChannel *
-MultiChannelForwarder::getMasterFromRequest(Suscan::RequestId reqId) const
+// Pick the analyzer that leaves the largest margin around the master
+Suscan::Analyzer *
+MultiChannelForwarder::findAnalyzer(
+    const MasterChannel *master,
+    SourceInfoMap const &infos) const
 {
-  auto it = pendingMasterMap.find(reqId);
+  Suscan::Analyzer *best = nullptr;
+  SUFREQ bestMargin = 0;
+
+  for (auto a : m_analyzers) {
+    Suscan::AnalyzerSourceInfo const &info = infos.find(a)->second;
+    SUFREQ tunerFreq  = info.getFrequency();
+    SUFREQ sampleRate = info.getSampleRate();
+    SUFREQ margin     = std::min(
+          master->frequency - master->bandwidth / 2
+          - (tunerFreq - sampleRate / 2),
+          tunerFreq + sampleRate / 2
+          - (master->frequency + master->bandwidth / 2));
+
+    if (margin > 0 && (best == nullptr || margin > bestMargin)) {
+      best       = a;
+      bestMargin = margin;
+    }
+  }
 
-  if (it == pendingMasterMap.cend())
-    return nullptr;
+  return best;
+}
 
-  return it->second;
+void
+MultiChannelForwarder::adjustLo()
+{
+  if (!m_analyzers.empty()) {
+    SourceInfoMap infos = sourceInfos();
+
+    for (auto p : masterList) {
+      if (p->analyzer == nullptr)
+        continue;
+
+      Suscan::AnalyzerSourceInfo const &info = infos.find(p->analyzer)->second;
+      SUFREQ lo = p->frequency - info.getFrequency();
+
+      // Masters out of the passband are about to be suspended
+      if (!masterFits(p, info))
+        continue;
+
+      // Only new targets count as requests: adjustLo() is reached more
+      // than once for the same tuner frequency (e.g. from retune()).
+      if (p->isOpen()) {
+        if (p->loFreq != lo) {
+          p->loFreq = lo;
+          ++m_retuneStats.requested;
+        }
+      } else if (p->direct) {
+        for (auto &c : p->channels) {
+          if (c.isOpen() && c.loFreq != lo + c.offset) {
+            c.loFreq = lo + c.offset;
+            ++m_retuneStats.requested;
+          }
+        }
+      }
+    }
+  }
 }
 
-ChannelDescription *
-MultiChannelForwarder::getChannelFromRequest(Suscan::RequestId reqId) const
+unsigned int
+MultiChannelForwarder::flushLo()
 {
-  auto it = pendingChannelMap.find(reqId);
+  unsigned int count = 0;
 
-  if (it == pendingChannelMap.cend())
-    return nullptr;
+  for (auto p : masterList) {
+    if (p->analyzer == nullptr)
+      continue;
+
+    if (p->isOpen()) {
+      if (p->loFreq != p->loSent) {
+        p->analyzer->setInspectorFreq(p->handle, p->loFreq);
+        p->loSent = p->loFreq;
+        ++count;
+      }
+    } else if (p->direct) {
+      for (auto &c : p->channels) {
+        if (c.isOpen() && c.loFreq != c.loSent) {
+          c.consumer->retuned(p->analyzer, c.handle, c);
+          c.loSent = c.loFreq;
+          ++count;
+        }
+      }
+    }
+  }
 
-  return it->second;
+  m_retuneStats.sent += count;
+
+  return count;
 }
 
-ChannelDescription *
-MultiChannelForwarder::getChannelFromHandle(Suscan::Handle reqId) const
+RetuneStats
+MultiChannelForwarder::retuneStats() const
 {
-  auto it = channelMap.find(reqId);
-
-  if (it == channelMap.cend())
-    return nullptr;
+  return m_retuneStats;
+}
 
-  return it->second;
+void
+MultiChannelForwarder::resetRetuneStats()
+{
+  m_retuneStats = RetuneStats();
 }
+
 bool
-MultiChannelForwarder::promoteMaster(
-    Suscan::RequestId reqId,
-    Suscan::Handle hnd,
-    const suscan_config_t *cfg)
+MultiChannelForwarder::retune()
 {
-  MasterChannel *master;
-
-  auto it = pendingMasterMap.find(reqId);
+  bool changes = false;
 
-  if (it == pendingMasterMap.cend())
+  if (m_analyzers.empty() || !isPartiallyOpen())
     return false;
 
-  master = it->second;
+  SourceInfoMap infos = sourceInfos();
 
-  pendingMasterMap.erase(it);
+  for (auto p : masterList) {
+    if (p->deleted)
+      continue;
 
-  if (master->deleted) {
-    // If master was deleted, we silently close it and return false. And also
-    // remote it from the list
-    m_analyzer->closeInspector(hnd);
+    if (p->suspended)
+      changes = findAnalyzer(p, infos) != nullptr;
+    else if (p->analyzer != nullptr)
+      changes = !masterFits(p, infos.find(p->analyzer)->second);
 
-    if (master->opening) {
-      pendingMasterMap.erase(master->reqId);
-      master->opening = false;
+    if (changes)
+      break;
+  }
+
+  if (changes) {
+    if (m_opened) {
+      m_opening = true;
+      m_opened  = false;
     }
 
-    master->deleted = false;
-    master->handle = SUSCAN_INVALID_HANDLE_VALUE;
+    keepOpening();
+  }
 
-    removeMaster(master->iter);
+  adjustLo();
 
-    return false;
-  }
+  return changes;
+}
 
-  master->handle  = hnd;
-  master->opening = false;
-  master->config  = Suscan::Config(cfg);
+unsigned int
+MultiChannelForwarder::suspendedCount() const
+{
+  unsigned int count = 0;
 
-  masterMap[hnd]  = master;
+  for (auto p : masterList)
+    if (p->suspended && !p->deleted)
+      ++count;
 
-  if (!master->enabled)
-    updateMasterConfig(master);
+  return count;
+}
 
-  return true;
+bool
+MultiChannelForwarder::masterFits(
+    const MasterChannel *master,
+    Suscan::AnalyzerSourceInfo const &info) const
+{
+  SUFREQ tunerFreq   = info.getFrequency();
+  SUFREQ sampleRate  = info.getSampleRate();
+  SUFREQ currFreqMin = tunerFreq - sampleRate / 2;
+  SUFREQ currFreqMax = tunerFreq + sampleRate / 2;
+
+  return currFreqMin < master->frequency - master->bandwidth / 2
+      && master->frequency + master->bandwidth / 2 < currFreqMax;
 }
 
 bool
-MultiChannelForwarder::promoteChannel(Suscan::RequestId reqId, Suscan::Handle hnd)
+MultiChannelForwarder::parkChannel(ChannelDescription *channel)
 {
-  ChannelDescription *channel;
+  StandbyInspector standby;
+  Suscan::Analyzer *analyzer = channel->parent->analyzer;
+
+  // Idle until reused: the demodulator goes off (the same path as a
+  // disabled channel) and samples arrive in few, large messages. The
+  // consumer of the next channel configures both again when opened.
+  channel->consumer->syncEnableState(false);
+  if (channel->inspClass == "audio")
+    analyzer->setInspectorWatermark(
+          channel->handle,
+          static_cast<SUSCOUNT>(STANDBY_WATERMARK_SECS * channel->sampRate));
+
+  standby.parent    = channel->parent;
+  standby.inspClass = channel->inspClass;
+  standby.handle    = channel->handle;
+  standby.sampRate  = channel->sampRate;
+  standby.config    = channel->inspConfig;
+
+  m_standby.push_back(standby);
+
+  // Evict the oldest one
+  if (m_standby.size() > STANDBY_MAX_INSPECTORS) {
+    StandbyInspector &oldest = m_standby.front();
+    oldest.parent->analyzer->closeInspector(oldest.handle);
+    m_standby.pop_front();
+  }
 
-  auto it = pendingChannelMap.find(reqId);
+  return true;
+}
 
-  if (it == pendingChannelMap.cend())
-    return false;
+bool
+MultiChannelForwarder::reuseStandby(
+    ChannelDescription *channel,
+    Suscan::AnalyzerSourceInfo const &info)
+{
+  MasterChannel *master = channel->parent;
+
+  for (auto it = m_standby.begin(); it != m_standby.end(); ++it) {
+    if (it->parent == master && it->inspClass == channel->inspClass) {
+      channel->handle     = it->handle;
+      channel->sampRate   = it->sampRate;
+      channel->inspConfig = it->config;
+      channel->loFreq     = channel->offset;
+
+      if (master->direct)
+        channel->loFreq += master->frequency - info.getFrequency();
+
+      channel->loSent     = channel->loFreq;
+
+      m_standby.erase(it);
+
+      ++master->open_count;
+      channelMap[AnalyzerHandle(master->analyzer, channel->handle)] = channel;
+      changed(master);
+      changed(channel);
+
+      // Same master, same class: the inspector was opened with the same
+      // room, so only the tuning needs to change. opened() turns the
+      // demodulator back on and restores the watermark.
+      master->analyzer->setInspectorFreq(channel->handle, channel->loFreq);
+      master->analyzer->setInspectorBandwidth(
+            channel->handle,
+            channel->bandwidth);
+      channel->consumer->opened(
+            master->analyzer,
+            channel->handle,
+            *channel,
+            channel->inspConfig);
+      openSharers(channel);
+      publishDispatchTable();
+
+      return true;
+    }
+  }
 
-  channel = it->second;
+  return false;
+}
 
-  assert(channel->opening);
+void
+MultiChannelForwarder::dropStandby(MasterChannel *master)
+{
+  auto it = m_standby.begin();
+
+  while (it != m_standby.end()) {
+    if (it->parent == master) {
+      // Children of a master inspector are closed along with it
+      if (master->direct && master->analyzer != nullptr)
+        master->analyzer->closeInspector(it->handle);
+      it = m_standby.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
 
-  pendingChannelMap.erase(it);
+unsigned int
+MultiChannelForwarder::standbyCount() const
+{
+  return static_cast<unsigned int>(m_standby.size());
+}
 
-  if (channel->deleted) {
-    // If channel was deleted, we silently close it and return false. And also
-    // remote it from the list
-    m_analyzer->closeInspector(hnd);
+//
+// Channels with the same frequency, bandwidth and class whose consumers
+// do not touch the inspector configuration can be fed by the same
+// inspector. Channelizer engines produce their channels cheaply enough,
+// so only inspector masters look for twins.
+//
+ChannelDescription *
+MultiChannelForwarder::findTwin(const ChannelDescription *channel) const
+{
+  MasterChannel *master = channel->parent;
 
-    channel->opening = false;
-    channel->deleted = false;
-    channel->handle = SUSCAN_INVALID_HANDLE_VALUE;
+  if (master->engine != MASTER_ENGINE_INSPECTORS)
+    return nullptr;
 
-    removeChannel(channel->iter);
+  for (auto &c : master->channels)
+    if (&c != channel
+        && !c.deleted
+        && c.owner == nullptr
+        && c.offset == channel->offset
+        && c.bandwidth == channel->bandwidth
+        && c.inspClass == channel->inspClass
+        && channel->consumer->sharesInspectorWith(*c.consumer))
+      return &c;
+
+  return nullptr;
+}
 
-    return false;
-  }
+void
+MultiChannelForwarder::openSharer(ChannelDescription *sharer)
+{
+  ChannelDescription *owner = sharer->owner;
 
-  channel->handle  = hnd;
-  channel->opening = false;
+  sharer->sampRate   = owner->sampRate;
+  sharer->inspConfig = owner->inspConfig;
+  sharer->loFreq     = owner->loFreq;
+  sharer->loSent     = owner->loSent;
 
-  ++channel->parent->open_count;
+  sharer->consumer->opened(
+        owner->parent->analyzer,
+        owner->handle,
+        *sharer,
+        sharer->inspConfig);
 
-  channelMap[hnd]  = channel;
+  // An enabled sharer needs the inspector of a disabled owner
+  owner->consumer->syncEnableState(owner->inUse());
+}
 
-  return true;
+void
+MultiChannelForwarder::openSharers(ChannelDescription *owner)
+{
+  for (auto s : owner->sharers)
+    openSharer(s);
 }
 
 void
-MultiChannelForwarder::setMaxBandwidth(SUFLOAT max)
+MultiChannelForwarder::closeSharers(ChannelDescription *owner)
 {
-  m_maxBandwidth = max;
+  for (auto s : owner->sharers)
+    s->consumer->closed();
 }
 
+//
+// The owner of a shared inspector is about to be deleted. Its first
+// sharer takes over the inspector (open or in flight) and the rest of
+// the sharers, as if it had opened it itself.
+//
 void
-MultiChannelForwarder::keepOpening()
+MultiChannelForwarder::handOver(ChannelDescription *channel)
 {
-  if (!m_opened) {
-    // For all masterLists
-    //  1. If master set is not opened nor opening: open
-    //  2. If master set is opened: check if there are
-    //     pending open requests
+  MasterChannel *master = channel->parent;
+  ChannelDescription *heir = channel->sharers.front();
+
+  heir->owner = nullptr;
+  heir->sharers.assign(channel->sharers.begin() + 1, channel->sharers.end());
+  for (auto s : heir->sharers)
+    s->owner = heir;
+
+  heir->handle     = channel->handle;
+  heir->reqId      = channel->reqId;
+  heir->opening    = channel->opening;
+  heir->loFreq     = channel->loFreq;
+  heir->loSent     = channel->loSent;
+  heir->sampRate   = channel->sampRate;
+  heir->inspConfig = channel->inspConfig;
+
+  // An open inspector is mapped again by adoptInspector(), once the old
+  // owner gets no more samples
+  if (heir->opening)
+    pendingChannelMap[AnalyzerRequest(master->analyzer, heir->reqId)] = heir;
+  else if (heir->handle != SUSCAN_INVALID_HANDLE_VALUE)
+    channelMap.erase(AnalyzerHandle(master->analyzer, heir->handle));
+
+  // Nothing left to release when the old owner is deleted
+  channel->sharers.clear();
+  channel->handle  = SUSCAN_INVALID_HANDLE_VALUE;
+  channel->opening = false;
 
-    if (masterList.empty()) {
-      m_opened = true;
-      return;
-    }
+  changed(heir);
+  publishDispatchTable();
+}
+
+// The heir of an open inspector was opened as a sharer, which leaves the
+// inspector alone. Open it again as its owner.
+void
+MultiChannelForwarder::adoptInspector(ChannelDescription *heir)
+{
+  MasterChannel *master = heir->parent;
+
+  heir->consumer->closed();
+  heir->consumer->opened(
+        master->analyzer,
+        heir->handle,
+        *heir,
+        heir->inspConfig);
+  heir->consumer->syncEnableState(heir->inUse());
+
+  channelMap[AnalyzerHandle(master->analyzer, heir->handle)] = heir;
+  publishDispatchTable();
+}
+
+// Sharing is only possible in inspector masters
+void
+MultiChannelForwarder::unshare(MasterChannel *master)
+{
+  for (auto &c : master->channels) {
+    c.owner = nullptr;
+    c.sharers.clear();
+  }
+
+  // Former sharers are opened again by themselves
+  publishDispatchTable();
+  synchronizeDispatch();
+}
+
+void
+MultiChannelForwarder::suspendMaster(MasterChannel *master)
+{
+  dropStandby(master);
+
+  // Closing the master closes all its subchannels too. We only need to
+  // notify the consumers and forget about the handles.
+  if (master->isOpen()) {
+    master->analyzer->closeInspector(master->handle);
+    masterMap.erase(AnalyzerHandle(master->analyzer, master->handle));
+  }
+
+  unmapMaster(master);
+
+  for (auto &c : master->channels) {
+    if (c.isOpen()) {
+      if (master->direct)
+        master->analyzer->closeInspector(c.handle);
+      c.consumer->closed();
+      closeSharers(&c);
+      c.handle   = SUSCAN_INVALID_HANDLE_VALUE;
+      c.attached = false;
+    }
+  }
+
+  dropTap(master);
+
+  master->handle     = SUSCAN_INVALID_HANDLE_VALUE;
+  master->open_count = 0;
+  master->direct     = false;
+  master->analyzer   = nullptr;
+
+  changed(master, true);
+}
+
+bool
+MultiChannelForwarder::isEngineChannel(const ChannelDescription *channel) const
+{
+  if (channel->parent->engine == MASTER_ENGINE_INSPECTORS)
+    return false;
+
+  if (channel->inspClass == "raw")
+    return true;
+
+  return channel->inspClass == "audio"
+      && channel->consumer->channelDemodulator() != CHANNEL_DEMOD_NONE;
+}
+
+//
+// The tap is a raw inspector covering the whole master. Its samples are
+// channelized in the plugin. For the PFB, bins are placed on the grid of
+// the channel plan: the spacing is the GCD of the channel offsets (or
+// the widest channel, if the plan is not regular enough) and the tap is
+// shifted so that the channels fall at the center of their bins. The
+// overlap-save engine only needs to know the narrowest channel, which
+// determines its frequency resolution.
+//
+void
+MultiChannelForwarder::openTap(MasterChannel *master)
+{
+  Suscan::Analyzer *analyzer = master->analyzer;
+  ChannelDescription *tap = new ChannelDescription;
+  Suscan::Channel channel;
+  SUFLOAT spacing = master->gridSpacing;
+  SUFLOAT widest  = 0;
+  SUFLOAT narrowest = 0;
+  SUFREQ  first   = 0;
+  SUFREQ  center  = 0;
+  long long grid  = 0;
+  bool    found   = false;
+
+  for (auto &c : master->channels) {
+    if (!isEngineChannel(&c))
+      continue;
+
+    if (!found) {
+      first = c.offset;
+      found = true;
+    }
+
+    long long a = std::llabs(std::llround(c.offset - first));
+    long long b = grid;
+
+    while (b != 0) {
+      long long t = a % b;
+      a = b;
+      b = t;
+    }
+
+    grid = a;
+
+    if (c.bandwidth > widest)
+      widest = c.bandwidth;
+
+    if (narrowest == 0 || c.bandwidth < narrowest)
+      narrowest = c.bandwidth;
+  }
+
+  // Opened for the spectrum only
+  if (found) {
+    if (master->engine == MASTER_ENGINE_OLS) {
+      master->channelizer = new OlsChannelizer(narrowest);
+    } else {
+      if (spacing <= 0)
+        spacing = grid >= widest ? grid : widest;
+
+      if (spacing > 0)
+        center = first - spacing * std::floor(first / spacing + .5);
+
+      master->channelizer = new PfbChannelizer(spacing);
+      master->channelizer->setCenter(center);
+    }
+
+    if (m_pool == nullptr) {
+      m_pool = new WorkerPool;
+      m_pool->setAffinity(m_workerCpus);
+    }
+
+    master->channelizer->setWorkerPool(m_pool);
+  }
+
+  ChannelizerTap *consumer = new ChannelizerTap(master->channelizer);
+
+  consumer->setForward(master->iq);
+
+  if (master->spectrum != nullptr) {
+    SpectrumMonitor *monitor = new SpectrumMonitor(
+          master->spectrum,
+          master->spectrumBins,
+          master->spectrumRate);
+    monitor->setCenter(master->frequency + center);
+    consumer->setMonitor(monitor);
+  }
+
+  tap->parent    = master;
+  tap->name      = master->name + ".tap";
+  tap->offset    = center;
+  tap->bandwidth = master->bandwidth;
+  tap->inspClass = "raw";
+  tap->consumer  = consumer;
+  tap->worker    = m_nextWorker++;
+  tap->reqId     = analyzer->allocateRequestId();
+
+  channel.fc    = center;
+  channel.fHigh = + .5 * master->bandwidth;
+  channel.fLow  = - .5 * master->bandwidth;
+  channel.bw    = master->bandwidth;
+  channel.ft    = 0;
+
+  analyzer->openEx("raw", channel, true, master->handle, tap->reqId);
+
+  tap->loFreq  = tap->loSent = channel.fc;
+  tap->opening = true;
+
+  master->tap = tap;
+  pendingChannelMap[AnalyzerRequest(analyzer, tap->reqId)] = tap;
+}
+
+void
+MultiChannelForwarder::attachChannel(ChannelDescription *channel)
+{
+  MasterChannel *master = channel->parent;
+
+  // The tap may be feeding the channelizer right now
+  std::lock_guard<std::mutex> guard(master->channelizer->mutex());
+
+  if (!master->channelizer->addChannel(channel)) {
+    error(
+        "Channel `%s' does not fit in the channelizer of master `%s' "
+        "(too wide, or too far from the center of its bin).\n",
+        channel->name.c_str(),
+        master->name.c_str());
+    return;
+  }
+
+  channel->attached   = true;
+  channel->inspConfig = master->tap->inspConfig;
+  ++master->open_count;
+  changed(master);
+  changed(channel);
+
+  delete channel->demodulator;
+  channel->demodulator = nullptr;
+
+  if (channel->inspClass == "audio")
+    channel->demodulator = new Demodulator(
+          channel->consumer->channelDemodulator(),
+          channel->sampRate,
+          channel->bandwidth);
+
+  channel->consumer->opened(
+        master->analyzer,
+        SUSCAN_INVALID_HANDLE_VALUE,
+        *channel,
+        channel->inspConfig);
+}
+
+// The tap inspector is a child of the master: closing the master is
+// enough to close it. Use closeTap() if the master stays open.
+void
+MultiChannelForwarder::dropTap(MasterChannel *master)
+{
+  ChannelDescription *tap = master->tap;
+
+  if (tap == nullptr)
+    return;
+
+  for (auto &c : master->channels)
+    c.attached = false;
+
+  if (tap->isOpen()) {
+    channelMap.erase(AnalyzerHandle(master->analyzer, tap->handle));
+    publishDispatchTable();
+    synchronizeDispatch();
+  } else if (tap->opening) {
+    pendingChannelMap.erase(AnalyzerRequest(master->analyzer, tap->reqId));
+  }
+
+  delete tap;
+  delete master->channelizer;
+
+  master->tap         = nullptr;
+  master->channelizer = nullptr;
+}
+
+void
+MultiChannelForwarder::closeTap(MasterChannel *master)
+{
+  ChannelDescription *tap = master->tap;
+
+  if (tap != nullptr && tap->handle != SUSCAN_INVALID_HANDLE_VALUE)
+    master->analyzer->closeInspector(tap->handle);
+
+  dropTap(master);
+}
+
+//
+// Every inspector mixes, filters and decimates the output of its parent,
+// so its cost is roughly proportional to the sample rate of the parent.
+// For a master of bandwidth Bm with N channels and a source rate fs:
+//
+//   Through the master: fs (master) + N * Bm (channels)
+//   Direct:             N * fs
+//
+// I.e. the master only pays off when it is narrow compared to the source
+// rate and has more than one channel.
+//
+TopologyCost
+MultiChannelForwarder::estimateCost(
+    const MasterChannel *master,
+    SUFLOAT sampleRate) const
+{
+  TopologyCost cost;
+  SUFLOAT count = 0;
+  SUFLOAT inspectors = 0;
+  bool engine = false;
+
+  // Channelizer outputs share a single tap inspector, and sharers the
+  // inspector of their owner
+  for (auto &c : master->channels) {
+    if (c.owner != nullptr)
+      continue;
+
+    ++count;
+
+    if (isEngineChannel(&c))
+      engine = true;
+    else
+      ++inspectors;
+  }
+
+  if (engine || master->hasTapOutputs())
+    ++inspectors;
+
+  cost.viaMaster = sampleRate + inspectors * master->bandwidth;
+  cost.direct    = count * sampleRate;
+
+  return cost;
+}
+
+TopologyCost
+MultiChannelForwarder::estimateCost(const MasterChannel *master) const
+{
+  SUFLOAT sampleRate = 0;
+
+  if (master->analyzer != nullptr)
+    sampleRate = master->analyzer->getSourceInfo().getSampleRate();
+  else if (m_analyzer != nullptr)
+    sampleRate = m_analyzer->getSourceInfo().getSampleRate();
+
+  return estimateCost(master, sampleRate);
+}
+
+bool
+MultiChannelForwarder::preferDirect(
+    const MasterChannel *master,
+    SUFLOAT sampleRate) const
+{
+  TopologyCost cost;
+
+  // Channelizers and tap outputs are fed by the master
+  if (master->engine != MASTER_ENGINE_INSPECTORS || master->hasTapOutputs())
+    return false;
+
+  switch (m_topology) {
+    case MULTI_CHANNEL_TOPOLOGY_MASTER:
+      return false;
+
+    case MULTI_CHANNEL_TOPOLOGY_DIRECT:
+      return true;
+
+    default:
+      // Empty masters are opened anyway, so channels added later
+      // have a place to go.
+      if (master->isEmpty())
+        return false;
+
+      cost = estimateCost(master, sampleRate);
+      return cost.direct < cost.viaMaster;
+  }
+}
+
+bool
+MultiChannelForwarder::canOpen() const
+{
+  if (!m_analyzers.empty()) {
+    SourceInfoMap infos = sourceInfos();
+
+    for (auto p : masterList)
+      if (!p->deleted && findAnalyzer(p, infos) == nullptr)
+        return false;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool
+MultiChannelForwarder::canOpenAny() const
+{
+  if (!m_analyzers.empty()) {
+    SourceInfoMap infos = sourceInfos();
+
+    for (auto p : masterList)
+      if (!p->deleted && findAnalyzer(p, infos) != nullptr)
+        return true;
+  }
+
+  return false;
+}
+
+MultiChannelForwarder::MasterSet
+MultiChannelForwarder::coveredElsewhere() const
+{
+  MasterSet covered;
+
+  if (m_analyzers.size() > 1) {
+    SourceInfoMap infos = sourceInfos();
+
+    for (auto p : masterList) {
+      if (p->deleted)
+        continue;
+
+      for (auto &info : infos)
+        if (info.first != m_analyzer && masterFits(p, info.second)) {
+          covered.insert(p);
+          break;
+        }
+    }
+  }
+
+  return covered;
+}
+
+void
+MultiChannelForwarder::primaryLimits(SUFREQ &freqMin, SUFREQ &freqMax) const
+{
+  MasterSet covered = coveredElsewhere();
+
+  if (covered.empty()) {
+    freqMin = m_freqMin;
+    freqMax = m_freqMax;
+    return;
+  }
+
+  freqMin = +INFINITY;
+  freqMax = -INFINITY;
+
+  for (auto p : masterList) {
+    if (p->deleted || covered.find(p) != covered.end())
+      continue;
+
+    if (p->frequency - p->bandwidth / 2 < freqMin)
+      freqMin = p->frequency - p->bandwidth / 2;
+
+    if (p->frequency + p->bandwidth / 2 > freqMax)
+      freqMax = p->frequency + p->bandwidth / 2;
+  }
+
+  // Everything is covered elsewhere: nothing to fit
+  if (freqMin > freqMax)
+    freqMin = freqMax = 0;
+}
+
+SUFREQ
+MultiChannelForwarder::span() const
+{
+  SUFREQ freqMin, freqMax;
+
+  primaryLimits(freqMin, freqMax);
+
+  return freqMax - freqMin;
+}
+
+SUFREQ
+MultiChannelForwarder::getCenter() const
+{
+  SUFREQ freqMin, freqMax;
+
+  primaryLimits(freqMin, freqMax);
+
+  return .5 * (freqMax + freqMin);
+}
+
+bool
+MultiChannelForwarder::canCenter() const
+{
+  if (m_analyzer == nullptr)
+    return false;
+
+  Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
+
+  if (span() > info.getSampleRate())
+    return false;
+
+  return true;
+}
+
+bool
+MultiChannelForwarder::center()
+{
+  TunerPlacement placement;
+
+  if (!findPlacement(placement))
+    return false;
+
+  m_analyzer->setFrequency(placement.frequency);
+
+  return true;
+}
+
+void
+MultiChannelForwarder::evalPlacement(
+    TunerPlacement &result,
+    SUFREQ tunerFreq,
+    SUFREQ sampleRate,
+    MasterSet const &covered) const
+{
+  result = TunerPlacement();
+  result.frequency = tunerFreq;
+
+  for (auto p : masterList) {
+    bool fits, elsewhere;
+
+    if (p->deleted)
+      continue;
+
+    elsewhere = covered.find(p) != covered.end();
+    fits = tunerFreq - sampleRate / 2 < p->frequency - p->bandwidth / 2
+        && p->frequency + p->bandwidth / 2 < tunerFreq + sampleRate / 2;
+
+    if (fits && !elsewhere)
+      ++result.masters;
+
+    for (auto &c : p->channels) {
+      SUFREQ freq = p->frequency + c.offset;
+
+      result.maxScore += c.priority;
+      ++result.totalChannels;
+
+      // Kept by another analyzer, whatever the primary does
+      if (elsewhere) {
+        result.score += c.priority;
+        ++result.channels;
+      } else if (fits) {
+        if (m_dcGuard > 0
+            && freq - c.bandwidth / 2 - m_dcGuard / 2 < tunerFreq
+            && tunerFreq < freq + c.bandwidth / 2 + m_dcGuard / 2) {
+          ++result.nearDc;
+        } else {
+          result.score += c.priority;
+          ++result.channels;
+        }
+      }
+    }
+  }
+}
+
+//
+// The score of a tuner frequency is piecewise constant: it can only change
+// when a master enters or leaves the passband, or when a channel enters or
+// leaves the DC guard region. We collect all these breakpoints and evaluate
+// the score in the middle of each interval. The winner is the interval with
+// the highest score (ties are broken by number of masters and then by
+// the interval width, i.e. the placement with the largest margin).
+//
+bool
+MultiChannelForwarder::findPlacement(TunerPlacement &placement) const
+{
+  std::vector<SUFREQ> breakpoints;
+  TunerPlacement current;
+  SUFREQ sampleRate, bestWidth = 0;
+  bool found = false;
+
+  if (m_analyzer == nullptr)
+    return false;
+
+  Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
+  MasterSet covered = coveredElsewhere();
+  sampleRate = info.getSampleRate();
+
+  for (auto p : masterList) {
+    SUFREQ fitMin = p->frequency + p->bandwidth / 2 - sampleRate / 2;
+    SUFREQ fitMax = p->frequency - p->bandwidth / 2 + sampleRate / 2;
+
+    if (p->deleted || fitMin >= fitMax || covered.find(p) != covered.end())
+      continue;
+
+    breakpoints.push_back(fitMin);
+    breakpoints.push_back(fitMax);
+
+    if (m_dcGuard > 0) {
+      for (auto &c : p->channels) {
+        SUFREQ freq = p->frequency + c.offset;
+        breakpoints.push_back(freq - c.bandwidth / 2 - m_dcGuard / 2);
+        breakpoints.push_back(freq + c.bandwidth / 2 + m_dcGuard / 2);
+      }
+    }
+  }
+
+  std::sort(breakpoints.begin(), breakpoints.end());
+  breakpoints.erase(
+        std::unique(breakpoints.begin(), breakpoints.end()),
+        breakpoints.end());
+
+  for (size_t i = 1; i < breakpoints.size(); ++i) {
+    SUFREQ width = breakpoints[i] - breakpoints[i - 1];
+    bool better;
+
+    evalPlacement(
+          current,
+          .5 * (breakpoints[i] + breakpoints[i - 1]),
+          sampleRate,
+          covered);
+
+    if (current.masters == 0)
+      continue;
+
+    if (!found)
+      better = true;
+    else if (current.score != placement.score)
+      better = current.score > placement.score;
+    else if (current.masters != placement.masters)
+      better = current.masters > placement.masters;
+    else
+      better = width > bestWidth;
+
+    if (better) {
+      placement = current;
+      bestWidth = width;
+      found     = true;
+    }
+  }
+
+  return found;
+}
+
+bool
+MultiChannelForwarder::isOpen() const
+{
+  return m_opened;
+}
+
+bool
+MultiChannelForwarder::isPartiallyOpen() const
+{
+  return m_opened || m_opening;
+}
+
+MasterChannel *
+MultiChannelForwarder::getMasterFromRequest(
+    const Suscan::Analyzer *analyzer,
+    Suscan::RequestId reqId) const
+{
+  auto it = pendingMasterMap.find(AnalyzerRequest(analyzer, reqId));
+
+  if (it == pendingMasterMap.cend())
+    return nullptr;
+
+  return it->second;
+}
+
+ChannelDescription *
+MultiChannelForwarder::getChannelFromRequest(
+    const Suscan::Analyzer *analyzer,
+    Suscan::RequestId reqId) const
+{
+  auto it = pendingChannelMap.find(AnalyzerRequest(analyzer, reqId));
+
+  if (it == pendingChannelMap.cend())
+    return nullptr;
+
+  return it->second;
+}
+
+ChannelDescription *
+MultiChannelForwarder::getChannelFromHandle(
+    const Suscan::Analyzer *analyzer,
+    Suscan::Handle handle) const
+{
+  auto it = channelMap.find(AnalyzerHandle(analyzer, handle));
+
+  if (it == channelMap.cend())
+    return nullptr;
+
+  return it->second;
+}
+bool
+MultiChannelForwarder::promoteMaster(
+    Suscan::Analyzer *analyzer,
+    Suscan::RequestId reqId,
+    Suscan::Handle hnd,
+    const suscan_config_t *cfg)
+{
+  MasterChannel *master;
+
+  auto it = pendingMasterMap.find(AnalyzerRequest(analyzer, reqId));
+
+  if (it == pendingMasterMap.cend())
+    return false;
+
+  master = it->second;
+
+  pendingMasterMap.erase(it);
+
+  if (master->deleted) {
+    // If master was deleted, we silently close it and return false. And also
+    // remote it from the list
+    analyzer->closeInspector(hnd);
+
+    if (master->opening) {
+      pendingMasterMap.erase(AnalyzerRequest(analyzer, master->reqId));
+      master->opening = false;
+    }
+
+    master->deleted = false;
+    master->handle = SUSCAN_INVALID_HANDLE_VALUE;
+
+    removeMaster(master->iter);
+
+    return false;
+  }
+
+  master->handle  = hnd;
+  master->opening = false;
+  master->config  = Suscan::Config(cfg);
+
+  masterMap[AnalyzerHandle(analyzer, hnd)] = master;
+  changed(master);
+
+  if (!master->enabled)
+    updateMasterConfig(master);
+
+  return true;
+}
+
+bool
+MultiChannelForwarder::promoteChannel(
+    Suscan::Analyzer *analyzer,
+    Suscan::RequestId reqId,
+    Suscan::Handle hnd)
+{
+  ChannelDescription *channel;
+
+  auto it = pendingChannelMap.find(AnalyzerRequest(analyzer, reqId));
+
+  if (it == pendingChannelMap.cend())
+    return false;
+
+  channel = it->second;
+
+  assert(channel->opening);
+
+  pendingChannelMap.erase(it);
+
+  if (channel->deleted) {
+    // If channel was deleted, we silently close it and return false. And also
+    // remote it from the list
+    analyzer->closeInspector(hnd);
+
+    MasterChannel *master = channel->parent;
+
+    channel->opening = false;
+    channel->deleted = false;
+    channel->handle = SUSCAN_INVALID_HANDLE_VALUE;
+
+    removeChannel(channel->iter);
+
+    // Last pending channel of a removed direct master
+    if (master->deleted && master->direct && !master->hasPendingChannels()) {
+      master->deleted = false;
+      removeMaster(master->iter);
+    }
+
+    return false;
+  }
+
+  channel->handle  = hnd;
+  channel->opening = false;
+
+  // The tap is not one of the channels of the master
+  if (channel != channel->parent->tap)
+    ++channel->parent->open_count;
+
+  channelMap[AnalyzerHandle(analyzer, hnd)] = channel;
+  changed(channel->parent);
+  changed(channel);
+
+  return true;
+}
+
+void
+MultiChannelForwarder::setMaxBandwidth(SUFLOAT max)
+{
+  m_maxBandwidth = max;
+}
+
+void
+MultiChannelForwarder::setDcGuard(SUFLOAT guard)
+{
+  m_dcGuard = guard;
+}
+
+void
+MultiChannelForwarder::setTopology(MultiChannelTopology topology)
+{
+  m_topology = topology;
+}
+
+MultiChannelTopology
+MultiChannelForwarder::topology() const
+{
+  return m_topology;
+}
+
+const char *
+MultiChannelForwarder::topologyName(MultiChannelTopology topology)
+{
+  switch (topology) {
+    case MULTI_CHANNEL_TOPOLOGY_MASTER:
+      return "master";
+
+    case MULTI_CHANNEL_TOPOLOGY_DIRECT:
+      return "direct";
+
+    default:
+      return "auto";
+  }
+}
+
+bool
+MultiChannelForwarder::topologyFromName(
+    std::string const &name,
+    MultiChannelTopology &topology)
+{
+  if (name == "" || name == "auto")
+    topology = MULTI_CHANNEL_TOPOLOGY_AUTO;
+  else if (name == "master")
+    topology = MULTI_CHANNEL_TOPOLOGY_MASTER;
+  else if (name == "direct")
+    topology = MULTI_CHANNEL_TOPOLOGY_DIRECT;
+  else
+    return false;
+
+  return true;
+}
+
+SUFLOAT
+MultiChannelForwarder::dcGuard() const
+{
+  return m_dcGuard;
+}
+
+void
+MultiChannelForwarder::keepOpening()
+{
+  if (!m_opened) {
+    // For all masterLists
+    //  1. If master set is not opened nor opening: open
+    //  2. If master set is opened: check if there are
+    //     pending open requests
+
+    //  3. If master set falls outside the passband: close it (or leave it
+    //     closed) and mark it as suspended. It will be opened again
+    //     by retune() as soon as the tuner gets back to it.
+
+    if (masterList.empty()) {
+      m_opened = true;
+      return;
+    }
+
+    SourceInfoMap infos = sourceInfos();
 
     for (auto p : masterList) {
-      bool opened = p->isOpen();
-      bool fullyOpened = opened && p->open_count == p->channels.size();
+      bool opened = p->isReady();
+      bool fullyOpened;
+
+      // Not assigned yet: pick the analyzer with the most room for it
+      if (!opened && !p->opening)
+        p->analyzer = findAnalyzer(p, infos);
+
+      // Out of band: wait for in-flight requests before closing it
+      if (p->analyzer == nullptr
+          || !masterFits(p, infos.find(p->analyzer)->second)) {
+        if (!p->opening && !p->hasPendingChannels()) {
+          if (opened)
+            suspendMaster(p);
+          p->analyzer  = nullptr;
+          p->suspended = true;
+          changed(p, true);
+        }
+
+        continue;
+      }
+
+      Suscan::Analyzer *analyzer = p->analyzer;
+      Suscan::AnalyzerSourceInfo const &info = infos.find(analyzer)->second;
+
+      if (p->suspended) {
+        p->suspended = false;
+        changed(p, true);
+      }
+
+      // Not opened yet: decide whether its channels should be opened
+      // directly on the analyzer.
+      if (!opened && !p->opening) {
+        p->direct = preferDirect(p, info.getSampleRate());
+        opened    = p->direct;
+      }
+
+      fullyOpened = opened && p->open_count == p->channels.size();
 
       // Neither opened nor opening: open master.
       if (!opened && !p->opening) {
-        Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
         Suscan::Channel channel;
 
-        p->reqId      = m_analyzer->allocateRequestId();
+        p->reqId      = analyzer->allocateRequestId();
         channel.fc    = p->frequency - info.getFrequency();
+        p->loFreq     = p->loSent = channel.fc;
         channel.fHigh = + p->bandwidth / 2;
         channel.fLow  = - p->bandwidth / 2;
         channel.bw    =   p->bandwidth;
 
         // Open master (no precision)
-        m_analyzer->open("multicarrier", channel, p->reqId);
-        pendingMasterMap[p->reqId] = p;
+        analyzer->open("multicarrier", channel, p->reqId);
+        pendingMasterMap[AnalyzerRequest(analyzer, p->reqId)] = p;
 
         p->opening = true;
       }
 
+      // Tap outputs do not depend on the channels
+      if (opened && !p->direct && p->hasTapOutputs() && p->tap == nullptr)
+        openTap(p);
+
       // Opened: open all subchannels
       if (opened && !fullyOpened) {
         for (auto c = p->channels.begin();
@@ -450,39 +1720,75 @@ MultiChannelForwarder::keepOpening()
              ++c) {
           bool chan_opened = c->isOpen();
 
+          // Fed by the inspector of its owner
+          if (c->owner != nullptr)
+            continue;
+
           if (!chan_opened && !c->opening) {
             Suscan::Channel channel;
+
+            // Produced by the channelizer: open its feed first
+            if (isEngineChannel(&*c)) {
+              if (p->tap == nullptr) {
+                openTap(p);
+              } else if (p->tap->isOpen() && p->channelizer == nullptr) {
+                // Opened for the spectrum only: reopen with a channelizer
+                closeTap(p);
+                openTap(p);
+              } else if (p->tap->isOpen()) {
+                attachChannel(&*c);
+              }
+              continue;
+            }
+
+            if (reuseStandby(&*c, info))
+              continue;
+
             SUFLOAT extraRoom = m_maxBandwidth;
             if (extraRoom > p->bandwidth)
               extraRoom = p->bandwidth;
 
-            c->reqId      = m_analyzer->allocateRequestId();
+            c->reqId      = analyzer->allocateRequestId();
             channel.fc    = c->offset;
             channel.fHigh = + .5 * extraRoom;
             channel.fLow  = - .5 * extraRoom;
             channel.bw    = extraRoom; // Give some extra room at allocation
             channel.ft    = 0;
 
-            m_analyzer->openEx(
-                  c->inspClass,
-                  channel,
-                  true,
-                  p->handle,
-                  c->reqId);
+            if (p->direct) {
+              // Direct channel: relative to the tuner frequency
+              channel.fc += p->frequency - info.getFrequency();
+              analyzer->open(c->inspClass, channel, c->reqId);
+            } else {
+              analyzer->openEx(
+                    c->inspClass,
+                    channel,
+                    true,
+                    p->handle,
+                    c->reqId);
+            }
+
+            c->loFreq = c->loSent = channel.fc;
 
-            pendingChannelMap[c->reqId] = &*c;
+            pendingChannelMap[AnalyzerRequest(analyzer, c->reqId)] = &*c;
             c->opening = true;
           }
         }
       }
     }
+
+    // Nothing left in flight (e.g. all remaining masters are suspended)
+    if (pendingMasterMap.empty() && pendingChannelMap.empty()) {
+      m_opened  = true;
+      m_opening = false;
+    }
   }
 }
 
 void
 MultiChannelForwarder::openAll()
 {
-  if (m_analyzer != nullptr && !m_opening && !m_opened) {
+  if (!m_analyzers.empty() && !m_opening && !m_opened) {
     m_opening = true;
     keepOpening();
   }
@@ -491,16 +1797,32 @@ MultiChannelForwarder::openAll()
 void
 MultiChannelForwarder::closeAll()
 {
-  if (m_analyzer != nullptr) {
+  // Consumers are closed below: stop dispatching samples first
+  channelMap.clear();
+  publishDispatchTable();
+  synchronizeDispatch();
+
+  if (!m_analyzers.empty()) {
+    for (auto &standby : m_standby)
+      if (standby.parent->direct)
+        standby.parent->analyzer->closeInspector(standby.handle);
+
     for (auto p : masterList) {
+      if (p->analyzer == nullptr)
+        continue;
+
       if (p->isOpen())
-        m_analyzer->closeInspector(p->handle);
+        p->analyzer->closeInspector(p->handle);
 
       auto i = p->channels.begin();
 
       while (i != p->channels.end()) {
-        if (i->isOpen())
+        if (i->isOpen()) {
+          if (p->direct)
+            p->analyzer->closeInspector(i->handle);
           i->consumer->closed();
+          closeSharers(&*i);
+        }
         ++i;
       }
     }
@@ -551,8 +1873,17 @@ MultiChannelForwarder::getErrors() const
 
 bool
 MultiChannelForwarder::processMessage(Suscan::InspectorMessage const &msg)
+{
+  return processMessage(m_analyzer, msg);
+}
+
+bool
+MultiChannelForwarder::processMessage(
+    Suscan::Analyzer *analyzer,
+    Suscan::InspectorMessage const &msg)
 {
   ChannelDescription *ch;
+  AnalyzerRequest req(analyzer, msg.getRequestId());
   bool changes = false;
 
   if (m_opening) {
@@ -570,20 +1901,24 @@ MultiChannelForwarder::processMessage(Suscan::InspectorMessage const &msg)
         // 4. If found, promote
         // 5. If anything was opened, check if we must transit to opened
         if (!promoteMaster(
+              analyzer,
               msg.getRequestId(),
               msg.getHandle(),
               msg.getCConfig())) {
-          ch = getChannelFromRequest(msg.getRequestId());
+          ch = getChannelFromRequest(analyzer, msg.getRequestId());
           if (ch != nullptr) {
-            if (promoteChannel(msg.getRequestId(), msg.getHandle())) {
-              m_analyzer->setInspectorId(msg.getHandle(), msg.getHandle());
-              m_analyzer->setInspectorBandwidth(msg.getHandle(), ch->bandwidth);
-              ch->sampRate = msg.getEquivSampleRate();
+            if (promoteChannel(analyzer, msg.getRequestId(), msg.getHandle())) {
+              analyzer->setInspectorId(msg.getHandle(), msg.getHandle());
+              analyzer->setInspectorBandwidth(msg.getHandle(), ch->bandwidth);
+              ch->sampRate   = msg.getEquivSampleRate();
+              ch->inspConfig = Suscan::Config(msg.getCConfig());
               ch->consumer->opened(
-                    m_analyzer,
+                    analyzer,
                     msg.getHandle(),
                     *ch,
-                    Suscan::Config(msg.getCConfig()));
+                    ch->inspConfig);
+              openSharers(ch);
+              publishDispatchTable();
               changes = true;
             }
           }
@@ -600,7 +1935,7 @@ MultiChannelForwarder::processMessage(Suscan::InspectorMessage const &msg)
 
       case SUSCAN_ANALYZER_INSPECTOR_MSGKIND_WRONG_HANDLE:
         // Failed to open one of the subcarrier inspectors
-        if (pendingChannelMap.find(msg.getRequestId()) != pendingChannelMap.end()) {
+        if (pendingChannelMap.find(req) != pendingChannelMap.end()) {
           closeAll();
           error("Failed to open subcarrier inspector (wrong handle)\n");
 
@@ -610,8 +1945,8 @@ MultiChannelForwarder::processMessage(Suscan::InspectorMessage const &msg)
 
       case SUSCAN_ANALYZER_INSPECTOR_MSGKIND_INVALID_CHANNEL:
         // Failed to open a channel
-        if (pendingChannelMap.find(msg.getRequestId()) != pendingChannelMap.end()
-            || pendingMasterMap.find(msg.getRequestId()) != pendingMasterMap.end()) {
+        if (pendingChannelMap.find(req) != pendingChannelMap.end()
+            || pendingMasterMap.find(req) != pendingMasterMap.end()) {
           closeAll();
           error("Failed to open a channel (invalid limits?)\n");
 
@@ -625,21 +1960,284 @@ MultiChannelForwarder::processMessage(Suscan::InspectorMessage const &msg)
     }
   }
 
-  return changes;
+  return changes;
+}
+
+bool
+MultiChannelForwarder::feedSamplesMessage(Suscan::SamplesMessage const &msg)
+{
+  return feedSamplesMessage(m_analyzer, msg);
+}
+
+//
+// Runs in the GUI thread, like the rest of the forwarder, but it must not
+// wait for the consumers: samples of known inspectors are copied to the
+// dispatch queue and everything else happens in the dispatch thread.
+//
+bool
+MultiChannelForwarder::feedSamplesMessage(
+    Suscan::Analyzer *analyzer,
+    Suscan::SamplesMessage const &msg)
+{
+  AnalyzerHandle target(analyzer, msg.getInspectorId());
+  std::vector<SUCOMPLEX> samples;
+
+  // Not ours (e.g. an inspector tab of the application)
+  if (channelMap.find(target) == channelMap.end())
+    return false;
+
+  {
+    std::lock_guard<std::mutex> guard(m_dispatchMutex);
+
+    // Reported to the consumers along with the next block of the target
+    if (m_dispatchJobs.size() >= DISPATCH_MAX_QUEUE) {
+      ++m_dispatchDropped;
+      m_dispatchLost[target] += msg.getCount();
+      return false;
+    }
+
+    if (!m_dispatchSpare.empty()) {
+      samples = std::move(m_dispatchSpare.back());
+      m_dispatchSpare.pop_back();
+    }
+  }
+
+  samples.assign(msg.getSamples(), msg.getSamples() + msg.getCount());
+
+  {
+    std::lock_guard<std::mutex> guard(m_dispatchMutex);
+    DispatchJob job;
+    auto lost = m_dispatchLost.find(target);
+
+    job.target  = target;
+    job.samples = std::move(samples);
+
+    if (lost != m_dispatchLost.end()) {
+      job.dropped = lost->second;
+      m_dispatchLost.erase(lost);
+    }
+
+    m_dispatchJobs.push_back(std::move(job));
+  }
+
+  m_dispatchWakeUp.notify_one();
+
+  return true;
+}
+
+//
+// The dispatch thread is the only reader of the published table. Samples
+// are copied again into the worker the channel is bound to, so consumers
+// of different channels run in parallel while each of them still gets
+// its samples in order. A full worker blocks this thread, never the GUI.
+//
+void
+MultiChannelForwarder::dispatch(DispatchJob const &job)
+{
+  const DispatchTable *table;
+
+  ++m_dispatchState;
+
+  table = m_dispatchTable.load();
+
+  auto it = table->find(job.target);
+  if (it != table->cend() && !it->second.paused) {
+    // Disabled direct masters cannot be paused from the analyzer side
+    ChannelDescription *channel = it->second.channel;
+
+    m_consumers->push(
+          channel->worker,
+          channel->consumer,
+          job.samples.data(),
+          job.samples.size(),
+          job.dropped);
+
+    for (auto s : it->second.sharers)
+      m_consumers->push(
+            s->worker,
+            s->consumer,
+            job.samples.data(),
+            job.samples.size(),
+            job.dropped);
+  }
+
+  ++m_dispatchState;
+}
+
+void
+MultiChannelForwarder::runDispatch()
+{
+  std::unique_lock<std::mutex> lock(m_dispatchMutex);
+
+  for (;;) {
+    m_dispatchWakeUp.wait(
+          lock,
+          [this] { return m_dispatchStop || !m_dispatchJobs.empty(); });
+
+    if (m_dispatchJobs.empty())
+      break;
+
+    DispatchJob job = std::move(m_dispatchJobs.front());
+    m_dispatchJobs.pop_front();
+    lock.unlock();
+
+    // Everything queued before the barrier has been pushed: wait for the
+    // consumers to be done with it too.
+    if (job.barrier)
+      m_consumers->wait();
+    else
+      dispatch(job);
+
+    lock.lock();
+
+    if (job.barrier) {
+      ++m_barriersDone;
+      m_dispatchDone.notify_all();
+    } else if (m_dispatchSpare.size() < DISPATCH_MAX_QUEUE) {
+      m_dispatchSpare.push_back(std::move(job.samples));
+    }
+  }
+}
+
+// Frees the replaced tables the dispatch thread cannot be using anymore
+void
+MultiChannelForwarder::reclaimDispatchTables()
+{
+  uint64_t state = m_dispatchState.load();
+  auto it = m_retired.begin();
+
+  while (it != m_retired.end()) {
+    // Idle when it was replaced, or done with the job it was in
+    if ((it->second & 1) == 0 || it->second != state) {
+      delete it->first;
+      it = m_retired.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+//
+// Grace period. When this returns, the samples that were in flight when
+// the last table was published have been consumed, so the channels that
+// left the dispatch path can be closed, reopened or deleted.
+//
+void
+MultiChannelForwarder::synchronizeDispatch()
+{
+  if (m_synchronized == m_published)
+    return;
+
+  std::unique_lock<std::mutex> lock(m_dispatchMutex);
+  uint64_t barrier = ++m_barriersQueued;
+  DispatchJob job;
+
+  job.barrier = true;
+  m_dispatchJobs.push_back(std::move(job));
+  m_dispatchWakeUp.notify_one();
+
+  m_dispatchDone.wait(
+        lock,
+        [this, barrier] { return m_barriersDone >= barrier; });
+  lock.unlock();
+
+  m_synchronized = m_published;
+  reclaimDispatchTables();
+}
+
+void
+MultiChannelForwarder::publishDispatchTable()
+{
+  const DispatchTable *old = m_dispatchTable.load();
+  DispatchTable *table = new DispatchTable;
+
+  // Losses of closed inspectors must not reach a later one with the same
+  // handle
+  {
+    std::lock_guard<std::mutex> guard(m_dispatchMutex);
+    auto it = m_dispatchLost.begin();
+
+    while (it != m_dispatchLost.end())
+      if (channelMap.find(it->first) == channelMap.end())
+        it = m_dispatchLost.erase(it);
+      else
+        ++it;
+  }
+
+  for (auto &p : channelMap) {
+    MasterChannel *master = p.second->parent;
+    DispatchEntry entry;
+
+    entry.channel = p.second;
+    entry.paused  = master->direct && !master->enabled;
+    entry.sharers = p.second->sharers;
+
+    (*table)[p.first] = entry;
+  }
+
+  // Nothing changed
+  if (*table == *old) {
+    delete table;
+    return;
+  }
+
+  m_dispatchTable.store(table);
+  m_retired.push_back(std::make_pair(old, m_dispatchState.load()));
+  ++m_published;
+
+  reclaimDispatchTables();
+}
+
+uint64_t
+MultiChannelForwarder::dispatchDropped() const
+{
+  return m_dispatchDropped.load();
+}
+
+void
+MultiChannelForwarder::changed(const MasterChannel *master, bool withChannels)
+{
+  m_changedMasters.insert(master->name);
+
+  if (withChannels)
+    for (auto &c : master->channels)
+      m_changedChannels.insert(c.name);
+}
+
+void
+MultiChannelForwarder::changed(const ChannelDescription *channel)
+{
+  m_changedChannels.insert(channel->name);
+
+  for (auto s : channel->sharers)
+    m_changedChannels.insert(s->name);
+}
+
+void
+MultiChannelForwarder::takeChanges(
+    std::unordered_set<std::string> &masters,
+    std::unordered_set<std::string> &channels)
+{
+  masters.insert(m_changedMasters.begin(), m_changedMasters.end());
+  channels.insert(m_changedChannels.begin(), m_changedChannels.end());
+
+  m_changedMasters.clear();
+  m_changedChannels.clear();
 }
 
-bool
-MultiChannelForwarder::feedSamplesMessage(Suscan::SamplesMessage const &msg)
+// Takes every channel of a master (and its tap) out of the dispatch path
+void
+MultiChannelForwarder::unmapMaster(MasterChannel *master)
 {
-  ChannelDescription *ch;
+  for (auto &c : master->channels)
+    if (c.handle != SUSCAN_INVALID_HANDLE_VALUE)
+      channelMap.erase(AnalyzerHandle(master->analyzer, c.handle));
 
-  ch = getChannelFromHandle(msg.getInspectorId());
-  if (ch != nullptr) {
-    ch->consumer->samples(msg.getSamples(), msg.getCount());
-    return true;
-  }
+  if (master->tap != nullptr && master->tap->handle != SUSCAN_INVALID_HANDLE_VALUE)
+    channelMap.erase(AnalyzerHandle(master->analyzer, master->tap->handle));
 
-  return false;
+  publishDispatchTable();
+  synchronizeDispatch();
 }
 
 MasterChannel *
@@ -671,12 +2269,152 @@ MultiChannelForwarder::makeMaster(const char *name, SUFREQ frequency, SUFLOAT ba
     m_opened = false;
   }
 
-  if (m_opening)
+  if (m_opening && !m_importing)
     keepOpening();
 
   return master;
 }
 
+bool
+MultiChannelForwarder::setMasterEngine(
+    MasterChannel *master,
+    MasterEngine engine,
+    SUFLOAT spacing)
+{
+  if (master->isReady() || master->opening) {
+    error(
+        "Cannot change the engine of master `%s' while it is open.\n",
+        master->name.c_str());
+    return false;
+  }
+
+  master->engine      = engine;
+  master->gridSpacing = spacing;
+
+  if (engine != MASTER_ENGINE_INSPECTORS)
+    unshare(master);
+
+  return true;
+}
+
+void
+MultiChannelForwarder::setMasterActivity(
+    MasterChannel *master,
+    bool enabled,
+    SUFLOAT snr,
+    SUFLOAT hold)
+{
+  bool wasEnabled = master->activityDriven;
+
+  master->activityDriven = enabled;
+  master->activitySnr    = snr;
+  master->activityHold   = hold;
+
+  // Channels wait for a carrier from now on. When leaving the mode, they
+  // are handed back enabled.
+  for (auto &c : master->channels)
+    c.lastActivity = -INFINITY;
+
+  if (wasEnabled != enabled)
+    setChannelsEnabled(master, !enabled);
+}
+
+void
+MultiChannelForwarder::setMasterSpectrum(
+    MasterChannel *master,
+    SpectrumConsumer *consumer,
+    unsigned int bins,
+    SUFLOAT rate)
+{
+  SpectrumConsumer *old = master->spectrum;
+  ChannelDescription *tap = master->tap;
+
+  master->spectrum     = consumer;
+  master->spectrumBins = bins;
+  master->spectrumRate = rate;
+
+  if (tap != nullptr) {
+    ChannelizerTap *feed = static_cast<ChannelizerTap *>(tap->consumer);
+
+    if (!master->hasTapOutputs()
+        && master->channelizer == nullptr
+        && tap->isOpen()) {
+      // Nothing else needs the tap
+      closeTap(master);
+    } else if (consumer == nullptr) {
+      feed->setMonitor(nullptr);
+    } else {
+      SpectrumMonitor *monitor = new SpectrumMonitor(consumer, bins, rate);
+      monitor->setCenter(master->frequency + tap->offset);
+      feed->setMonitor(monitor);
+    }
+  } else if (consumer != nullptr && master->isOpen()) {
+    openTap(master);
+  }
+
+  delete old;
+}
+
+void
+MultiChannelForwarder::setMasterIQ(
+    MasterChannel *master,
+    ChannelConsumer *consumer)
+{
+  ChannelConsumer *old = master->iq;
+  ChannelDescription *tap = master->tap;
+
+  master->iq = consumer;
+
+  if (tap != nullptr) {
+    ChannelizerTap *feed = static_cast<ChannelizerTap *>(tap->consumer);
+
+    if (!master->hasTapOutputs()
+        && master->channelizer == nullptr
+        && tap->isOpen()) {
+      closeTap(master);
+    } else {
+      // Opens it too, if the tap is already running
+      feed->setForward(consumer);
+    }
+  } else if (consumer != nullptr && master->isOpen()) {
+    openTap(master);
+  }
+
+  delete old;
+}
+
+const char *
+MultiChannelForwarder::engineName(MasterEngine engine)
+{
+  switch (engine) {
+    case MASTER_ENGINE_PFB:
+      return "pfb";
+
+    case MASTER_ENGINE_OLS:
+      return "ols";
+
+    default:
+      return "inspectors";
+  }
+}
+
+bool
+MultiChannelForwarder::engineFromName(
+    std::string const &name,
+    MasterEngine &engine)
+{
+  if (name == "" || name == "inspectors")
+    engine = MASTER_ENGINE_INSPECTORS;
+  else if (name == "pfb")
+    engine = MASTER_ENGINE_PFB;
+  else if (name == "ols")
+    engine = MASTER_ENGINE_OLS;
+  else
+    return false;
+
+  return true;
+}
+
 bool
 MultiChannelForwarder::removeMaster(MasterListIterator it)
 {
@@ -688,6 +2426,9 @@ MultiChannelForwarder::removeMaster(MasterListIterator it)
     MasterChannel *master = *it;
     bool master_opened = master->isOpen();
 
+    if (!master->opening)
+      dropStandby(master);
+
     if (master->opening) {
       // This refers to a lazy closure. Mark as deleted and delete later.
       master->deleted = true;
@@ -695,10 +2436,30 @@ MultiChannelForwarder::removeMaster(MasterListIterator it)
     } else if (master_opened) {
       // We do not need to traverse the subchannels here. The closure
       // of the master triggers the close of the children
-      m_analyzer->closeInspector(master->handle);
-      masterMap.erase(master->handle);
+      master->analyzer->closeInspector(master->handle);
+      masterMap.erase(AnalyzerHandle(master->analyzer, master->handle));
       master->handle = SUSCAN_INVALID_HANDLE_VALUE;
+    } else if (master->direct) {
+      // No master inspector: channels must be closed one by one. The
+      // ones still being opened are closed when their handle arrives.
+      for (auto &c : master->channels) {
+        if (c.opening) {
+          c.deleted = true;
+          master->deleted = true;
+          delayed = true;
+        } else if (c.isOpen()) {
+          master->analyzer->closeInspector(c.handle);
+          channelMap.erase(AnalyzerHandle(master->analyzer, c.handle));
+          c.handle = SUSCAN_INVALID_HANDLE_VALUE;
+        }
+      }
     }
+
+    // Its channels go with it: they must not be found (and kept) by name
+    // while it waits for its handles
+    if (delayed)
+      for (auto &c : master->channels)
+        c.deleted = true;
   }
 
   // Nothing delayed. We can delete now.
@@ -793,25 +2554,349 @@ MultiChannelForwarder::makeChannel(
   channel->iter      = master->channels.begin();
   channel->opening   = false;
   channel->handle    = SUSCAN_INVALID_HANDLE_VALUE;
+  channel->worker    = m_nextWorker++;
 
   channelHash[name] = channel;
 
+  // Same inspector as an existing channel: get a copy of its samples
+  // instead of opening another one.
+  ChannelDescription *twin = findTwin(channel);
+
+  if (twin != nullptr) {
+    channel->owner = twin;
+    twin->sharers.push_back(channel);
+
+    if (twin->handle != SUSCAN_INVALID_HANDLE_VALUE) {
+      openSharer(channel);
+      publishDispatchTable();
+    }
+
+    return channel;
+  }
+
   if (m_opened) {
     m_opening = true;
     m_opened = false;
   }
 
-  if (m_opening)
+  if (m_opening && !m_importing)
     keepOpening();
 
   return channel;
 }
 
+bool
+MultiChannelForwarder::importPlan(ChannelPlan &plan)
+{
+  std::unordered_set<std::string> masters;
+  std::unordered_set<std::string> channels;
+  bool ok = true;
+
+  // First pass: everything must be valid before anything is created
+  for (auto &m : plan.masters) {
+    if (findMaster(m.name.c_str()) != nullptr
+        || !masters.insert(m.name).second) {
+      error("Master channel `%s' already exists.\n", m.name.c_str());
+      ok = false;
+    }
+  }
+
+  for (auto &c : plan.channels) {
+    bool inside = findMaster(c.frequency, c.bandwidth) != cend();
+
+    for (auto i = plan.masters.cbegin(); !inside && i != plan.masters.cend(); ++i)
+      inside = i->frequency - i->bandwidth / 2 <= c.frequency - c.bandwidth / 2
+          && c.frequency + c.bandwidth / 2 <= i->frequency + i->bandwidth / 2;
+
+    if (findChannel(c.name.c_str()) != nullptr
+        || !channels.insert(c.name).second) {
+      error("Channel `%s' already exists\n", c.name.c_str());
+      ok = false;
+    } else if (!inside) {
+      error("Channel `%s' is outside any master channel.\n", c.name.c_str());
+      ok = false;
+    }
+  }
+
+  if (!ok) {
+    plan.discard();
+    return false;
+  }
+
+  // Second pass: create everything, then open it in one go
+  std::vector<MasterChannel *> newMasters;
+  std::vector<ChannelDescription *> newChannels;
+
+  m_importing = true;
+
+  for (auto &m : plan.masters) {
+    MasterChannel *master = makePlanMaster(m);
+
+    if (master == nullptr) {
+      ok = false;
+      break;
+    }
+
+    newMasters.push_back(master);
+  }
+
+  for (auto i = plan.channels.begin(); ok && i != plan.channels.end(); ++i) {
+    ChannelDescription *channel = makeChannel(
+          i->name.c_str(),
+          i->frequency,
+          i->bandwidth,
+          i->inspClass.c_str(),
+          i->consumer);
+
+    if (channel == nullptr) {
+      ok = false;
+      break;
+    }
+
+    i->consumer = nullptr;
+    channel->priority = i->priority;
+    channel->consumer->setEnabled(
+          i->enabled && !channel->parent->activityDriven);
+    newChannels.push_back(channel);
+  }
+
+  // All or nothing: undo what was created (none of it is open yet)
+  if (!ok) {
+    for (auto channel : newChannels)
+      removeChannel(channel);
+
+    for (auto master : newMasters)
+      removeMaster(master);
+  }
+
+  m_importing = false;
+
+  // Consumers not taken go away with the plan
+  plan.discard();
+
+  if (m_opening)
+    keepOpening();
+
+  return ok;
+}
+
+MasterChannel *
+MultiChannelForwarder::makePlanMaster(MasterPlanEntry &m)
+{
+  MasterChannel *master = makeMaster(m.name.c_str(), m.frequency, m.bandwidth);
+
+  if (master == nullptr)
+    return nullptr;
+
+  if (!setMasterEngine(master, m.engine, m.gridSpacing)) {
+    removeMaster(master);
+    return nullptr;
+  }
+
+  master->setEnabled(m.enabled);
+  setMasterActivity(master, m.activityDriven, m.activitySnr, m.activityHold);
+  setMasterSpectrum(master, m.spectrum, m.spectrumBins, m.spectrumRate);
+  setMasterIQ(master, m.iq);
+
+  m.spectrum = nullptr;
+  m.iq       = nullptr;
+
+  return master;
+}
+
+bool
+MultiChannelForwarder::diffPlan(ChannelPlan &plan, PlanDiff &diff)
+{
+  std::unordered_map<std::string, const MasterPlanEntry *> masters;
+  std::unordered_map<std::string, const ChannelPlanEntry *> channels;
+  bool ok = true;
+
+  diff = PlanDiff();
+
+  // The plan replaces everything: it must be valid on its own
+  for (auto &m : plan.masters) {
+    if (!masters.insert(std::make_pair(m.name, &m)).second) {
+      error("Master channel `%s' already exists.\n", m.name.c_str());
+      ok = false;
+    }
+  }
+
+  for (auto &c : plan.channels) {
+    bool inside = false;
+
+    for (auto i = plan.masters.cbegin(); !inside && i != plan.masters.cend(); ++i)
+      inside = i->frequency - i->bandwidth / 2 <= c.frequency - c.bandwidth / 2
+          && c.frequency + c.bandwidth / 2 <= i->frequency + i->bandwidth / 2;
+
+    if (!channels.insert(std::make_pair(c.name, &c)).second) {
+      error("Channel `%s' already exists\n", c.name.c_str());
+      ok = false;
+    } else if (!inside) {
+      error("Channel `%s' is outside any master channel.\n", c.name.c_str());
+      ok = false;
+    }
+  }
+
+  if (!ok) {
+    plan.discard();
+    return false;
+  }
+
+  for (auto master : masterList) {
+    if (master->deleted)
+      continue;
+
+    auto m = masters.find(master->name);
+
+    // Moving a master or changing its engine means opening it again
+    if (m == masters.end()
+        || m->second->frequency != master->frequency
+        || m->second->bandwidth != master->bandwidth
+        || m->second->engine != master->engine
+        || m->second->gridSpacing != master->gridSpacing) {
+      diff.removedMasters.push_back(master);
+      continue;
+    }
+
+    for (auto &c : master->channels) {
+      if (c.deleted)
+        continue;
+
+      auto e = channels.find(c.name);
+
+      if (e == channels.end()
+          || e->second->frequency - master->frequency != c.offset
+          || e->second->bandwidth != c.bandwidth
+          || e->second->inspClass != c.inspClass
+          || !c.consumer->canUpdateFrom(*e->second->consumer))
+        diff.removedChannels.push_back(&c);
+    }
+  }
+
+  return true;
+}
+
+bool
+MultiChannelForwarder::applyPlan(ChannelPlan &plan, PlanDiff &diff)
+{
+  bool ok = true;
+
+  m_importing = true;
+
+  for (auto channel : diff.removedChannels)
+    removeChannel(channel);
+
+  for (auto master : diff.removedMasters)
+    removeMaster(master);
+
+  for (auto &m : plan.masters) {
+    MasterChannel *master = findMaster(m.name.c_str());
+
+    if (master == nullptr) {
+      master = makePlanMaster(m);
+
+      // Its channels will be reported as outside any master
+      if (master != nullptr)
+        diff.addedMasters.push_back(master);
+      else
+        ok = false;
+      continue;
+    }
+
+    // Kept master: everything else can change while it is open
+    master->setEnabled(m.enabled);
+
+    if (m.activityDriven != master->activityDriven
+        || m.activitySnr != master->activitySnr
+        || m.activityHold != master->activityHold)
+      setMasterActivity(
+            master,
+            m.activityDriven,
+            m.activitySnr,
+            m.activityHold);
+
+    if ((m.spectrum == nullptr) != (master->spectrum == nullptr)
+        || m.spectrumBins != master->spectrumBins
+        || m.spectrumRate != master->spectrumRate) {
+      setMasterSpectrum(master, m.spectrum, m.spectrumBins, m.spectrumRate);
+      m.spectrum = nullptr;
+    }
+
+    if (m.iq != nullptr
+        && master->iq != nullptr
+        && master->iq->canUpdateFrom(*m.iq)) {
+      master->iq->updateFrom(*m.iq);
+    } else if (m.iq != nullptr || master->iq != nullptr) {
+      setMasterIQ(master, m.iq);
+      m.iq = nullptr;
+    }
+  }
+
+  for (auto &c : plan.channels) {
+    ChannelDescription *channel = findChannel(c.name.c_str());
+
+    if (channel == nullptr) {
+      channel = makeChannel(
+            c.name.c_str(),
+            c.frequency,
+            c.bandwidth,
+            c.inspClass.c_str(),
+            c.consumer);
+
+      if (channel == nullptr) {
+        ok = false;
+        continue;
+      }
+
+      c.consumer = nullptr;
+      channel->priority = c.priority;
+      channel->consumer->setEnabled(c.enabled && !channel->parent->activityDriven);
+      diff.addedChannels.push_back(channel);
+    } else {
+      channel->priority = c.priority;
+      channel->consumer->updateFrom(*c.consumer);
+
+      if (!channel->parent->activityDriven) {
+        channel->consumer->setEnabled(c.enabled);
+        changed(channel);
+      }
+    }
+  }
+
+  m_importing = false;
+
+  // Consumers not taken (kept entries) go away with the plan
+  plan.discard();
+
+  if (m_opening)
+    keepOpening();
+
+  return ok;
+}
+
 bool
 MultiChannelForwarder::removeChannel(ChannelListIterator it)
 {
   bool delayed = false;
 
+  // Shared inspectors outlive the channels that asked for them
+  if (it->owner != nullptr || !it->sharers.empty()) {
+    ChannelDescription *heir = nullptr;
+
+    if (it->owner == nullptr) {
+      heir = it->sharers.front();
+      handOver(&*it);
+    }
+
+    // Waits for the samples in flight to the old owner
+    deleteChannel(it);
+
+    if (heir != nullptr && heir->handle != SUSCAN_INVALID_HANDLE_VALUE)
+      adoptInspector(heir);
+
+    return true;
+  }
+
   // The removal of a channel may occur immediately or be delayed
   if (m_opened) {
     ChannelDescription *channel = &*it;
@@ -821,11 +2906,17 @@ MultiChannelForwarder::removeChannel(ChannelListIterator it)
       // This refers to a lazy closure. Mark as deleted and delete later.
       channel->deleted = true;
       delayed = true;
+    } else if (channel->attached) {
+      // No inspector behind it. deleteChannel detaches it from the
+      // channelizer.
     } else if (channel_opened) {
-      // We do not need to traverse the subchannels here. The closure
-      // of the master triggers the close of the children
-      m_analyzer->closeInspector(channel->handle);
-      channelMap.erase(channel->handle);
+      // Keep the inspector around in case a similar channel is added
+      // soon. Otherwise, close it.
+      Suscan::Analyzer *analyzer = channel->parent->analyzer;
+
+      if (!parkChannel(channel))
+        analyzer->closeInspector(channel->handle);
+      channelMap.erase(AnalyzerHandle(analyzer, channel->handle));
     }
   }
 
@@ -842,13 +2933,199 @@ MultiChannelForwarder::removeChannel(ChannelDescription *channel)
   return removeChannel(channel->iter);
 }
 
-MultiChannelForwarder::MultiChannelForwarder()
+void
+MultiChannelForwarder::setChannelsEnabled(MasterChannel *master, bool enabled)
+{
+  for (auto &c : master->channels)
+    c.consumer->setEnabled(enabled);
+
+  changed(master, true);
+}
+
+unsigned int
+MultiChannelForwarder::syncEnableStates(bool disables)
+{
+  unsigned int count = 0;
+
+  // Sharers leave the inspector to its owner, which keeps it configured
+  // while any of them is enabled
+  for (auto &p : channelMap) {
+    bool inUse = p.second->inUse();
+
+    if ((disables || inUse) && p.second->consumer->syncEnableState(inUse))
+      ++count;
+  }
+
+  return count;
+}
+
+//
+// The noise floor of each master is the lower quartile of the bins it
+// spans, which holds as long as its channels are not busy at the same
+// time. A channel is active when the mean power in its slot exceeds the
+// floor by the SNR of its master, and stays enabled until it has been
+// quiet for the hold time of the master.
+//
+ActivityUpdate
+MultiChannelForwarder::feedPsd(
+    Suscan::Analyzer *analyzer,
+    SUFREQ center,
+    SUFLOAT sampRate,
+    const SUFLOAT *psd,
+    unsigned int size)
+{
+  ActivityUpdate update;
+  std::vector<SUFLOAT> bins;
+  SUFREQ start = center - .5 * sampRate;
+  double binWidth;
+  double now = std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+  if (size == 0 || sampRate <= 0)
+    return update;
+
+  binWidth = static_cast<double>(sampRate) / size;
+
+  for (auto master : masterList) {
+    long first, last;
+    SUFLOAT floor, threshold;
+
+    // Masters on other analyzers are not in this spectrum
+    if (!master->activityDriven || master->deleted
+        || master->analyzer != analyzer)
+      continue;
+
+    first = lround(
+          (master->frequency - .5 * master->bandwidth - start) / binWidth);
+    last  = lround(
+          (master->frequency + .5 * master->bandwidth - start) / binWidth);
+
+    // Not fully in the spectrum: leave its channels as they are
+    if (first < 0 || last > static_cast<long>(size) || last - first < 4)
+      continue;
+
+    bins.assign(psd + first, psd + last);
+    std::nth_element(bins.begin(), bins.begin() + bins.size() / 4, bins.end());
+    floor = bins[bins.size() / 4];
+
+    if (floor <= 0)
+      continue;
+
+    threshold = floor * static_cast<SUFLOAT>(std::pow(10., master->activitySnr / 10.));
+
+    for (auto &c : master->channels) {
+      SUFREQ freq = master->frequency + c.offset;
+      long lo = lround((freq - .5 * c.bandwidth - start) / binWidth);
+      long hi = lround((freq + .5 * c.bandwidth - start) / binWidth);
+      SUFLOAT power = 0;
+      bool active;
+
+      lo = std::max(lo, first);
+      hi = std::min(std::max(hi, lo + 1), last);
+
+      for (long i = lo; i < hi; ++i)
+        power += psd[i];
+
+      if (hi > lo && power >= threshold * (hi - lo))
+        c.lastActivity = now;
+
+      active = now - c.lastActivity <= master->activityHold;
+
+      if (active != c.consumer->isEnabled()) {
+        c.consumer->setEnabled(active);
+        changed(&c);
+        if (active)
+          ++update.enabled;
+        else
+          ++update.disabled;
+      }
+    }
+  }
+
+  return update;
+}
+
+void
+MultiChannelForwarder::setAffinity(
+    std::vector<int> const &consumers,
+    std::vector<int> const &workers)
+{
+  m_consumers->setAffinity(consumers);
+
+  m_workerCpus = workers;
+  if (m_pool != nullptr)
+    m_pool->setAffinity(workers);
+}
+
+//////////////////////////////// ChannelPlan ////////////////////////////////
+MasterPlanEntry *
+ChannelPlan::findMaster(std::string const &name)
+{
+  // Settings of an entry usually follow it: search from the end
+  for (auto i = masters.rbegin(); i != masters.rend(); ++i)
+    if (i->name == name)
+      return &*i;
+
+  return nullptr;
+}
+
+ChannelPlanEntry *
+ChannelPlan::findChannel(std::string const &name)
+{
+  for (auto i = channels.rbegin(); i != channels.rend(); ++i)
+    if (i->name == name)
+      return &*i;
+
+  return nullptr;
+}
+
+void
+ChannelPlan::discard()
 {
+  for (auto &m : masters) {
+    delete m.spectrum;
+    delete m.iq;
+  }
+
+  for (auto &c : channels)
+    delete c.consumer;
+
+  masters.clear();
+  channels.clear();
+}
 
+MultiChannelForwarder::MultiChannelForwarder(unsigned int consumerThreads)
+{
+  m_dispatchTable   = new DispatchTable;
+  m_dispatchState   = 0;
+  m_dispatchDropped = 0;
+  m_consumers       = new ConsumerPool(consumerThreads);
+  m_dispatchThread  = std::thread(&MultiChannelForwarder::runDispatch, this);
 }
 
 MultiChannelForwarder::~MultiChannelForwarder()
 {
-  for (auto p : masterList)
+  channelMap.clear();
+  publishDispatchTable();
+  synchronizeDispatch();
+
+  {
+    std::lock_guard<std::mutex> guard(m_dispatchMutex);
+    m_dispatchStop = true;
+  }
+
+  m_dispatchWakeUp.notify_one();
+  m_dispatchThread.join();
+
+  for (auto p : masterList) {
+    dropTap(p);
     delete p;
+  }
+
+  for (auto &p : m_retired)
+    delete p.first;
+
+  delete m_dispatchTable.load();
+  delete m_consumers;
+  delete m_pool;
 }
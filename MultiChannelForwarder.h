@@ -22,15 +22,38 @@
 
 #include <Suscan/Analyzer.h>
 #include <Suscan/Messages/InspectorMessage.h>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <map>
 #include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
 #include <unordered_map>
+#include <unordered_set>
 
 struct ChannelDescription;
 class MultiChannelForwarder;
+class Channelizer;
+class Demodulator;
+class WorkerPool;
+class ConsumerPool;
+
+// Demodulators run by the plugin, for channels produced by a channelizer
+enum ChannelDemodulator {
+  CHANNEL_DEMOD_NONE,
+  CHANNEL_DEMOD_AM,
+  CHANNEL_DEMOD_FM,
+  CHANNEL_DEMOD_USB,
+  CHANNEL_DEMOD_LSB
+};
 
 class ChannelConsumer {
-  bool m_enabled = true;
+  std::atomic<bool> m_enabled{true}; // Also read from the dispatch thread
 
 public:
   virtual void opened(
@@ -40,7 +63,45 @@ public:
       Suscan::Config const &) = 0;
   virtual void samples(const SUCOMPLEX *, SUSCOUNT) = 0;
   virtual void closed() = 0;
+
+  // Samples of the channel that were dropped before reaching samples()
+  // (full dispatch queue). Called from the same thread and in the same
+  // order as samples(). By default, ignored.
+  virtual void dropped(SUSCOUNT);
+
+  // Enable state changes must be cheap (no analyzer round trips). Consumers
+  // that need to reconfigure their inspector do it lazily in
+  // syncEnableState, which returns true if a message was sent. The
+  // inspector is in use while this consumer or any consumer sharing it
+  // is enabled.
   virtual void enableStateChanged(bool) = 0;
+  virtual bool syncEnableState(bool inUse);
+
+  // Called when the LO of a channel opened directly on the analyzer
+  // changes. The default implementation just moves the inspector to
+  // the new frequency.
+  virtual void retuned(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &);
+
+  // Demodulator to use if the channel is produced by a channelizer instead
+  // of an audio inspector. CHANNEL_DEMOD_NONE keeps it in an inspector.
+  virtual ChannelDemodulator channelDemodulator() const;
+
+  // Whether the settings of another consumer for the same channel can be
+  // taken without reopening it (by default, they cannot), and how.
+  virtual bool canUpdateFrom(ChannelConsumer const &) const;
+  virtual void updateFrom(ChannelConsumer const &);
+
+  // Whether this consumer changes the configuration of its inspector when
+  // it is opened (by default, it does not)
+  virtual bool configuresInspector() const;
+
+  // Whether this consumer can take its samples from the inspector opened
+  // for another one, with the same frequency, bandwidth and class. By
+  // default, if neither of them configures the inspector.
+  virtual bool sharesInspectorWith(ChannelConsumer const &) const;
 
   void setEnabled(bool);
   bool isEnabled() const;
@@ -48,20 +109,86 @@ public:
   virtual ~ChannelConsumer();
 };
 
+// Receives the averaged spectrum of a master (see SpectrumMonitor)
+class SpectrumConsumer {
+public:
+  virtual void spectrum(
+      SUFREQ center,
+      SUFLOAT sampRate,
+      const SUFLOAT *psd,
+      unsigned int bins) = 0;
+
+  virtual ~SpectrumConsumer();
+};
+
 struct MasterChannel;
 
+// Inspector of a removed channel, kept open so that a new channel of the
+// same class in the same master can reuse it without a full open. Parked
+// audio inspectors are idle: their demodulator is off and they deliver
+// STANDBY_WATERMARK_SECS seconds of samples per message.
+#define STANDBY_MAX_INSPECTORS 8
+#define STANDBY_WATERMARK_SECS 5
+
+struct StandbyInspector {
+  MasterChannel     *parent;
+  std::string        inspClass;
+  Suscan::Handle     handle;
+  SUFLOAT            sampRate;
+  Suscan::Config     config;
+};
+
+// Handles and request ids are only unique within the same analyzer
+typedef std::pair<const Suscan::Analyzer *, Suscan::Handle> AnalyzerHandle;
+typedef std::pair<const Suscan::Analyzer *, Suscan::RequestId> AnalyzerRequest;
+typedef std::map<const Suscan::Analyzer *, Suscan::AnalyzerSourceInfo> SourceInfoMap;
+
 typedef std::list<ChannelDescription>::iterator ChannelListIterator;
 typedef std::list<MasterChannel *>::iterator MasterListIterator;
 typedef std::list<MasterChannel *>::const_iterator MasterListConstIterator;
 typedef std::unordered_map<std::string, ChannelDescription *>::const_iterator ChannelHashConstIterator;
 
+// What the sample dispatch path needs to know about an open channel
+struct DispatchEntry {
+  ChannelDescription *channel;
+  bool                paused; // Disabled direct master: drop its samples
+  std::vector<ChannelDescription *> sharers; // Also fed with the samples
+
+  inline bool
+  operator==(DispatchEntry const &other) const
+  {
+    return channel == other.channel
+        && paused == other.paused
+        && sharers == other.sharers;
+  }
+};
+
+// Immutable snapshot of channelMap, read without locks by the dispatch
+// thread. See publishDispatchTable().
+typedef std::map<AnalyzerHandle, DispatchEntry> DispatchTable;
+
+// Sample blocks waiting for the dispatch thread. Beyond this, new blocks
+// are dropped (and counted) instead of stalling the GUI thread. Their
+// consumers learn about it before the next block that gets through.
+#define DISPATCH_MAX_QUEUE 1024
+
+struct DispatchJob {
+  AnalyzerHandle         target;
+  std::vector<SUCOMPLEX> samples;
+  SUSCOUNT               dropped = 0;     // Samples lost right before these
+  bool                   barrier = false; // See synchronizeDispatch()
+};
+
 struct ChannelDescription {
   MasterChannel *parent;
   std::string    name;
   SUFREQ         offset;
   SUFLOAT        bandwidth;
+  SUFREQ         loFreq = 0; // Inspector frequency, relative to its parent
+  SUFREQ         loSent = 0; // Last frequency sent to the inspector
 
   SUFLOAT        sampRate;
+  SUFLOAT        priority = 1; // Weight used for tuner placement
   std::string    inspClass;
   Suscan::Config inspConfig;
 
@@ -71,16 +198,44 @@ struct ChannelDescription {
   Suscan::RequestId  reqId;
   bool               opening = false;
   bool               deleted = false;
+  bool               attached = false; // Fed by the channelizer of its master
+  Demodulator       *demodulator = nullptr; // Audio of attached channels
+  unsigned int       worker = 0; // Consumer pool worker delivering samples
+  double             lastActivity = -INFINITY; // Last carrier seen (s)
+
+  // Identical channels share one inspector. The owner opens and configures
+  // it, and the rest (which never touch it) get a copy of its samples.
+  ChannelDescription *owner = nullptr;
+  std::vector<ChannelDescription *> sharers;
 
   inline bool
   isOpen() const
   {
-    return handle != SUSCAN_INVALID_HANDLE_VALUE;
+    return handle != SUSCAN_INVALID_HANDLE_VALUE || attached;
+  }
+
+  // Whether the consumer of this channel or of any of its sharers is
+  // enabled, and its samples are not dropped with a paused direct master
+  bool inUse() const;
+
+  // The channel whose inspector delivers the samples of this one
+  inline const ChannelDescription *
+  source() const
+  {
+    return owner != nullptr ? owner : this;
   }
 
   ~ChannelDescription();
 };
 
+// How the raw channels of a master are produced. Channels of any other
+// class are always opened as inspectors.
+enum MasterEngine {
+  MASTER_ENGINE_INSPECTORS, // One suscan inspector per channel
+  MASTER_ENGINE_PFB,        // Polyphase filterbank, for regular grids
+  MASTER_ENGINE_OLS         // Overlap-save filterbank, arbitrary positions
+};
+
 struct MasterChannel {
   MultiChannelForwarder *owner;
   std::string    name;
@@ -90,14 +245,46 @@ struct MasterChannel {
 
   std::list<ChannelDescription> channels;
   MasterListIterator  iter;
+  Suscan::Analyzer  *analyzer = nullptr; // Analyzer the master is opened on
   Suscan::Handle     handle  = SUSCAN_INVALID_HANDLE_VALUE;
   Suscan::RequestId  reqId;
   Suscan::Config     config;
   bool               opening = false;
   unsigned int       open_count = 0;
   bool               deleted = false;
+  bool               suspended = false; // Out of the tuner passband
+  bool               direct = false; // Channels opened on the analyzer
+  SUFREQ             loFreq = 0; // Target LO, relative to the tuner
+  SUFREQ             loSent = 0; // Last LO sent to the inspector
+
+  MasterEngine       engine = MASTER_ENGINE_INSPECTORS;
+  SUFLOAT            gridSpacing = 0; // PFB channel spacing (0: deduce)
+  ChannelDescription *tap = nullptr; // Raw feed of the channelizer
+  Channelizer        *channelizer = nullptr;
+
+  // Activity-driven mode: channels are enabled only while the spectrum
+  // shows a carrier in their slot. See MultiChannelForwarder::feedPsd.
+  bool               activityDriven = false;
+  SUFLOAT            activitySnr  = 6; // dB above the master noise floor
+  SUFLOAT            activityHold = 5; // Seconds enabled after the carrier
+
+  // Averaged spectrum of the master, computed on its tap
+  SpectrumConsumer  *spectrum = nullptr;
+  unsigned int       spectrumBins = 0;
+  SUFLOAT            spectrumRate = 0; // Updates per second
+
+  // Raw IQ of the master, taken from its tap
+  ChannelConsumer   *iq = nullptr;
 
   void setEnabled(bool);
+  bool hasPendingChannels() const;
+
+  // Whether the tap is needed even without channelizer channels
+  inline bool
+  hasTapOutputs() const
+  {
+    return spectrum != nullptr || iq != nullptr;
+  }
 
   inline bool
   isOpen() const
@@ -110,18 +297,136 @@ struct MasterChannel {
   {
     return channels.empty();
   }
+
+  // Whether channels can be opened (i.e. the master is open or we
+  // decided to skip it)
+  inline bool
+  isReady() const
+  {
+    return direct || isOpen();
+  }
+};
+
+enum MultiChannelTopology {
+  MULTI_CHANNEL_TOPOLOGY_AUTO,
+  MULTI_CHANNEL_TOPOLOGY_MASTER,
+  MULTI_CHANNEL_TOPOLOGY_DIRECT
+};
+
+// Estimated number of samples per second processed by the inspectors of
+// a master, depending on whether its channels are opened through the
+// master inspector or directly on the analyzer.
+struct TopologyCost {
+  SUFLOAT viaMaster = 0;
+  SUFLOAT direct    = 0;
+};
+
+struct RetuneStats {
+  uint64_t requested = 0; // LO target changes (messages, if not coalesced)
+  uint64_t sent      = 0; // LO updates actually sent
+};
+
+struct ActivityUpdate {
+  unsigned int enabled  = 0; // Channels where a carrier appeared
+  unsigned int disabled = 0; // Channels silent for longer than the hold
+};
+
+//
+// Channel plan applied at once by MultiChannelForwarder::importPlan.
+// Masters may carry the same settings as the setMaster* methods.
+//
+struct MasterPlanEntry {
+  std::string        name;
+  SUFREQ             frequency;
+  SUFLOAT            bandwidth;
+  bool               enabled = true;
+
+  MasterEngine       engine = MASTER_ENGINE_INSPECTORS;
+  SUFLOAT            gridSpacing = 0;
+  bool               activityDriven = false;
+  SUFLOAT            activitySnr  = 6;
+  SUFLOAT            activityHold = 5;
+  SpectrumConsumer  *spectrum = nullptr;
+  unsigned int       spectrumBins = 0;
+  SUFLOAT            spectrumRate = 0;
+  ChannelConsumer   *iq = nullptr;
+};
+
+struct ChannelPlanEntry {
+  std::string        name;
+  SUFREQ             frequency;
+  SUFLOAT            bandwidth;
+  std::string        inspClass;
+  ChannelConsumer   *consumer = nullptr;
+  bool               enabled = true;
+  SUFLOAT            priority = 1;
+};
+
+struct ChannelPlan {
+  std::vector<MasterPlanEntry>  masters;
+  std::vector<ChannelPlanEntry> channels;
+
+  MasterPlanEntry *findMaster(std::string const &);
+  ChannelPlanEntry *findChannel(std::string const &);
+
+  // Deletes the consumers and empties the plan
+  void discard();
+};
+
+// Differences between the current channels and a plan, found by
+// MultiChannelForwarder::diffPlan. Entries that changed are removed and
+// created again; anything else is updated in place and stays open.
+struct PlanDiff {
+  std::vector<MasterChannel *>      removedMasters;
+  std::vector<ChannelDescription *> removedChannels; // Of kept masters
+
+  // Filled by applyPlan
+  std::vector<MasterChannel *>      addedMasters;
+  std::vector<ChannelDescription *> addedChannels;
+};
+
+struct TunerPlacement {
+  SUFREQ       frequency = 0;
+  SUFLOAT      score     = 0; // Weighted priority of the channels that fit
+  SUFLOAT      maxScore  = 0; // Weighted priority of all channels
+  unsigned int masters   = 0; // Masters inside the passband
+  unsigned int channels  = 0; // Channels inside the passband and away from DC
+  unsigned int nearDc    = 0; // Channels lost to the DC spike
+  unsigned int totalChannels = 0;
 };
 
 class MultiChannelForwarder
 {
-  Suscan::Analyzer *m_analyzer = nullptr;
+  Suscan::Analyzer *m_analyzer = nullptr; // Primary analyzer (tunable)
+  std::vector<Suscan::Analyzer *> m_analyzers;
   bool m_opening = false;
   bool m_opened = false;
+  bool m_importing = false; // Open once, at the end of importPlan
   SUFREQ m_freqMin = INFINITY;
   SUFREQ m_freqMax = -INFINITY;
   std::string m_errors;
   bool m_failed = false;
   SUFLOAT m_maxBandwidth = 2e5;
+  SUFLOAT m_dcGuard = 0;
+  MultiChannelTopology m_topology = MULTI_CHANNEL_TOPOLOGY_AUTO;
+  RetuneStats m_retuneStats;
+  WorkerPool *m_pool = nullptr; // Created with the first channelizer
+  std::vector<int> m_workerCpus;
+
+  // Warm standby inspectors, oldest first
+  std::list<StandbyInspector> m_standby;
+  bool parkChannel(ChannelDescription *);
+  bool reuseStandby(ChannelDescription *, Suscan::AnalyzerSourceInfo const &);
+  void dropStandby(MasterChannel *);
+
+  // Inspector sharing
+  ChannelDescription *findTwin(const ChannelDescription *) const;
+  void openSharer(ChannelDescription *);
+  void openSharers(ChannelDescription *);
+  void closeSharers(ChannelDescription *);
+  void handOver(ChannelDescription *);
+  void adoptInspector(ChannelDescription *);
+  void unshare(MasterChannel *);
 
   // Owner: This holds the structure of the channels to open
   std::list<MasterChannel *> masterList;
@@ -131,22 +436,98 @@ class MultiChannelForwarder
   std::unordered_map<std::string, ChannelDescription *> channelHash;
 
   // This is a map that enumerates opened masters
-  std::map<Suscan::Handle, MasterChannel *> masterMap;
-  std::map<Suscan::RequestId, MasterChannel *> pendingMasterMap;
+  std::map<AnalyzerHandle, MasterChannel *> masterMap;
+  std::map<AnalyzerRequest, MasterChannel *> pendingMasterMap;
   bool promoteMaster(
+      Suscan::Analyzer *,
       Suscan::RequestId,
       Suscan::Handle,
       const suscan_config_t *);
 
   // This is a map that relates opened channels with consumers
-  std::map<Suscan::Handle, ChannelDescription *> channelMap;
-  std::map<Suscan::RequestId, ChannelDescription *> pendingChannelMap;
-  bool promoteChannel(Suscan::RequestId, Suscan::Handle);
-
+  std::map<AnalyzerHandle, ChannelDescription *> channelMap;
+  std::map<AnalyzerRequest, ChannelDescription *> pendingChannelMap;
+  bool promoteChannel(Suscan::Analyzer *, Suscan::RequestId, Suscan::Handle);
+
+  // Sample dispatch. The GUI thread only copies the samples to
+  // m_dispatchJobs. The dispatch thread looks them up in a snapshot of
+  // channelMap and hands them to the consumer pool. m_dispatchState is
+  // odd while it holds a snapshot: replaced snapshots wait in m_retired
+  // until it is seen to change (or to be even).
+  std::atomic<const DispatchTable *> m_dispatchTable;
+  std::atomic<uint64_t> m_dispatchState;
+  std::list<std::pair<const DispatchTable *, uint64_t>> m_retired;
+  uint64_t m_published = 0;  // Tables published so far
+  uint64_t m_synchronized = 0; // Published before the last grace period
+
+  std::thread m_dispatchThread;
+  std::mutex m_dispatchMutex;
+  std::condition_variable m_dispatchWakeUp; // Jobs available (or stop)
+  std::condition_variable m_dispatchDone;   // A barrier was reached
+  std::deque<DispatchJob> m_dispatchJobs;
+  std::vector<std::vector<SUCOMPLEX>> m_dispatchSpare;
+  uint64_t m_barriersQueued = 0;
+  uint64_t m_barriersDone = 0;
+  bool m_dispatchStop = false;
+  std::atomic<uint64_t> m_dispatchDropped;
+  std::map<AnalyzerHandle, SUSCOUNT> m_dispatchLost; // Not yet reported
+
+  // Names of the entries whose state (open, suspended, enabled) changed
+  // since the last takeChanges()
+  std::unordered_set<std::string> m_changedMasters;
+  std::unordered_set<std::string> m_changedChannels;
+
+  ConsumerPool *m_consumers = nullptr;
+  unsigned int m_nextWorker = 0;
+  void runDispatch();
+  void dispatch(DispatchJob const &);
+  void reclaimDispatchTables();
+  void synchronizeDispatch();
+  void unmapMaster(MasterChannel *);
+
+  // Creates a master with the settings of a plan entry, through the
+  // same setters as the UI. Takes its spectrum and IQ consumers.
+  MasterChannel *makePlanMaster(MasterPlanEntry &);
+
+  SourceInfoMap sourceInfos() const;
+  Suscan::Analyzer *findAnalyzer(
+      const MasterChannel *,
+      SourceInfoMap const &) const;
   void keepOpening();
-  MasterChannel *getMasterFromRequest(Suscan::RequestId) const;
-  ChannelDescription *getChannelFromRequest(Suscan::RequestId) const;
-  ChannelDescription *getChannelFromHandle(Suscan::Handle) const;
+
+  // Masters that fit in some analyzer other than the primary one. They
+  // stay open wherever the primary is tuned, so placement ignores them.
+  typedef std::unordered_set<const MasterChannel *> MasterSet;
+  MasterSet coveredElsewhere() const;
+  void primaryLimits(SUFREQ &, SUFREQ &) const;
+  void evalPlacement(
+      TunerPlacement &,
+      SUFREQ,
+      SUFREQ,
+      MasterSet const &) const;
+  TopologyCost estimateCost(const MasterChannel *, SUFLOAT) const;
+  bool preferDirect(const MasterChannel *, SUFLOAT) const;
+  bool masterFits(
+      const MasterChannel *,
+      Suscan::AnalyzerSourceInfo const &) const;
+  void suspendMaster(MasterChannel *);
+
+  // Channelizer engines
+  bool isEngineChannel(const ChannelDescription *) const;
+  void openTap(MasterChannel *);
+  void attachChannel(ChannelDescription *);
+  void dropTap(MasterChannel *);
+  void closeTap(MasterChannel *);
+
+  MasterChannel *getMasterFromRequest(
+      const Suscan::Analyzer *,
+      Suscan::RequestId) const;
+  ChannelDescription *getChannelFromRequest(
+      const Suscan::Analyzer *,
+      Suscan::RequestId) const;
+  ChannelDescription *getChannelFromHandle(
+      const Suscan::Analyzer *,
+      Suscan::Handle) const;
 
   MasterListIterator deleteMaster(MasterListIterator);
   ChannelListIterator deleteChannel(ChannelListIterator);
@@ -239,21 +620,62 @@ public:
     return masterList.empty();
   }
 
+  // Makes the dispatch path see the current state of the channel map.
+  // It does not wait: channels that left the map may still get the
+  // samples already in flight until synchronizeDispatch() is called.
+  void publishDispatchTable();
+
+  // Sample blocks dropped because the dispatch thread was behind
+  uint64_t dispatchDropped() const;
+
+  // Records that the state of an entry changed, so the UI can refresh
+  // it. Changing a channel changes the channels sharing its inspector.
+  void changed(const MasterChannel *, bool withChannels = false);
+  void changed(const ChannelDescription *);
+
+  // Adds the names of the masters and channels changed since the last
+  // call to the given sets, and forgets them.
+  void takeChanges(
+      std::unordered_set<std::string> &masters,
+      std::unordered_set<std::string> &channels);
+
   bool failed() const; // Something went wrong
   std::string getErrors() const;
   void clearErrors();
   bool canOpen() const; // Returns if channels can be opened
-  bool canCenter() const; // Returns if all masters fit
-  bool center(); // Center masters
+  bool canOpenAny() const; // Returns if at least one master can be opened
+  bool canCenter() const; // Returns if all masters fit the primary analyzer
+  bool center(); // Tune to the optimal placement
+  bool findPlacement(TunerPlacement &) const;
   SUFREQ span() const;
   SUFREQ getCenter() const;
   bool isOpen() const;
   bool isPartiallyOpen() const;
   void setMaxBandwidth(SUFLOAT max);
+  void setDcGuard(SUFLOAT); // Width of the DC spike region to avoid
+  SUFLOAT dcGuard() const;
+  void setTopology(MultiChannelTopology); // For masters opened from now on
+  unsigned int standbyCount() const;
+  MultiChannelTopology topology() const;
+  static const char *topologyName(MultiChannelTopology);
+  static bool topologyFromName(std::string const &, MultiChannelTopology &);
+  TopologyCost estimateCost(const MasterChannel *) const;
 
   // If track tuner is enabled, we call this periodically to update the
-  // LO of each master. No need to touch the channels.
+  // LO of each master. No need to touch the channels. This only records
+  // the new targets: nothing is sent to the analyzer until flushLo(),
+  // so only the latest target of each master is sent per call.
   void adjustLo();
+  unsigned int flushLo();
+  RetuneStats retuneStats() const;
+  void resetRetuneStats();
+
+  // Called when the tuner moves. Masters that left the passband are
+  // suspended and those that got back into it are reopened. Returns true
+  // if the suspension state of any master changed. Like adjustLo(), it
+  // leaves the new LO targets for flushLo().
+  bool retune();
+  unsigned int suspendedCount() const;
 
   void updateMasterConfig(MasterChannel *);
 
@@ -261,10 +683,43 @@ public:
   void openAll(); // Used to open all masters and channels
   void closeAll(); // Used to close all masters and channels
 
+  // Additional analyzers. Each master is opened on the analyzer whose
+  // passband covers it best. The first analyzer is the primary one, used
+  // for tuner placement.
+  bool addAnalyzer(Suscan::Analyzer *);
+  bool removeAnalyzer(Suscan::Analyzer *);
+  std::vector<Suscan::Analyzer *> const &analyzers() const;
+
+  // Messages from the primary analyzer
   bool processMessage(Suscan::InspectorMessage const &);
   bool feedSamplesMessage(Suscan::SamplesMessage const &);
 
+  // GUI thread only. Samples are queued for the dispatch thread.
+  bool processMessage(Suscan::Analyzer *, Suscan::InspectorMessage const &);
+  bool feedSamplesMessage(Suscan::Analyzer *, Suscan::SamplesMessage const &);
+
   MasterChannel *makeMaster(const char *, SUFREQ freq, SUFLOAT bw);
+  bool setMasterEngine(MasterChannel *, MasterEngine, SUFLOAT spacing = 0);
+  void setMasterActivity(
+      MasterChannel *,
+      bool enabled,
+      SUFLOAT snr = 6,
+      SUFLOAT hold = 5);
+
+  // Publishes the averaged spectrum of a master (nullptr: stop). Takes
+  // ownership of the consumer. Masters opened directly on the analyzer
+  // have no tap: the spectrum starts when they are reopened.
+  void setMasterSpectrum(
+      MasterChannel *,
+      SpectrumConsumer *,
+      unsigned int bins,
+      SUFLOAT rate);
+
+  // Publishes the raw IQ of a master (nullptr: stop), at the rate of its
+  // tap. Takes ownership of the consumer. Same restrictions as above.
+  void setMasterIQ(MasterChannel *, ChannelConsumer *);
+  static const char *engineName(MasterEngine);
+  static bool engineFromName(std::string const &, MasterEngine &);
   bool removeMaster(MasterListIterator);
   bool removeMaster(MasterChannel *);
 
@@ -281,7 +736,49 @@ public:
   bool removeChannel(ChannelListIterator);
   bool removeChannel(ChannelDescription *);
 
-  MultiChannelForwarder();
+  // Validates the whole plan against the current channels first, then
+  // creates everything and starts opening it once. Nothing is created if
+  // any entry is invalid. Takes ownership of the consumers and empties
+  // the plan in both cases.
+  bool importPlan(ChannelPlan &);
+
+  // Makes the current channels match a plan. diffPlan validates the plan
+  // on its own (discarding it if invalid) and lists what has to go. The
+  // removed entries are still alive when it returns, and are deleted by
+  // applyPlan, which also takes ownership of the consumers. applyPlan
+  // returns false if some entry could not be created: the rest of the
+  // plan is applied anyway, and the reasons are left in getErrors().
+  bool diffPlan(ChannelPlan &, PlanDiff &);
+  bool applyPlan(ChannelPlan &, PlanDiff &);
+
+  // Bulk enable / disable all channels of a master
+  void setChannelsEnabled(MasterChannel *, bool);
+
+  // Push pending enable state changes to the inspectors. Returns the
+  // number of inspectors that were reconfigured. Disables can be left
+  // for a later call, as they cost nothing but CPU until then.
+  unsigned int syncEnableStates(bool disables = true);
+
+  // Activity detection for activity-driven masters. Takes the spectrum
+  // of an analyzer (lowest frequency first, in the same frame as its
+  // source info) and enables or disables the channels of its masters
+  // accordingly. Call syncEnableStates() afterwards.
+  ActivityUpdate feedPsd(
+      Suscan::Analyzer *,
+      SUFREQ center,
+      SUFLOAT sampRate,
+      const SUFLOAT *psd,
+      unsigned int size);
+
+  // CPUs of the consumer threads and of the channelizer workers (empty:
+  // no restriction). Consumer threads are spread over their list, one
+  // thread per CPU.
+  void setAffinity(
+      std::vector<int> const &consumers,
+      std::vector<int> const &workers);
+
+  // consumerThreads: threads running the consumers (0: half the cores)
+  MultiChannelForwarder(unsigned int consumerThreads = 0);
   ~MultiChannelForwarder();
 };
 
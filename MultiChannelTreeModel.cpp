@@ -30,6 +30,133 @@
 
 #define ZMQ_TREEMODEL_COUNT (ZMQ_TREEMODEL_COL_FREQUENCY + 1)
 
+/////////////////////////// MultiChannelTreeChildren //////////////////////////
+void
+MultiChannelTreeChildren::add(int slot, int delta)
+{
+  for (int i = slot + 1; i <= static_cast<int>(m_slots.size()); i += i & -i)
+    m_tree[i] += delta;
+}
+
+int
+MultiChannelTreeChildren::size() const
+{
+  return m_count;
+}
+
+bool
+MultiChannelTreeChildren::empty() const
+{
+  return m_count == 0;
+}
+
+int
+MultiChannelTreeChildren::append(MultiChannelTreeItem *item)
+{
+  int slot = static_cast<int>(m_slots.size());
+  int i    = slot + 1;
+  int sum  = 1;
+
+  m_slots.push_back(item);
+
+  // The new node covers (i - lowbit(i), i]: the item itself plus the
+  // nodes that already cover the rest of that range.
+  if (m_tree.empty())
+    m_tree.push_back(0);
+
+  for (int j = i - 1; j > i - (i & -i); j -= j & -j)
+    sum += m_tree[j];
+
+  m_tree.push_back(sum);
+  ++m_count;
+
+  return slot;
+}
+
+void
+MultiChannelTreeChildren::remove(int slot)
+{
+  m_slots[slot] = nullptr;
+  add(slot, -1);
+  --m_count;
+
+  if (2 * m_count < static_cast<int>(m_slots.size()))
+    compact();
+}
+
+void
+MultiChannelTreeChildren::compact()
+{
+  std::vector<MultiChannelTreeItem *> items;
+
+  items.reserve(m_count);
+  for (auto item : m_slots)
+    if (item != nullptr)
+      items.push_back(item);
+
+  clear();
+
+  for (auto item : items)
+    item->slot = append(item);
+}
+
+void
+MultiChannelTreeChildren::clear()
+{
+  m_slots.clear();
+  m_tree.clear();
+  m_count = 0;
+}
+
+// Items in the slots before this one
+int
+MultiChannelTreeChildren::row(int slot) const
+{
+  int row = 0;
+
+  for (int i = slot; i > 0; i -= i & -i)
+    row += m_tree[i];
+
+  return row;
+}
+
+MultiChannelTreeItem *
+MultiChannelTreeChildren::at(int row) const
+{
+  int size = static_cast<int>(m_slots.size());
+  int pos  = 0;
+  int step = 1;
+
+  if (row < 0 || row >= m_count)
+    return nullptr;
+
+  while (2 * step <= size)
+    step *= 2;
+
+  // Last position whose prefix holds no more than row items
+  for (; step > 0; step /= 2) {
+    if (pos + step <= size && m_tree[pos + step] <= row) {
+      pos += step;
+      row -= m_tree[pos];
+    }
+  }
+
+  return m_slots[pos];
+}
+
+std::vector<MultiChannelTreeItem *> const &
+MultiChannelTreeChildren::slots() const
+{
+  return m_slots;
+}
+
+int
+MultiChannelTreeItem::row() const
+{
+  return parent->children.row(slot);
+}
+
+///////////////////////////// MultiChannelTreeModel ////////////////////////////
 MultiChannelTreeItem *
 MultiChannelTreeModel::indexData(const QModelIndex &index)
 {
@@ -46,10 +173,9 @@ MultiChannelTreeModel::indexData(const QModelIndex &index)
 void
 MultiChannelTreeModel::fastExpand(QTreeView *view)
 {
-  QModelIndex parent = createIndex(0, 0, m_rootItem);
-
-  for (auto p : m_masterHash)
-    view->expand(index(p->index, 0, parent));
+  for (auto p : m_rootItem->children.slots())
+    if (p != nullptr)
+      view->expand(itemIndex(p));
 }
 
 MultiChannelTreeModel::MultiChannelTreeModel(
@@ -58,64 +184,188 @@ MultiChannelTreeModel::MultiChannelTreeModel(
   : QAbstractItemModel{parent}
 {
   m_forwarder = forwarder;
+  m_rootItem  = new MultiChannelTreeItem();
+  m_rootItem->type = MULTI_CHANNEL_TREE_ITEM_ROOT;
 
   rebuildStructure();
 }
 
 MultiChannelTreeModel::~MultiChannelTreeModel()
 {
-
+  clear();
+  delete m_rootItem;
 }
 
 MultiChannelTreeItem *
-MultiChannelTreeModel::allocItem(MultiChannelTreeItemType type)
+MultiChannelTreeModel::allocItem(
+    MultiChannelTreeItemType type,
+    MultiChannelTreeItem *parent)
 {
-  auto item = m_treeStructure.insert(
-        m_treeStructure.size(),
-        MultiChannelTreeItem());
+  auto item = new MultiChannelTreeItem();
 
-  auto lastItem = &item.value();
-  lastItem->type = type;
+  item->type   = type;
+  item->parent = parent;
+  item->slot   = parent->children.append(item);
 
-  return lastItem;
+  return item;
 }
 
 void
-MultiChannelTreeModel::rebuildStructure()
+MultiChannelTreeModel::clear()
 {
-  beginResetModel();
+  for (auto master : m_rootItem->children.slots()) {
+    if (master == nullptr)
+      continue;
 
-  m_treeStructure.clear();
+    for (auto channel : master->children.slots())
+      delete channel;
+    delete master;
+  }
+
+  m_rootItem->children.clear();
   m_masterHash.clear();
+  m_channelHash.clear();
+}
+
+QModelIndex
+MultiChannelTreeModel::itemIndex(const MultiChannelTreeItem *item) const
+{
+  if (item == nullptr || item == m_rootItem)
+    return QModelIndex();
+
+  return createIndex(
+        item->row(),
+        0,
+        const_cast<MultiChannelTreeItem *>(item));
+}
+
+QModelIndex
+MultiChannelTreeModel::masterIndex(const MasterChannel *master) const
+{
+  return itemIndex(m_masterHash.value(master, nullptr));
+}
+
+QModelIndex
+MultiChannelTreeModel::channelIndex(const ChannelDescription *channel) const
+{
+  return itemIndex(m_channelHash.value(channel, nullptr));
+}
+
+void
+MultiChannelTreeModel::rebuildStructure()
+{
+  beginResetModel();
 
-  m_rootItem = allocItem(MULTI_CHANNEL_TREE_ITEM_ROOT);
+  clear();
 
   for (MasterChannel *p : *m_forwarder) {
-    auto *masterItem = allocItem(MULTI_CHANNEL_TREE_ITEM_MASTER);
+    if (p->deleted)
+      continue;
 
-    masterItem->parent = m_rootItem;
-    masterItem->master = p;
-    masterItem->index  = m_rootItem->children.size();
-    m_rootItem->children.push_back(masterItem);
+    auto *masterItem = allocItem(MULTI_CHANNEL_TREE_ITEM_MASTER, m_rootItem);
 
-    m_masterHash[p->name.c_str()] = masterItem;
+    masterItem->master = p;
+    m_masterHash[p] = masterItem;
 
-    auto i = p->channels.begin();
+    // Channels are prepended to the master: walk them backwards so that
+    // rows follow the order of creation, as in addChannel.
+    for (auto i = p->channels.rbegin(); i != p->channels.rend(); ++i) {
+      if (i->deleted)
+        continue;
 
-    while (i != p->channels.end()) {
-      auto *channelItem = allocItem(MULTI_CHANNEL_TREE_ITEM_CHANNEL);
+      auto *channelItem = allocItem(MULTI_CHANNEL_TREE_ITEM_CHANNEL, masterItem);
 
-      channelItem->parent = masterItem;
       channelItem->channel = &*i;
-      channelItem->index   = masterItem->children.size();
-      masterItem->children.push_back(channelItem);
-      ++i;
+      m_channelHash[&*i] = channelItem;
     }
   }
 
   endResetModel();
 }
 
+void
+MultiChannelTreeModel::reset()
+{
+  beginResetModel();
+  clear();
+  endResetModel();
+}
+
+void
+MultiChannelTreeModel::addMaster(MasterChannel *master)
+{
+  int row = m_rootItem->children.size();
+
+  if (m_masterHash.contains(master))
+    return;
+
+  beginInsertRows(QModelIndex(), row, row);
+
+  auto *item = allocItem(MULTI_CHANNEL_TREE_ITEM_MASTER, m_rootItem);
+  item->master = master;
+  m_masterHash[master] = item;
+
+  endInsertRows();
+}
+
+void
+MultiChannelTreeModel::addChannel(ChannelDescription *channel)
+{
+  MultiChannelTreeItem *masterItem = m_masterHash.value(channel->parent, nullptr);
+
+  if (masterItem == nullptr || m_channelHash.contains(channel))
+    return;
+
+  int row = masterItem->children.size();
+
+  beginInsertRows(itemIndex(masterItem), row, row);
+
+  auto *item = allocItem(MULTI_CHANNEL_TREE_ITEM_CHANNEL, masterItem);
+  item->channel = channel;
+  m_channelHash[channel] = item;
+
+  endInsertRows();
+}
+
+void
+MultiChannelTreeModel::removeItem(MultiChannelTreeItem *item)
+{
+  MultiChannelTreeItem *parent = item->parent;
+  int row = item->row();
+
+  beginRemoveRows(itemIndex(parent), row, row);
+  parent->children.remove(item->slot);
+  endRemoveRows();
+
+  for (auto child : item->children.slots()) {
+    if (child == nullptr)
+      continue;
+
+    m_channelHash.remove(child->channel);
+    delete child;
+  }
+
+  delete item;
+}
+
+void
+MultiChannelTreeModel::removeMaster(const MasterChannel *master)
+{
+  MultiChannelTreeItem *item = m_masterHash.take(master);
+
+  if (item != nullptr)
+    removeItem(item);
+}
+
+void
+MultiChannelTreeModel::removeChannel(const ChannelDescription *channel)
+{
+  MultiChannelTreeItem *item = m_channelHash.take(channel);
+
+  if (item != nullptr)
+    removeItem(item);
+}
+
 QVariant
 MultiChannelTreeModel::data(const QModelIndex &index, int role) const
 {
@@ -142,6 +392,19 @@ MultiChannelTreeModel::data(const QModelIndex &index, int role) const
       }
     }
 
+    if (role == Qt::ToolTipRole && item->type == MULTI_CHANNEL_TREE_ITEM_MASTER) {
+      TopologyCost cost = m_forwarder->estimateCost(item->master);
+
+      return
+          QString(item->master->direct
+                  ? "Channels opened directly on the source"
+                  : "Channels opened through the master")
+          + "\nEstimated cost through master: "
+          + SuWidgetsHelpers::formatQuantity(cost.viaMaster, "sps")
+          + "\nEstimated cost if direct: "
+          + SuWidgetsHelpers::formatQuantity(cost.direct, "sps");
+    }
+
     if (role == Qt::DisplayRole) {
       switch (item->type) {
         case MULTI_CHANNEL_TREE_ITEM_MASTER:
@@ -162,7 +425,11 @@ MultiChannelTreeModel::data(const QModelIndex &index, int role) const
                     "Hz");
 
             case ZMQ_TREEMODEL_COL_TYPE:
-              return "(Master)";
+              if (master->engine == MASTER_ENGINE_PFB)
+                return "(PFB)";
+              else if (master->engine == MASTER_ENGINE_OLS)
+                return "(OLS)";
+              return master->direct ? "(Direct)" : "(Master)";
           }
 
           break;
@@ -211,6 +478,28 @@ MultiChannelTreeModel::data(const QModelIndex &index, int role) const
   return QVariant();
 }
 
+void
+MultiChannelTreeModel::setChildrenEnabled(const QModelIndex &index, bool enabled)
+{
+  QModelIndex parent = index.sibling(index.row(), ZMQ_TREEMODEL_COL_NAME);
+  MultiChannelTreeItem *item = indexData(parent);
+
+  if (item == nullptr
+      || item->type != MULTI_CHANNEL_TREE_ITEM_MASTER
+      || item->children.empty())
+    return;
+
+  m_forwarder->setChannelsEnabled(item->master, enabled);
+
+  // Single notification for the whole subtree
+  emit dataChanged(
+        this->index(0, ZMQ_TREEMODEL_COL_NAME, parent),
+        this->index(
+          item->children.size() - 1,
+          ZMQ_TREEMODEL_COL_NAME,
+          parent));
+}
+
 bool
 MultiChannelTreeModel::setData(const QModelIndex &index, const QVariant &value, int role)
 {
@@ -299,10 +588,10 @@ MultiChannelTreeModel::index(
   else
       parentItem = static_cast<MultiChannelTreeItem*>(parent.internalPointer());
 
-  if (row < 0 || row >= parentItem->children.size())
-    return QModelIndex();
+  childItem = parentItem->children.at(row);
 
-  childItem = parentItem->children[row];
+  if (childItem == nullptr)
+    return QModelIndex();
 
   return createIndex(row, column, childItem);
 }
@@ -319,7 +608,7 @@ MultiChannelTreeModel::parent(const QModelIndex &index) const
   if (parentItem == m_rootItem)
       return QModelIndex();
 
-  return createIndex(parentItem->index, 0, parentItem);
+  return createIndex(parentItem->row(), 0, parentItem);
 }
 
 int
@@ -23,6 +23,7 @@
 #include <QAbstractItemModel>
 #include <MultiChannelForwarder.h>
 #include <QHash>
+#include <vector>
 
 class QTreeView;
 
@@ -33,6 +34,38 @@ enum MultiChannelTreeItemType
   MULTI_CHANNEL_TREE_ITEM_CHANNEL
 };
 
+struct MultiChannelTreeItem;
+
+//
+// Children of an item. A removed row leaves a hole behind, and a Fenwick
+// tree counting the items in each slot maps rows to slots and back in
+// O(log n): nothing after a removed row has to move or be renumbered.
+// Holes are squeezed out once they outnumber the items.
+//
+class MultiChannelTreeChildren
+{
+  std::vector<MultiChannelTreeItem *> m_slots;
+  std::vector<int> m_tree; // 1-based
+  int m_count = 0;
+
+  void add(int slot, int delta);
+  void compact();
+
+public:
+  int size() const;
+  bool empty() const;
+
+  int append(MultiChannelTreeItem *); // Returns its slot
+  void remove(int slot);
+  void clear();
+
+  int row(int slot) const;
+  MultiChannelTreeItem *at(int row) const;
+
+  // Every slot, holes included (null)
+  std::vector<MultiChannelTreeItem *> const &slots() const;
+};
+
 struct MultiChannelTreeItem
 {
   MultiChannelTreeItemType type;
@@ -43,8 +76,10 @@ struct MultiChannelTreeItem
   };
 
   MultiChannelTreeItem *parent = nullptr;
-  int index = -1;
-  QVector<MultiChannelTreeItem *> children;
+  int slot = -1; // In the children of the parent
+  MultiChannelTreeChildren children;
+
+  int row() const;
 };
 
 class MultiChannelTreeModel : public QAbstractItemModel
@@ -52,16 +87,37 @@ class MultiChannelTreeModel : public QAbstractItemModel
   Q_OBJECT
 
   MultiChannelForwarder *m_forwarder = nullptr;
-  QHash<int, MultiChannelTreeItem> m_treeStructure;
-  QHash<QString, MultiChannelTreeItem *> m_masterHash;
+  QHash<const MasterChannel *, MultiChannelTreeItem *> m_masterHash;
+  QHash<const ChannelDescription *, MultiChannelTreeItem *> m_channelHash;
   MultiChannelTreeItem *m_rootItem;
 
+  MultiChannelTreeItem *allocItem(
+      MultiChannelTreeItemType type,
+      MultiChannelTreeItem *parent);
+  QModelIndex itemIndex(const MultiChannelTreeItem *) const;
+  void removeItem(MultiChannelTreeItem *);
+  void clear();
+
 public:
   static MultiChannelTreeItem *indexData(const QModelIndex &);
   void fastExpand(QTreeView *);
+  void setChildrenEnabled(const QModelIndex &, bool);
+
+  // Full reset. Only for bulk changes (e.g. loading a file)
   void rebuildStructure();
 
-  MultiChannelTreeItem *allocItem(MultiChannelTreeItemType type);
+  // Forgets every item. Must happen before the forwarder deletes the
+  // entries in bulk, so that views never see them afterwards.
+  void reset();
+
+  // Single-row updates. Items are looked up by the forwarder object they
+  // refer to, and removals must happen before the forwarder deletes it.
+  void addMaster(MasterChannel *);
+  void addChannel(ChannelDescription *);
+  void removeMaster(const MasterChannel *);
+  void removeChannel(const ChannelDescription *);
+  QModelIndex masterIndex(const MasterChannel *) const;
+  QModelIndex channelIndex(const ChannelDescription *) const;
 
   explicit MultiChannelTreeModel(MultiChannelForwarder *, QObject *parent = nullptr);
 
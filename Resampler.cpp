@@ -0,0 +1,215 @@
+//
+//    Resampler.cpp: Fractional polyphase resampler
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "Resampler.h"
+#include <algorithm>
+#include <cmath>
+
+Resampler::Resampler(SUFLOAT inRate, SUFLOAT outRate)
+{
+  double scale = std::min(1., static_cast<double>(outRate) / inRate);
+
+  m_inRate  = inRate;
+  m_outRate = outRate;
+  m_step    = static_cast<double>(inRate) / outRate;
+  m_taps    = 2 * static_cast<unsigned>(
+        std::ceil(RESAMPLER_ZERO_CROSSINGS / scale));
+
+  designPhases();
+
+  // Start with an empty (zero) history, so the first output is available
+  // as soon as the first input sample arrives.
+  m_buffer.assign(m_taps - 1, 0);
+  m_row.resize(m_taps);
+}
+
+//
+// Row p holds the prototype sampled at a fractional delay of p / PHASES.
+// With the history x[i], ..., x[i + T - 1], the output at i + mu (plus
+// the constant T / 2 - 1 group delay) is sum_k x[i + k] h(T / 2 - 1 + mu - k).
+// Every row is normalized to unit DC gain, so that the gain does not
+// ripple with the delay.
+//
+void
+Resampler::designPhases()
+{
+  double scale = std::min(1., static_cast<double>(m_outRate) / m_inRate);
+  double fc = RESAMPLER_CUTOFF * scale;
+  double half = .5 * m_taps;
+
+  m_phases.resize((RESAMPLER_PHASES + 1) * m_taps);
+
+  for (unsigned int p = 0; p <= RESAMPLER_PHASES; ++p) {
+    SUFLOAT *row = m_phases.data() + p * m_taps;
+    double mu = static_cast<double>(p) / RESAMPLER_PHASES;
+    double sum = 0;
+
+    for (unsigned int k = 0; k < m_taps; ++k) {
+      double t = half - 1 + mu - k;
+      double x = 2 * M_PI * fc * t;
+      double sinc = t == 0 ? 1 : std::sin(x) / x;
+      double w = 2 * M_PI * t / m_taps;
+      double window = .42 + .5 * std::cos(w) + .08 * std::cos(2 * w);
+
+      row[k] = static_cast<SUFLOAT>(sinc * window);
+      sum += row[k];
+    }
+
+    for (unsigned int k = 0; k < m_taps; ++k)
+      row[k] /= static_cast<SUFLOAT>(sum);
+  }
+}
+
+SUFLOAT
+Resampler::inRate() const
+{
+  return m_inRate;
+}
+
+SUFLOAT
+Resampler::outRate() const
+{
+  return m_outRate;
+}
+
+unsigned int
+Resampler::taps() const
+{
+  return m_taps;
+}
+
+const SUCOMPLEX *
+Resampler::output() const
+{
+  return m_output.data();
+}
+
+SUSCOUNT
+Resampler::size() const
+{
+  return m_output.size();
+}
+
+// Real and imaginary parts are accumulated separately over the flat
+// float view of the history, which the compiler turns into packed
+// multiply-adds.
+SUCOMPLEX
+Resampler::dot(const SUCOMPLEX *x, const SUFLOAT *h) const
+{
+  const SUFLOAT *xf = reinterpret_cast<const SUFLOAT *>(x);
+  SUFLOAT re = 0, im = 0;
+
+  for (unsigned int k = 0; k < m_taps; ++k) {
+    re += xf[2 * k + 0] * h[k];
+    im += xf[2 * k + 1] * h[k];
+  }
+
+  return SUCOMPLEX(re, im);
+}
+
+void
+Resampler::process(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  SUSCOUNT consumed;
+  SUSCOUNT avail;
+
+  m_buffer.insert(m_buffer.end(), samples, samples + size);
+  m_output.clear();
+
+  avail = m_buffer.size() - m_taps + 1;
+
+  while (m_time < avail) {
+    SUSCOUNT i = static_cast<SUSCOUNT>(m_time);
+    double pos = (m_time - i) * RESAMPLER_PHASES;
+    unsigned int p = static_cast<unsigned>(pos);
+    SUFLOAT frac = static_cast<SUFLOAT>(pos - p);
+    const SUFLOAT *h0 = m_phases.data() + p * m_taps;
+    const SUFLOAT *h1 = h0 + m_taps;
+
+    for (unsigned int k = 0; k < m_taps; ++k)
+      m_row[k] = h0[k] + frac * (h1[k] - h0[k]);
+
+    m_output.push_back(dot(m_buffer.data() + i, m_row.data()));
+    m_time += m_step;
+  }
+
+  // Drop the samples no future output will look at
+  consumed = std::min<SUSCOUNT>(static_cast<SUSCOUNT>(m_time), avail);
+  m_buffer.erase(m_buffer.begin(), m_buffer.begin() + consumed);
+  m_time -= consumed;
+}
+
+//////////////////////////// Half-band decimator ////////////////////////////
+HalfBandDecimator::HalfBandDecimator()
+{
+  int mid = HALFBAND_TAPS / 2;
+  SUFLOAT sum = .5f;
+
+  for (int n = 1; n <= mid; n += 2) {
+    double x = .5 * M_PI * n;
+    double w = 2 * M_PI * n / (HALFBAND_TAPS + 1);
+    double window = .42 + .5 * std::cos(w) + .08 * std::cos(2 * w);
+
+    m_taps.push_back(static_cast<SUFLOAT>(.5 * std::sin(x) / x * window));
+    sum += 2 * m_taps.back();
+  }
+
+  // Unit DC gain
+  for (auto &h : m_taps)
+    h *= .5f / (sum - .5f);
+
+  m_buffer.assign(HALFBAND_TAPS - 1, 0);
+}
+
+const SUCOMPLEX *
+HalfBandDecimator::output() const
+{
+  return m_output.data();
+}
+
+SUSCOUNT
+HalfBandDecimator::size() const
+{
+  return m_output.size();
+}
+
+void
+HalfBandDecimator::process(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  unsigned int mid = HALFBAND_TAPS / 2;
+  unsigned int count = static_cast<unsigned>(m_taps.size());
+  const SUFLOAT *h = m_taps.data();
+
+  m_buffer.insert(m_buffer.end(), samples, samples + size);
+  m_output.clear();
+
+  while (m_next + HALFBAND_TAPS <= m_buffer.size()) {
+    const SUCOMPLEX *x = m_buffer.data() + m_next + mid;
+    SUCOMPLEX y = .5f * x[0];
+
+    for (unsigned int j = 0; j < count; ++j)
+      y += h[j] * (x[-2 * static_cast<int>(j) - 1] + x[2 * j + 1]);
+
+    m_output.push_back(y);
+    m_next += 2;
+  }
+
+  m_buffer.erase(m_buffer.begin(), m_buffer.begin() + m_next);
+  m_next = 0;
+}
@@ -0,0 +1,98 @@
+//
+//    Resampler.h: Fractional polyphase resampler
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <sigutils/types.h>
+#include <vector>
+
+// Number of filter phases. Delays between two phases are interpolated
+// linearly, so the time resolution is effectively continuous.
+#define RESAMPLER_PHASES 256
+
+// Zero crossings of the prototype on each side of its center, measured
+// at the narrower of the two rates.
+#define RESAMPLER_ZERO_CROSSINGS 24
+
+// Cutoff of the prototype, relative to the narrower of the two rates
+#define RESAMPLER_CUTOFF .45
+
+// Length of the half-band decimation filters (must be 4k - 1)
+#define HALFBAND_TAPS 47
+
+//
+// Converts a complex stream from one sample rate to another with an
+// arbitrary (non-rational) ratio. The prototype is a Blackman-windowed
+// sinc tabulated in RESAMPLER_PHASES fractional delays; every output
+// sample is the dot product of the input history with the phase row
+// interpolated at its exact position. When decimating, the prototype is
+// stretched so that it also acts as the anti-aliasing filter.
+//
+class Resampler {
+  SUFLOAT m_inRate;
+  SUFLOAT m_outRate;
+  unsigned int m_taps;           // Taps per phase
+  double m_step;                 // Input samples per output sample
+  double m_time = 0;             // Position of the next output in m_buffer
+
+  std::vector<SUFLOAT> m_phases; // (RESAMPLER_PHASES + 1) x m_taps
+  std::vector<SUFLOAT> m_row;    // Interpolated phase row
+  std::vector<SUCOMPLEX> m_buffer;
+  std::vector<SUCOMPLEX> m_output;
+
+  void designPhases();
+  SUCOMPLEX dot(const SUCOMPLEX *, const SUFLOAT *) const;
+
+public:
+  Resampler(SUFLOAT inRate, SUFLOAT outRate);
+
+  SUFLOAT inRate() const;
+  SUFLOAT outRate() const;
+  unsigned int taps() const;
+
+  void process(const SUCOMPLEX *, SUSCOUNT);
+
+  const SUCOMPLEX *output() const;
+  SUSCOUNT size() const;
+};
+
+//
+// Decimation by two with a half-band FIR. Every other tap of a half-band
+// filter is zero (except the central one, which is 1/2), and the filter
+// is symmetric, so each output costs a quarter of the filter length in
+// multiplications. Cascades of these produce the power-of-two fractions
+// of a rate almost for free.
+//
+class HalfBandDecimator {
+  std::vector<SUFLOAT> m_taps;  // h[c + 2j + 1] == h[c - 2j - 1]
+  std::vector<SUCOMPLEX> m_buffer;
+  std::vector<SUCOMPLEX> m_output;
+  SUSCOUNT m_next = 0;          // Start of the next output in m_buffer
+
+public:
+  HalfBandDecimator();
+
+  void process(const SUCOMPLEX *, SUSCOUNT);
+
+  const SUCOMPLEX *output() const;
+  SUSCOUNT size() const;
+};
+
+#endif // RESAMPLER_H
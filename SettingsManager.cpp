@@ -1,6 +1,7 @@
 #include "SettingsManager.h"
 #include "MultiChannelForwarder.h"
 #include <ZeroMQSink.h>
+#include <UdpConsumer.h>
 
 #include <QSettings>
 
@@ -72,6 +73,14 @@ SettingsManager::loadSettings(const char *path)
     auto vfo_freq     = settings.value("frequency").value<qint64>();
     auto out_topic    = settings.value("zmq_topic").value<QString>();
     bool disabled     = settings.value("SigDigger.disabled").value<bool>();
+    auto engine       = settings.value("SigDigger.engine").value<QString>();
+    auto spacing      = settings.value("SigDigger.grid_spacing").value<qint64>();
+    bool activity     = settings.value("SigDigger.activity").value<bool>();
+    auto activitySnr  = settings.value("SigDigger.activity_snr", 6.).value<SUFLOAT>();
+    auto activityHold = settings.value("SigDigger.activity_hold", 5.).value<SUFLOAT>();
+    auto psdBins      = settings.value("SigDigger.psd_bins").value<qint64>();
+    auto psdRate      = settings.value("SigDigger.psd_rate", 2.).value<SUFLOAT>();
+    auto iqFormat     = settings.value("SigDigger.iq_format").value<QString>();
 
     if (out_topic.size() == 0)
       out_topic = "MASTER_" + QString::number(i + 1);
@@ -93,6 +102,18 @@ SettingsManager::loadSettings(const char *path)
     }
 
     emit createMaster(out_topic, vfo_freq, bandwidth, !disabled);
+
+    if (engine.size() > 0)
+      emit setMasterEngine(out_topic, engine, spacing);
+
+    if (activity)
+      emit setMasterActivity(out_topic, activitySnr, activityHold);
+
+    if (psdBins > 0)
+      emit setMasterSpectrum(out_topic, psdBins, psdRate);
+
+    if (iqFormat.size() > 0)
+      emit setMasterIQ(out_topic, iqFormat);
   }
 
   settings.endArray();
@@ -114,6 +135,15 @@ SettingsManager::loadSettings(const char *path)
     auto vfo_out_rate = settings.value("out_rate").value<qint64>();
     auto data_rate    = settings.value("data_rate").value<qint64>();
     bool disabled     = settings.value("SigDigger.disabled").value<bool>();
+    // Unquoted lists (48000, 24000) are read as a QStringList, quoted
+    // ones ("48000,24000") as a QString. toStringList() takes both.
+    auto extra_rates  = settings.value("SigDigger.extra_rates").toStringList().join(",");
+    auto squelch      = settings.value("SigDigger.squelch").value<QString>();
+    auto squelch_lvl  = settings.value("SigDigger.squelch_level").value<SUFLOAT>();
+    // Same as extra_rates: several destinations may be read as a list
+    auto udp          = settings.value("SigDigger.udp").toStringList().join(",");
+    auto udp_ttl      = settings.value("SigDigger.udp_ttl", UDP_DEFAULT_TTL).value<qint64>();
+    auto priority     = settings.value("SigDigger.priority", 1.).value<SUFLOAT>();
     auto channelName  = out_topic.toStdString();
 
     // Assume USB if not present
@@ -153,6 +183,18 @@ SettingsManager::loadSettings(const char *path)
       vfo_freq -= filterbw / 2;
 
     emit createVFO(out_topic, vfo_freq, filterbw, demod, vfo_out_rate, !disabled);
+
+    if (extra_rates.size() > 0)
+      emit setChannelRates(out_topic, extra_rates);
+
+    if (squelch.size() > 0)
+      emit setChannelSquelch(out_topic, squelch, squelch_lvl);
+
+    if (udp.size() > 0)
+      emit setChannelUdp(out_topic, udp, udp_ttl);
+
+    if (priority != 1)
+      emit setChannelPriority(out_topic, priority);
   }
 
   if (m_aborted)
@@ -233,6 +275,35 @@ SettingsManager::saveSettings(const char *path, const MultiChannelForwarder *fwd
     settings.setValue("out_rate", static_cast<qint64>(master->bandwidth / EXTRA_BW_FACTOR));
     settings.setValue("out_topic", QString::fromStdString(master->name));
     settings.setValue("SigDigger.disabled", !master->enabled);
+
+    if (master->engine != MASTER_ENGINE_INSPECTORS) {
+      settings.setValue(
+            "SigDigger.engine",
+            MultiChannelForwarder::engineName(master->engine));
+      settings.setValue(
+            "SigDigger.grid_spacing",
+            static_cast<qint64>(master->gridSpacing));
+    }
+
+    if (master->activityDriven) {
+      settings.setValue("SigDigger.activity", true);
+      settings.setValue("SigDigger.activity_snr", master->activitySnr);
+      settings.setValue("SigDigger.activity_hold", master->activityHold);
+    }
+
+    if (master->spectrum != nullptr) {
+      settings.setValue(
+            "SigDigger.psd_bins",
+            static_cast<qint64>(master->spectrumBins));
+      settings.setValue("SigDigger.psd_rate", master->spectrumRate);
+    }
+
+    if (master->iq != nullptr) {
+      auto iq = static_cast<const ZeroMQMasterConsumer *>(master->iq);
+      settings.setValue(
+            "SigDigger.iq_format",
+            ZeroMQMasterConsumer::formatName(iq->format()));
+    }
   }
 
   settings.endArray();
@@ -261,6 +332,36 @@ SettingsManager::saveSettings(const char *path, const MultiChannelForwarder *fwd
     settings.setValue("SigDigger.demod", demod);
     settings.setValue("out_rate", static_cast<qint64>(consumer->getSampRate()));
     settings.setValue("SigDigger.disabled", !consumer->isEnabled());
+
+    if (channel->priority != 1)
+      settings.setValue("SigDigger.priority", channel->priority);
+
+    QStringList rates;
+    for (auto rate : consumer->getOutputRates())
+      rates.append(QString::number(static_cast<qint64>(rate)));
+
+    if (!rates.isEmpty())
+      settings.setValue("SigDigger.extra_rates", rates.join(","));
+
+    if (consumer->getSquelch() != ZEROMQ_SQUELCH_OFF) {
+      settings.setValue(
+            "SigDigger.squelch",
+            ZeroMQConsumer::squelchName(consumer->getSquelch()));
+      settings.setValue("SigDigger.squelch_level", consumer->getSquelchLevel());
+    }
+
+    QStringList udp;
+    for (auto &dest : consumer->getUdpDestinations())
+      udp.append(QString::fromStdString(dest));
+
+    if (!udp.isEmpty()) {
+      settings.setValue("SigDigger.udp", udp.join(","));
+
+      if (consumer->getUdpTtl() != UDP_DEFAULT_TTL)
+        settings.setValue(
+              "SigDigger.udp_ttl",
+              static_cast<qint64>(consumer->getUdpTtl()));
+    }
   }
 
   settings.endArray();
@@ -40,7 +40,15 @@ signals:
   void loadError(QString);
 
   void createMaster(QString, SUFREQ, SUFLOAT, bool);
+  void setMasterEngine(QString, QString, SUFLOAT);
+  void setMasterActivity(QString, SUFLOAT, SUFLOAT);
+  void setMasterSpectrum(QString, qint64, SUFLOAT);
+  void setMasterIQ(QString, QString);
   void createVFO(QString, SUFREQ, SUFLOAT, QString, qint64, bool);
+  void setChannelRates(QString, QString);
+  void setChannelSquelch(QString, QString, SUFLOAT);
+  void setChannelUdp(QString, QString, qint64);
+  void setChannelPriority(QString, SUFLOAT);
 };
 
 #endif // SETTINGSMANAGER_H
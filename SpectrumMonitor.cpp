@@ -0,0 +1,155 @@
+//
+//    SpectrumMonitor.cpp: Averaged power spectrum of a master
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "SpectrumMonitor.h"
+#include <algorithm>
+#include <cmath>
+
+SpectrumMonitor::SpectrumMonitor(
+    SpectrumConsumer *consumer,
+    unsigned int bins,
+    SUFLOAT updateRate)
+{
+  SUFLOAT sum = 0;
+
+  m_consumer   = consumer;
+  m_bins       = bins;
+  m_updateRate = updateRate;
+
+  m_window.resize(bins);
+  m_accum.assign(bins, 0);
+  m_psd.resize(bins);
+
+  for (unsigned int i = 0; i < bins; ++i) {
+    m_window[i] = static_cast<SUFLOAT>(.5 - .5 * std::cos(2 * M_PI * i / bins));
+    sum += m_window[i];
+  }
+
+  m_norm = sum * sum;
+
+  m_fftBuf = static_cast<SU_FFTW(_complex) *>(
+        SU_FFTW(_malloc)(bins * sizeof(SU_FFTW(_complex))));
+  m_plan = SU_FFTW(_plan_dft_1d)(
+        static_cast<int>(bins),
+        m_fftBuf,
+        m_fftBuf,
+        FFTW_FORWARD,
+        FFTW_ESTIMATE);
+}
+
+SpectrumMonitor::~SpectrumMonitor()
+{
+  if (m_plan != nullptr)
+    SU_FFTW(_destroy_plan)(m_plan);
+
+  if (m_fftBuf != nullptr)
+    SU_FFTW(_free)(m_fftBuf);
+}
+
+void
+SpectrumMonitor::setCenter(SUFREQ center)
+{
+  m_center = center;
+}
+
+void
+SpectrumMonitor::setInputRate(SUFLOAT rate)
+{
+  m_sampRate = rate;
+  m_period   = static_cast<SUSCOUNT>(std::ceil(rate / m_updateRate));
+  m_stride   = std::max<SUSCOUNT>(
+        m_bins,
+        m_period / SPECTRUM_MONITOR_MAX_AVERAGES);
+
+  m_fill    = 0;
+  m_frames  = 0;
+  m_skip    = 0;
+  m_elapsed = 0;
+  std::fill(m_accum.begin(), m_accum.end(), 0);
+}
+
+void
+SpectrumMonitor::transform()
+{
+  SU_FFTW(_execute)(m_plan);
+
+  for (unsigned int i = 0; i < m_bins; ++i)
+    m_accum[i] += m_fftBuf[i][0] * m_fftBuf[i][0]
+        + m_fftBuf[i][1] * m_fftBuf[i][1];
+
+  ++m_frames;
+}
+
+void
+SpectrumMonitor::publish()
+{
+  SUFLOAT scale = 1 / (m_norm * m_frames);
+  unsigned int half = (m_bins + 1) / 2;
+
+  // DC goes to the middle
+  for (unsigned int i = 0; i < m_bins; ++i) {
+    SUFLOAT power = m_accum[(i + half) % m_bins] * scale;
+    m_psd[i] = static_cast<SUFLOAT>(10 * std::log10(power + 1e-20));
+  }
+
+  m_consumer->spectrum(m_center, m_sampRate, m_psd.data(), m_bins);
+
+  std::fill(m_accum.begin(), m_accum.end(), 0);
+  m_frames = 0;
+}
+
+void
+SpectrumMonitor::feed(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  if (m_period == 0)
+    return;
+
+  while (size > 0) {
+    SUSCOUNT chunk;
+
+    if (m_skip > 0) {
+      chunk   = std::min(m_skip, size);
+      m_skip -= chunk;
+    } else {
+      chunk = std::min<SUSCOUNT>(m_bins - m_fill, size);
+
+      for (SUSCOUNT i = 0; i < chunk; ++i) {
+        SUCOMPLEX x = samples[i] * m_window[m_fill];
+        m_fftBuf[m_fill][0] = SU_C_REAL(x);
+        m_fftBuf[m_fill][1] = SU_C_IMAG(x);
+        ++m_fill;
+      }
+
+      if (m_fill == m_bins) {
+        transform();
+        m_fill = 0;
+        m_skip = m_stride - m_bins;
+      }
+    }
+
+    samples   += chunk;
+    size      -= chunk;
+    m_elapsed += chunk;
+
+    if (m_elapsed >= m_period && m_frames > 0) {
+      publish();
+      m_elapsed = m_elapsed >= 2 * m_period ? 0 : m_elapsed - m_period;
+    }
+  }
+}
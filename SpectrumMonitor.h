@@ -0,0 +1,76 @@
+//
+//    SpectrumMonitor.h: Averaged power spectrum of a master
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef SPECTRUMMONITOR_H
+#define SPECTRUMMONITOR_H
+
+#include <MultiChannelForwarder.h>
+#include <fftw3.h>
+#include <vector>
+
+#define SPECTRUM_MONITOR_DEFAULT_BINS 1024
+#define SPECTRUM_MONITOR_DEFAULT_RATE 2
+
+// Periodograms averaged per update. Samples beyond these are skipped, so
+// the cost does not grow with the bandwidth of the master.
+#define SPECTRUM_MONITOR_MAX_AVERAGES 64
+
+//
+// Welch estimate of the power spectrum of the tap of a master. Frames of
+// `bins' samples are Hann-windowed and transformed with a single FFTW
+// plan, and their periodograms are averaged over each update period.
+// Every update is handed to the SpectrumConsumer in dB (a full-scale tone
+// reads 0 dB), lowest frequency first.
+//
+class SpectrumMonitor {
+  SpectrumConsumer *m_consumer;
+  unsigned int m_bins;
+  SUFLOAT m_updateRate;
+  SUFLOAT m_sampRate = 0;
+  SUFREQ  m_center = 0;          // Absolute frequency of the tap
+
+  std::vector<SUFLOAT> m_window;
+  std::vector<SUFLOAT> m_accum;  // Sum of the periodograms of this update
+  std::vector<SUFLOAT> m_psd;
+  SUFLOAT m_norm = 1;            // Periodogram of a full-scale tone
+
+  SU_FFTW(_complex) *m_fftBuf = nullptr;
+  SU_FFTW(_plan)     m_plan   = nullptr;
+
+  unsigned int m_fill   = 0;     // Samples in m_fftBuf
+  unsigned int m_frames = 0;     // Periodograms in m_accum
+  SUSCOUNT m_period  = 0;        // Input samples per update
+  SUSCOUNT m_stride  = 0;        // Input samples between frame starts
+  SUSCOUNT m_skip    = 0;        // Samples left to skip before the next frame
+  SUSCOUNT m_elapsed = 0;        // Input samples since the last update
+
+  void transform();
+  void publish();
+
+public:
+  SpectrumMonitor(SpectrumConsumer *, unsigned int bins, SUFLOAT updateRate);
+
+  void setCenter(SUFREQ);
+  void setInputRate(SUFLOAT);
+  void feed(const SUCOMPLEX *, SUSCOUNT);
+
+  ~SpectrumMonitor();
+};
+
+#endif // SPECTRUMMONITOR_H
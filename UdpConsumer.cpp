@@ -0,0 +1,374 @@
+//
+//    UdpConsumer.cpp: Sample output over UDP datagrams
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "UdpConsumer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define UDP_FLOAT2INT16 32768.
+
+UdpConsumer::UdpConsumer(UdpSampleFormat format)
+{
+  m_format = format;
+}
+
+UdpConsumer::~UdpConsumer()
+{
+  if (m_socket4 != -1)
+    close(m_socket4);
+
+  if (m_socket6 != -1)
+    close(m_socket6);
+}
+
+void
+UdpConsumer::applyTtl(int socket, int family) const
+{
+  int ttl = m_ttl;
+
+  if (family == AF_INET6)
+    setsockopt(socket, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &ttl, sizeof(int));
+  else
+    setsockopt(socket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(int));
+}
+
+// One socket per address family, shared by all the destinations
+int
+UdpConsumer::socketFor(int family)
+{
+  int &fd = family == AF_INET6 ? m_socket6 : m_socket4;
+
+  if (fd == -1) {
+    fd = socket(family, SOCK_DGRAM, 0);
+
+    if (fd != -1)
+      applyTtl(fd, family);
+  }
+
+  return fd;
+}
+
+bool
+UdpConsumer::addDestination(std::string const &spec)
+{
+  UdpDestination dest;
+  struct addrinfo hints, *result = nullptr;
+  std::string host, port;
+  size_t colon = spec.rfind(':');
+
+  if (colon == std::string::npos || colon == 0 || colon + 1 == spec.size())
+    return false;
+
+  host = spec.substr(0, colon);
+  port = spec.substr(colon + 1);
+
+  if (host.front() == '[' && host.back() == ']')
+    host = host.substr(1, host.size() - 2);
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags    = AI_NUMERICSERV;
+
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0)
+    return false;
+
+  memset(&dest.addr, 0, sizeof(dest.addr));
+  memcpy(&dest.addr, result->ai_addr, result->ai_addrlen);
+  dest.len  = result->ai_addrlen;
+  dest.spec = spec;
+
+  freeaddrinfo(result);
+
+  // Multicast destinations need nothing else: the TTL set on the socket
+  // only applies to them.
+  if (socketFor(dest.addr.ss_family) == -1)
+    return false;
+
+  // The same datagrams go to every destination: IPv6 ones make them
+  // smaller for all
+  if (dest.addr.ss_family == AF_INET6)
+    m_maxDatagram = UDP_MAX_DATAGRAM6;
+
+  m_destinations.push_back(dest);
+
+  return true;
+}
+
+std::vector<std::string>
+UdpConsumer::destinations() const
+{
+  std::vector<std::string> specs;
+
+  for (auto &d : m_destinations)
+    specs.push_back(d.spec);
+
+  return specs;
+}
+
+void
+UdpConsumer::setTtl(int ttl)
+{
+  m_ttl = ttl;
+
+  if (m_socket4 != -1)
+    applyTtl(m_socket4, AF_INET);
+
+  if (m_socket6 != -1)
+    applyTtl(m_socket6, AF_INET6);
+}
+
+int
+UdpConsumer::ttl() const
+{
+  return m_ttl;
+}
+
+void
+UdpConsumer::start(SUFLOAT rate)
+{
+  m_rate     = static_cast<uint32_t>(rate);
+  m_sequence = 0;
+  m_skipped  = 0;
+}
+
+void
+UdpConsumer::skip(SUSCOUNT size)
+{
+  m_skipped += size;
+}
+
+static inline void
+putBE16(uint8_t *p, uint16_t value)
+{
+  p[0] = static_cast<uint8_t>(value >> 8);
+  p[1] = static_cast<uint8_t>(value);
+}
+
+static inline void
+putBE32(uint8_t *p, uint32_t value)
+{
+  putBE16(p, static_cast<uint16_t>(value >> 16));
+  putBE16(p + 2, static_cast<uint16_t>(value));
+}
+
+static inline uint8_t *
+putSample(uint8_t *p, SUFLOAT x)
+{
+  SUFLOAT scaled = SU_FLOOR(x * UDP_FLOAT2INT16);
+  int16_t value;
+
+  if (scaled > 32767)
+    value = 32767;
+  else if (scaled < -32768)
+    value = -32768;
+  else
+    value = static_cast<int16_t>(scaled);
+
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(static_cast<uint16_t>(value) >> 8);
+
+  return p + 2;
+}
+
+static inline void
+putHeader(
+    uint8_t *datagram,
+    uint32_t sequence,
+    uint32_t rate,
+    uint16_t format,
+    uint16_t count)
+{
+  putBE32(datagram + 0, sequence);
+  putBE32(datagram + 4, rate);
+  putBE16(datagram + 8, format);
+  putBE16(datagram + 10, count);
+}
+
+// Cuts a block in datagrams, after a gap marker if samples were skipped
+// since the last one. Returns how many.
+unsigned int
+UdpConsumer::pack(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  bool complex = m_format == UDP_FORMAT_COMPLEX_INT16;
+  unsigned int width = complex ? 4 : 2;
+  SUSCOUNT perDatagram = (m_maxDatagram - UDP_HEADER_SIZE) / width;
+  unsigned int first = m_skipped > 0 ? 1 : 0;
+  unsigned int count =
+      first + static_cast<unsigned>((size + perDatagram - 1) / perDatagram);
+
+  m_datagrams.resize(count * UDP_MAX_DATAGRAM);
+  m_lengths.resize(count);
+
+  if (first > 0) {
+    uint8_t *datagram = m_datagrams.data();
+
+    putHeader(
+          datagram,
+          m_sequence++,
+          m_rate,
+          static_cast<uint16_t>(m_format | UDP_GAP_FLAG),
+          0);
+    putBE32(datagram + UDP_HEADER_SIZE, static_cast<uint32_t>(m_skipped >> 32));
+    putBE32(datagram + UDP_HEADER_SIZE + 4, static_cast<uint32_t>(m_skipped));
+
+    m_lengths[0] = UDP_HEADER_SIZE + sizeof(uint64_t);
+    m_skipped    = 0;
+  }
+
+  for (unsigned int d = first; d < count; ++d) {
+    uint8_t *datagram = m_datagrams.data() + d * UDP_MAX_DATAGRAM;
+    uint8_t *p = datagram + UDP_HEADER_SIZE;
+    SUSCOUNT n = std::min(perDatagram, size);
+
+    putHeader(
+          datagram,
+          m_sequence++,
+          m_rate,
+          static_cast<uint16_t>(m_format),
+          static_cast<uint16_t>(n));
+
+    for (SUSCOUNT i = 0; i < n; ++i) {
+      p = putSample(p, SU_C_REAL(samples[i]));
+      if (complex)
+        p = putSample(p, SU_C_IMAG(samples[i]));
+    }
+
+    m_lengths[d] = UDP_HEADER_SIZE + n * width;
+    samples += n;
+    size    -= n;
+  }
+
+  return count;
+}
+
+//
+// Datagrams that cannot be sent (full socket buffer, unreachable host)
+// are dropped: receivers notice from the sequence numbers, and the
+// channel is never held back by a slow or absent receiver. A full socket
+// buffer will not drain in the meantime, so the rest of the block is
+// dropped at once.
+//
+void
+UdpConsumer::send(UdpDestination const &dest, unsigned int count)
+{
+  int fd = dest.addr.ss_family == AF_INET6 ? m_socket6 : m_socket4;
+  struct iovec iov[UDP_BATCH];
+  unsigned int d = 0;
+
+  while (d < count) {
+    unsigned int n = std::min<unsigned int>(count - d, UDP_BATCH);
+    int sent;
+
+#ifdef __linux__
+    struct mmsghdr msgs[UDP_BATCH];
+
+    memset(msgs, 0, n * sizeof(struct mmsghdr));
+
+    for (unsigned int i = 0; i < n; ++i) {
+      iov[i].iov_base = m_datagrams.data() + (d + i) * UDP_MAX_DATAGRAM;
+      iov[i].iov_len  = m_lengths[d + i];
+      msgs[i].msg_hdr.msg_name    = const_cast<sockaddr_storage *>(&dest.addr);
+      msgs[i].msg_hdr.msg_namelen = dest.len;
+      msgs[i].msg_hdr.msg_iov     = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen  = 1;
+    }
+
+    sent = sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+#else
+    iov[0].iov_base = m_datagrams.data() + d * UDP_MAX_DATAGRAM;
+    iov[0].iov_len  = m_lengths[d];
+
+    sent = sendto(
+          fd,
+          iov[0].iov_base,
+          iov[0].iov_len,
+          MSG_DONTWAIT,
+          reinterpret_cast<const sockaddr *>(&dest.addr),
+          dest.len) < 0 ? -1 : 1;
+#endif // __linux__
+
+    if (sent < 0 && errno == EINTR)
+      continue;
+
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      break;
+
+    // Skip the datagram that failed, keep trying with the rest
+    d += sent > 0 ? static_cast<unsigned>(sent) : 1;
+  }
+}
+
+void
+UdpConsumer::opened(
+    Suscan::Analyzer *,
+    Suscan::Handle,
+    ChannelDescription const &channel,
+    Suscan::Config const &)
+{
+  start(channel.sampRate);
+}
+
+void
+UdpConsumer::samples(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  unsigned int count;
+
+  if (!isEnabled() || size == 0 || m_destinations.empty())
+    return;
+
+  count = pack(samples, size);
+
+  for (auto &dest : m_destinations)
+    send(dest, count);
+}
+
+void
+UdpConsumer::dropped(SUSCOUNT size)
+{
+  skip(size);
+}
+
+void
+UdpConsumer::closed()
+{
+  m_rate = 0;
+}
+
+void
+UdpConsumer::enableStateChanged(bool)
+{
+  // Nothing to reconfigure: samples() drops everything while disabled
+}
+
+bool
+UdpConsumer::canUpdateFrom(ChannelConsumer const &consumer) const
+{
+  auto other = dynamic_cast<const UdpConsumer *>(&consumer);
+
+  return other != nullptr
+      && other->m_format == m_format
+      && other->m_ttl == m_ttl
+      && other->destinations() == destinations();
+}
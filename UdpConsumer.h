@@ -0,0 +1,128 @@
+//
+//    UdpConsumer.h: Sample output over UDP datagrams
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef UDPCONSUMER_H
+#define UDPCONSUMER_H
+
+#include <MultiChannelForwarder.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+
+//
+// Datagram layout. Header fields are big endian, samples are int16 in
+// little endian (I and Q interleaved for complex formats).
+//
+//   0  uint32  Sequence number (per channel, one per datagram)
+//   4  uint32  Sample rate (sps)
+//   8  uint16  Format (UdpSampleFormat)
+//  10  uint16  Samples in this datagram
+//  12  ...     Samples
+//
+#define UDP_HEADER_SIZE 12
+
+// Set in the format field of gap markers. They carry no samples: their
+// payload is the number of samples held back by the squelch (uint64, big
+// endian) since the previous datagram.
+#define UDP_GAP_FLAG 0x8000
+
+// Largest datagrams that fit in a 1500-byte Ethernet MTU, after the IP
+// (no options) and UDP headers
+#define UDP_MAX_DATAGRAM  1472 // IPv4
+#define UDP_MAX_DATAGRAM6 1452 // IPv6
+
+// Datagrams handed to the kernel in a single call
+#define UDP_BATCH 64
+
+// Hops of multicast datagrams. 1 keeps them in the local network.
+#define UDP_DEFAULT_TTL 1
+
+enum UdpSampleFormat {
+  UDP_FORMAT_REAL_INT16    = 0,
+  UDP_FORMAT_COMPLEX_INT16 = 1
+};
+
+struct UdpDestination {
+  std::string      spec; // As given: host:port, or [host]:port for IPv6
+  sockaddr_storage addr;
+  socklen_t        len;
+};
+
+//
+// Sends the samples of a channel to one or more unicast or multicast
+// destinations. Blocks are cut in datagrams that fit in the MTU, and all
+// the datagrams of a block are sent to each destination with as few
+// system calls as possible (sendmmsg, where available). Sending the same
+// datagram to many receivers is what multicast is for: one multicast
+// destination costs the same as one unicast receiver.
+//
+class UdpConsumer : public ChannelConsumer
+{
+  UdpSampleFormat m_format;
+  int m_ttl = UDP_DEFAULT_TTL;
+  int m_socket4 = -1;
+  int m_socket6 = -1;
+  std::vector<UdpDestination> m_destinations;
+  size_t m_maxDatagram = UDP_MAX_DATAGRAM; // Fits every destination
+
+  // Belong to the thread delivering the samples
+  uint32_t m_rate = 0;
+  uint32_t m_sequence = 0;
+  uint64_t m_skipped = 0; // Reported in a gap marker before the next samples
+  std::vector<uint8_t> m_datagrams; // UDP_MAX_DATAGRAM bytes each
+  std::vector<size_t> m_lengths;
+
+  int socketFor(int family);
+  void applyTtl(int socket, int family) const;
+  unsigned int pack(const SUCOMPLEX *, SUSCOUNT);
+  void send(UdpDestination const &, unsigned int count);
+
+public:
+  UdpConsumer(UdpSampleFormat);
+
+  // Destinations are added before the channel is opened
+  bool addDestination(std::string const &spec);
+  std::vector<std::string> destinations() const;
+
+  void setTtl(int);
+  int ttl() const;
+
+  // Starts a new stream at the given rate. For consumers that forward
+  // their own output (at their own rate) instead of the channel samples.
+  void start(SUFLOAT rate);
+
+  // Samples of the stream that are not sent (closed squelch)
+  void skip(SUSCOUNT);
+
+  virtual void opened(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &,
+      Suscan::Config const &) override;
+  virtual void samples(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
+  virtual void closed() override;
+  virtual void enableStateChanged(bool) override;
+  virtual bool canUpdateFrom(ChannelConsumer const &) const override;
+
+  virtual ~UdpConsumer();
+};
+
+#endif // UDPCONSUMER_H
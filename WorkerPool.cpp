@@ -0,0 +1,167 @@
+//
+//    WorkerPool.cpp: Work-stealing thread pool
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#include "WorkerPool.h"
+#include "Affinity.h"
+
+WorkerPool::WorkerPool(unsigned int threads)
+{
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+    threads = threads > 1 ? threads - 1 : 1;
+  }
+
+  m_pending = 0;
+
+  // Queue 0 belongs to the caller of run()
+  for (unsigned int i = 0; i <= threads; ++i)
+    m_queues.push_back(new WorkerQueue);
+
+  for (unsigned int i = 1; i <= threads; ++i)
+    m_threads.push_back(std::thread(&WorkerPool::worker, this, i));
+}
+
+WorkerPool::~WorkerPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+
+  m_wakeUp.notify_all();
+
+  for (auto &t : m_threads)
+    t.join();
+
+  for (auto q : m_queues)
+    delete q;
+}
+
+unsigned int
+WorkerPool::size() const
+{
+  return static_cast<unsigned>(m_threads.size());
+}
+
+bool
+WorkerPool::popTask(unsigned int index, WorkerTask &task)
+{
+  unsigned int count = static_cast<unsigned>(m_queues.size());
+
+  // Own queue first (front), then steal from the others (back)
+  for (unsigned int i = 0; i < count; ++i) {
+    WorkerQueue *q = m_queues[(index + i) % count];
+    std::lock_guard<std::mutex> lock(q->mutex);
+
+    if (!q->tasks.empty()) {
+      if (i == 0) {
+        task = std::move(q->tasks.front());
+        q->tasks.pop_front();
+      } else {
+        task = std::move(q->tasks.back());
+        q->tasks.pop_back();
+      }
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+WorkerPool::worker(unsigned int index)
+{
+  uint64_t generation = 0;
+  WorkerTask task;
+
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wakeUp.wait(
+            lock,
+            [&] () { return m_stop || m_generation != generation; });
+
+      if (m_stop)
+        return;
+
+      generation = m_generation;
+    }
+
+    while (popTask(index, task)) {
+      task();
+
+      if (--m_pending == 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done.notify_all();
+      }
+    }
+  }
+}
+
+void
+WorkerPool::run(std::vector<WorkerTask> &tasks)
+{
+  unsigned int count = static_cast<unsigned>(m_queues.size());
+  WorkerTask task;
+
+  if (tasks.empty())
+    return;
+
+  m_pending += static_cast<unsigned>(tasks.size());
+
+  for (unsigned int i = 0; i < tasks.size(); ++i) {
+    WorkerQueue *q = m_queues[i % count];
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->tasks.push_back(std::move(tasks[i]));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_generation;
+  }
+
+  m_wakeUp.notify_all();
+
+  // Help while waiting. Several threads may be running batches at the
+  // same time (one per analyzer), so the last task of any of them must
+  // wake up the others.
+  while (popTask(0, task)) {
+    task();
+
+    if (--m_pending == 0) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_done.notify_all();
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this] () { return m_pending == 0; });
+}
+
+void
+WorkerPool::setAffinity(std::vector<int> const &cpus)
+{
+  for (unsigned int i = 0; i < m_threads.size(); ++i) {
+    if (cpus.empty())
+      setThreadAffinity(m_threads[i], cpus);
+    else
+      setThreadAffinity(m_threads[i], std::vector<int>(1, cpus[i % cpus.size()]));
+  }
+}
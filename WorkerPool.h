@@ -0,0 +1,72 @@
+//
+//    WorkerPool.h: Work-stealing thread pool
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::function<void ()> WorkerTask;
+
+struct WorkerQueue {
+  std::mutex             mutex;
+  std::deque<WorkerTask> tasks;
+};
+
+//
+// Fork-join pool. run() spreads a batch of tasks over the per-worker
+// queues and returns when all of them are done. Workers (and the caller,
+// while it waits) take tasks from the front of their own queue and steal
+// from the back of the others when it runs dry.
+//
+class WorkerPool {
+  std::vector<std::thread>  m_threads;
+  std::vector<WorkerQueue *> m_queues;
+
+  std::mutex                m_mutex;
+  std::condition_variable   m_wakeUp;
+  std::condition_variable   m_done;
+  std::atomic<unsigned int> m_pending;
+  uint64_t                  m_generation = 0;
+  bool                      m_stop = false;
+
+  bool popTask(unsigned int, WorkerTask &);
+  void worker(unsigned int);
+
+public:
+  WorkerPool(unsigned int threads = 0); // 0: one less than the cores
+  unsigned int size() const;
+
+  void run(std::vector<WorkerTask> &);
+
+  // Worker i runs on cpus[i % cpus.size()] (empty: no restriction). The
+  // caller of run() is not affected.
+  void setAffinity(std::vector<int> const &cpus);
+
+  ~WorkerPool();
+};
+
+#endif // WORKERPOOL_H
@@ -35,23 +35,41 @@ isEmpty(SIGDIGGER_PREFIX) {
 SOURCES += \
     AddChanDialog.cpp \
     AddMasterDialog.cpp \
+    Affinity.cpp \
+    Channelizer.cpp \
+    ConsumerPool.cpp \
+    ControlServer.cpp \
+    Demodulator.cpp \
     MultiChannelTreeModel.cpp \
     Registration.cpp \
+    Resampler.cpp \
     SettingsManager.cpp \
+    SpectrumMonitor.cpp \
+    UdpConsumer.cpp \
     ZeroMQSink.cpp \
     ZeroMQWidget.cpp \
     ZeroMQWidgetFactory.cpp \
-    MultiChannelForwarder.cpp
+    MultiChannelForwarder.cpp \
+    WorkerPool.cpp
 
 HEADERS += \
   AddChanDialog.h \
   AddMasterDialog.h \
+  Affinity.h \
+  Channelizer.h \
+  ConsumerPool.h \
+  ControlServer.h \
+  Demodulator.h \
   MultiChannelTreeModel.h \
+  Resampler.h \
   SettingsManager.h \
+  SpectrumMonitor.h \
+  UdpConsumer.h \
   ZeroMQSink.h \
   ZeroMQWidget.h \
     ZeroMQWidgetFactory.h \
-    MultiChannelForwarder.h
+    MultiChannelForwarder.h \
+    WorkerPool.h
 
 INCLUDEPATH += $$SUWIDGETS_INSTALL_HEADERS $$SIGDIGGER_INSTALL_HEADERS
 
@@ -18,17 +18,68 @@
 //
 
 #include "ZeroMQSink.h"
+#include "UdpConsumer.h"
 #include <analyzer/inspector/params.h>
 #include <zmq.hpp>
+#include <algorithm>
+#include <cstring>
 
 #define ZMQ_FLOAT2INT16 32768.
 
+// Channel rates closer than this (in sps) to the requested rate are not
+// resampled
+#define ZMQ_RATE_TOLERANCE 1e-3
+
+// Squelch timing, in seconds. The hangover keeps the squelch open after
+// the last active block, the pre-roll is sent before the first one.
+#define ZMQ_SQUELCH_HANGOVER  .5
+#define ZMQ_SQUELCH_PREROLL   .2
+#define ZMQ_SQUELCH_FLOOR_TAU 10. // Rise time of the noise floor estimate
+
+bool
+ZeroMQSink::ioAffinitySupported()
+{
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+  return true;
+#else
+  return false;
+#endif // ZMQ_THREAD_AFFINITY_CPU_ADD
+}
+
+bool
+ZeroMQSink::setIoAffinity(std::vector<int> const &cpus)
+{
+  std::lock_guard<std::mutex> guard(m_mutex);
+
+  if (cpus != m_ioCpus) {
+    m_ioCpus   = cpus;
+    m_ctxDirty = true;
+  }
+
+  return cpus.empty() || ioAffinitySupported();
+}
+
 bool
 ZeroMQSink::bind(const char *url)
 {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
   if (m_state)
     return false;
 
+  // The I/O thread starts with the first socket of the context: the
+  // affinity can only be set on a fresh one.
+  if (m_ctxDirty) {
+    m_zmq_ctx.close();
+    m_zmq_ctx  = zmq::context_t();
+    m_ctxDirty = false;
+
+#ifdef ZMQ_THREAD_AFFINITY_CPU_ADD
+    for (auto cpu : m_ioCpus)
+      m_zmq_ctx.set(zmq::ctxopt::thread_affinity_cpu_add, cpu);
+#endif // ZMQ_THREAD_AFFINITY_CPU_ADD
+  }
+
   m_zmq_socket = new zmq::socket_t(m_zmq_ctx, zmq::socket_type::pub);
   m_zmq_socket->bind(url);
   m_state = true;
@@ -36,20 +87,62 @@ ZeroMQSink::bind(const char *url)
   return true;
 }
 
-bool
-ZeroMQSink::write(
-    const char *topic,
-    unsigned int sampleRate,
+SUFLOAT
+ZeroMQSink::convert(
     const SUCOMPLEX *samples,
     SUSCOUNT size,
-    ZeroMQDeliveryMask mask)
+    ZeroMQDeliveryMask mask,
+    std::vector<int16_t> &out)
+{
+  unsigned int allocSize;
+  SUFLOAT energy = 0;
+
+  allocSize = mask == ZEROMQ_DELIVER_COMPLEX ? 2 * size : size;
+  out.resize(allocSize);
+
+  switch (mask) {
+    case ZEROMQ_DELIVER_REAL:
+      for (SUSCOUNT i = 0; i < size; ++i) {
+        SUFLOAT re = SU_C_REAL(samples[i]);
+        out[i] = SU_FLOOR(re * ZMQ_FLOAT2INT16);
+        energy += re * re;
+      }
+      break;
+
+    case ZEROMQ_DELIVER_IMAG:
+      for (SUSCOUNT i = 0; i < size; ++i) {
+        SUFLOAT im = SU_C_IMAG(samples[i]);
+        out[i] = SU_FLOOR(im * ZMQ_FLOAT2INT16);
+        energy += im * im;
+      }
+      break;
+
+    case ZEROMQ_DELIVER_COMPLEX:
+      for (SUSCOUNT i = 0; i < size; ++i) {
+        SUFLOAT re = SU_C_REAL(samples[i]);
+        SUFLOAT im = SU_C_IMAG(samples[i]);
+        out[2 * i + 0] = SU_FLOOR(re * ZMQ_FLOAT2INT16);
+        out[2 * i + 1] = SU_FLOOR(im * ZMQ_FLOAT2INT16);
+        energy += re * re + im * im;
+      }
+      break;
+  }
+
+  return size > 0 ? energy / size : 0;
+}
+
+bool
+ZeroMQSink::send(
+    const char *topic,
+    uint32_t sampleRate,
+    const void *data,
+    size_t bytes)
 {
   union {
     uint32_t sampRate;
     uint8_t  asBytes[4];
   } sampRateBuf;
-  const void *sampleBuffer;
-  unsigned int allocSize;
+  std::lock_guard<std::mutex> guard(m_mutex);
 
   if (!m_state)
     return false;
@@ -64,41 +157,67 @@ ZeroMQSink::write(
         zmq::buffer(sampRateBuf.asBytes, sizeof(uint32_t)),
         zmq::send_flags::sndmore);
 
-  // Convert data
-  allocSize = mask == ZEROMQ_DELIVER_COMPLEX ? 2 * size : size;
-  if (m_sampleBuffer.size() < allocSize)
-    m_sampleBuffer.resize(allocSize);
+  m_zmq_socket->send(zmq::buffer(data, bytes));
 
-  switch (mask) {
-    case ZEROMQ_DELIVER_REAL:
-      for (SUSCOUNT i = 0; i < size; ++i)
-        m_sampleBuffer[i] = SU_FLOOR(SU_C_REAL(samples[i]) * ZMQ_FLOAT2INT16);
+  return true;
+}
 
-      break;
+bool
+ZeroMQSink::writeGap(const char *topic, unsigned int sampleRate, uint64_t count)
+{
+  return send(topic, sampleRate | ZEROMQ_GAP_FLAG, &count, sizeof(uint64_t));
+}
 
-    case ZEROMQ_DELIVER_IMAG:
-      for (SUSCOUNT i = 0; i < size; ++i)
-        m_sampleBuffer[i] = SU_FLOOR(SU_C_IMAG(samples[i]) * ZMQ_FLOAT2INT16);
-      break;
+bool
+ZeroMQSink::writeSpectrum(
+    const char *topic,
+    unsigned int sampleRate,
+    SUFREQ center,
+    const SUFLOAT *psd,
+    unsigned int bins)
+{
+  std::vector<uint8_t> payload(sizeof(double) + bins * sizeof(float));
+  double fc = center;
+  float *data = reinterpret_cast<float *>(payload.data() + sizeof(double));
 
-    case ZEROMQ_DELIVER_COMPLEX:
-      for (SUSCOUNT i = 0; i < size; ++i) {
-        m_sampleBuffer[2 * i + 0] = SU_FLOOR(SU_C_REAL(samples[i]) * ZMQ_FLOAT2INT16);
-        m_sampleBuffer[2 * i + 1] = SU_FLOOR(SU_C_IMAG(samples[i]) * ZMQ_FLOAT2INT16);
-      }
-      break;
-  }
+  std::memcpy(payload.data(), &fc, sizeof(double));
+  for (unsigned int i = 0; i < bins; ++i)
+    data[i] = static_cast<float>(psd[i]);
+
+  return send(
+        topic,
+        sampleRate | ZEROMQ_SPECTRUM_FLAG,
+        payload.data(),
+        payload.size());
+}
 
-  sampleBuffer = m_sampleBuffer.data();
+bool
+ZeroMQSink::write(
+    const char *topic,
+    unsigned int sampleRate,
+    const SUCOMPLEX *samples,
+    SUSCOUNT size,
+    ZeroMQDeliveryMask mask)
+{
+  // Conversion happens in the thread of the consumer (usually a worker
+  // of the consumer pool), each with its own buffer. Only the socket is
+  // shared.
+  static thread_local std::vector<int16_t> scratch;
 
-  m_zmq_socket->send(zmq::buffer(sampleBuffer, sizeof(int16_t) * allocSize));
+  convert(samples, size, mask, scratch);
 
-  return 0;
+  return send(
+        topic,
+        sampleRate,
+        scratch.data(),
+        sizeof(int16_t) * scratch.size());
 }
 
 bool
 ZeroMQSink::disconnect()
 {
+  std::lock_guard<std::mutex> guard(m_mutex);
+
   if (!m_state)
     return false;
 
@@ -124,6 +243,7 @@ ZeroMQConsumer::ZeroMQConsumer(
 
 
   m_sampRate    = audioSampRate;
+  m_reqRate     = audioSampRate;
   m_channelType = chanType;
   m_zmq_sink    = sink;
 
@@ -137,6 +257,13 @@ ZeroMQConsumer::~ZeroMQConsumer()
 {
   if (m_fp != nullptr)
     fclose(m_fp);
+
+  if (m_resampler != nullptr)
+    delete m_resampler;
+
+  delete m_udp;
+
+  clearCascade();
 }
 
 std::string
@@ -152,6 +279,434 @@ ZeroMQConsumer::getSampRate() const
   return m_sampRate;
 }
 
+uint64_t
+ZeroMQConsumer::demodulator(bool enabled) const
+{
+  uint64_t demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_DISABLED;
+
+  if (enabled) {
+    if (m_channelType == "audio:fm")
+      demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_FM;
+    else if (m_channelType == "audio:am")
+      demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_AM;
+    else if (m_channelType == "audio:usb")
+      demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_USB;
+    else if (m_channelType == "audio:lsb")
+      demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_LSB;
+  }
+
+  return demod;
+}
+
+ChannelDemodulator
+ZeroMQConsumer::channelDemodulator() const
+{
+  if (m_channelType == "audio:fm")
+    return CHANNEL_DEMOD_FM;
+  else if (m_channelType == "audio:am")
+    return CHANNEL_DEMOD_AM;
+  else if (m_channelType == "audio:usb")
+    return CHANNEL_DEMOD_USB;
+  else if (m_channelType == "audio:lsb")
+    return CHANNEL_DEMOD_LSB;
+
+  return CHANNEL_DEMOD_NONE;
+}
+
+// Type and rates shape the inspector and the published topics. The
+// squelch can change at any time.
+bool
+ZeroMQConsumer::canUpdateFrom(ChannelConsumer const &consumer) const
+{
+  auto other = dynamic_cast<const ZeroMQConsumer *>(&consumer);
+
+  if (other == nullptr
+      || other->m_channelType != m_channelType
+      || other->m_reqRate != m_reqRate
+      || other->getOutputRates() != getOutputRates())
+    return false;
+
+  if (m_udp == nullptr || other->m_udp == nullptr)
+    return m_udp == other->m_udp;
+
+  return m_udp->canUpdateFrom(*other->m_udp);
+}
+
+void
+ZeroMQConsumer::updateFrom(ChannelConsumer const &consumer)
+{
+  auto other = dynamic_cast<const ZeroMQConsumer *>(&consumer);
+
+  if (other != nullptr)
+    setSquelch(other->getSquelch(), other->getSquelchLevel());
+}
+
+// Audio consumers configure the demodulator of their inspector. Raw ones
+// only resample (locally) what they get.
+bool
+ZeroMQConsumer::configuresInspector() const
+{
+  return m_channelType != "raw";
+}
+
+// Audio consumers that would configure their inspector in the same way
+// can share it too
+bool
+ZeroMQConsumer::sharesInspectorWith(ChannelConsumer const &consumer) const
+{
+  auto other = dynamic_cast<const ZeroMQConsumer *>(&consumer);
+
+  if (other != nullptr && configuresInspector())
+    return other->m_channelType == m_channelType
+        && other->m_sampRate == m_sampRate;
+
+  return ChannelConsumer::sharesInspectorWith(consumer);
+}
+
+bool
+ZeroMQConsumer::addUdpDestination(std::string const &spec)
+{
+  if (m_udp == nullptr)
+    m_udp = new UdpConsumer(
+          m_mask == ZEROMQ_DELIVER_COMPLEX
+          ? UDP_FORMAT_COMPLEX_INT16
+          : UDP_FORMAT_REAL_INT16);
+
+  return m_udp->addDestination(spec);
+}
+
+std::vector<std::string>
+ZeroMQConsumer::getUdpDestinations() const
+{
+  if (m_udp == nullptr)
+    return std::vector<std::string>();
+
+  return m_udp->destinations();
+}
+
+void
+ZeroMQConsumer::setUdpTtl(int ttl)
+{
+  if (m_udp != nullptr)
+    m_udp->setTtl(ttl);
+}
+
+int
+ZeroMQConsumer::getUdpTtl() const
+{
+  return m_udp != nullptr ? m_udp->ttl() : UDP_DEFAULT_TTL;
+}
+
+bool
+ZeroMQConsumer::addOutputRate(SUFLOAT rate)
+{
+  ZeroMQExtraOutput output;
+  std::lock_guard<std::mutex> guard(m_outputMutex);
+
+  if (rate <= 0)
+    return false;
+
+  for (auto &p : m_extraOutputs)
+    if (sufeq(p.rate, rate, ZMQ_RATE_TOLERANCE))
+      return false;
+
+  output.rate = rate;
+  m_extraOutputs.push_back(output);
+
+  // Already delivering samples: the cascade must be redone. Otherwise
+  // opened() builds it, once the topic and the rate are known.
+  if (m_opened)
+    buildCascade();
+
+  return true;
+}
+
+std::vector<SUFLOAT>
+ZeroMQConsumer::getOutputRates() const
+{
+  std::vector<SUFLOAT> rates;
+  std::lock_guard<std::mutex> guard(m_outputMutex);
+
+  for (auto &p : m_extraOutputs)
+    rates.push_back(p.rate);
+
+  return rates;
+}
+
+void
+ZeroMQConsumer::clearCascade()
+{
+  for (auto p : m_cascade)
+    delete p;
+
+  for (auto &p : m_extraOutputs) {
+    if (p.resampler != nullptr)
+      delete p.resampler;
+    p.resampler = nullptr;
+  }
+
+  m_cascade.clear();
+}
+
+//
+// Every extra output hangs from the deepest half-band stage whose rate is
+// still above (or at) the output rate. The cascade is as deep as the
+// slowest output requires, and shared by all of them.
+//
+void
+ZeroMQConsumer::buildCascade()
+{
+  unsigned int depth = 0;
+
+  clearCascade();
+
+  for (auto &p : m_extraOutputs) {
+    SUFLOAT stageRate = m_sampRate;
+
+    p.stage = 0;
+    while (stageRate * .5f >= p.rate - ZMQ_RATE_TOLERANCE) {
+      stageRate *= .5f;
+      ++p.stage;
+    }
+
+    if (!sufeq(stageRate, p.rate, ZMQ_RATE_TOLERANCE))
+      p.resampler = new Resampler(stageRate, p.rate);
+
+    p.topic = m_topic + "_" + std::to_string(static_cast<unsigned>(p.rate));
+    depth = std::max(depth, p.stage);
+  }
+
+  for (unsigned int i = 0; i < depth; ++i)
+    m_cascade.push_back(new HalfBandDecimator());
+}
+
+void
+ZeroMQConsumer::writeExtraOutputs(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  std::lock_guard<std::mutex> guard(m_outputMutex);
+
+  if (m_extraOutputs.empty())
+    return;
+
+  std::vector<const SUCOMPLEX *> stageData(m_cascade.size() + 1);
+  std::vector<SUSCOUNT> stageSize(m_cascade.size() + 1);
+
+  stageData[0] = samples;
+  stageSize[0] = size;
+
+  for (unsigned int i = 0; i < m_cascade.size(); ++i) {
+    m_cascade[i]->process(stageData[i], stageSize[i]);
+    stageData[i + 1] = m_cascade[i]->output();
+    stageSize[i + 1] = m_cascade[i]->size();
+  }
+
+  for (auto &p : m_extraOutputs) {
+    const SUCOMPLEX *data = stageData[p.stage];
+    SUSCOUNT len = stageSize[p.stage];
+
+    if (p.resampler != nullptr) {
+      p.resampler->process(data, len);
+      data = p.resampler->output();
+      len  = p.resampler->size();
+    }
+
+    if (len == 0)
+      continue;
+
+    // Gated by the squelch of the main topic (without pre-roll), with
+    // the same gap markers
+    if (!m_squelchOpen) {
+      p.suppressed += len;
+      continue;
+    }
+
+    if (p.suppressed > 0) {
+      m_zmq_sink->writeGap(
+            p.topic.c_str(),
+            static_cast<unsigned>(p.rate),
+            p.suppressed);
+      p.suppressed = 0;
+    }
+
+    m_zmq_sink->write(
+          p.topic.c_str(),
+          static_cast<unsigned>(p.rate),
+          data,
+          len,
+          m_mask);
+  }
+}
+
+void
+ZeroMQConsumer::setSquelch(ZeroMQSquelch mode, SUFLOAT level)
+{
+  m_squelchLevel = level;
+  m_squelchMode  = mode;
+}
+
+ZeroMQSquelch
+ZeroMQConsumer::getSquelch() const
+{
+  return static_cast<ZeroMQSquelch>(m_squelchMode.load());
+}
+
+SUFLOAT
+ZeroMQConsumer::getSquelchLevel() const
+{
+  return m_squelchLevel;
+}
+
+const char *
+ZeroMQConsumer::squelchName(ZeroMQSquelch mode)
+{
+  switch (mode) {
+    case ZEROMQ_SQUELCH_ENERGY:
+      return "energy";
+
+    case ZEROMQ_SQUELCH_SNR:
+      return "snr";
+
+    default:
+      return "off";
+  }
+}
+
+bool
+ZeroMQConsumer::squelchFromName(std::string const &name, ZeroMQSquelch &mode)
+{
+  if (name == "" || name == "off")
+    mode = ZEROMQ_SQUELCH_OFF;
+  else if (name == "energy")
+    mode = ZEROMQ_SQUELCH_ENERGY;
+  else if (name == "snr")
+    mode = ZEROMQ_SQUELCH_SNR;
+  else
+    return false;
+
+  return true;
+}
+
+bool
+ZeroMQConsumer::squelchActive(ZeroMQSquelch mode, SUFLOAT power, SUSCOUNT size)
+{
+  SUFLOAT level = SU_POWER_DB(power + 1e-20f);
+
+  if (mode == ZEROMQ_SQUELCH_ENERGY)
+    return level >= m_squelchLevel;
+
+  bool active;
+
+  if (m_noiseFloor == 0 || power < m_noiseFloor)
+    m_noiseFloor = power;
+
+  active = level >= SU_POWER_DB(m_noiseFloor + 1e-20f) + m_squelchLevel;
+
+  // The floor follows drops immediately, but only rises (slowly) while
+  // the squelch is closed and the block is quiet. Otherwise a long
+  // transmission would pull it up to its own level and cut itself.
+  if (!active && !m_squelchOpen)
+    m_noiseFloor += (power - m_noiseFloor)
+        * SU_MIN(1.f, size / (ZMQ_SQUELCH_FLOOR_TAU * m_outRate));
+
+  return active;
+}
+
+//
+// Sends a block of the main output. While the squelch is closed, the
+// last ZMQ_SQUELCH_PREROLL seconds are kept (already converted) and the
+// rest is dropped. When it opens, a gap marker with the number of
+// dropped samples is sent first, then the pre-roll and the block.
+//
+void
+ZeroMQConsumer::publish(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  ZeroMQSquelch mode = getSquelch();
+  unsigned int rate = static_cast<unsigned>(m_outRate);
+  unsigned int width = m_mask == ZEROMQ_DELIVER_COMPLEX ? 2 : 1;
+  SUSCOUNT preroll = static_cast<SUSCOUNT>(ZMQ_SQUELCH_PREROLL * m_outRate);
+  SUFLOAT power;
+
+  power = m_zmq_sink->convert(samples, size, m_mask, m_converted);
+
+  if (mode == ZEROMQ_SQUELCH_OFF) {
+    m_squelchOpen = true;
+    m_suppressed  = 0;
+    m_prerollSize = 0;
+    m_preroll.clear();
+    m_zmq_sink->send(
+          m_topic.c_str(),
+          rate,
+          m_converted.data(),
+          m_converted.size() * sizeof(int16_t));
+    return;
+  }
+
+  if (squelchActive(mode, power, size))
+    m_hangover = static_cast<SUSCOUNT>(ZMQ_SQUELCH_HANGOVER * m_outRate);
+  else
+    m_hangover = m_hangover > size ? m_hangover - size : 0;
+
+  if (m_hangover > 0) {
+    if (!m_squelchOpen) {
+      if (m_suppressed > 0)
+        m_zmq_sink->writeGap(m_topic.c_str(), rate, m_suppressed);
+
+      for (auto &block : m_preroll)
+        m_zmq_sink->send(
+              m_topic.c_str(),
+              rate,
+              block.data(),
+              block.size() * sizeof(int16_t));
+
+      m_preroll.clear();
+      m_prerollSize = 0;
+      m_suppressed  = 0;
+      m_squelchOpen = true;
+    }
+
+    m_zmq_sink->send(
+          m_topic.c_str(),
+          rate,
+          m_converted.data(),
+          m_converted.size() * sizeof(int16_t));
+  } else {
+    m_squelchOpen = false;
+    m_preroll.push_back(m_converted);
+    m_prerollSize += size;
+
+    while (!m_preroll.empty()
+           && m_prerollSize - m_preroll.front().size() / width >= preroll) {
+      SUSCOUNT dropped = m_preroll.front().size() / width;
+
+      m_suppressed  += dropped;
+      m_prerollSize -= dropped;
+      m_preroll.pop_front();
+    }
+  }
+}
+
+//
+// The analyzer does not necessarily honor the rate we asked for (raw
+// inspectors run at whatever the decimator allows, channelizers at their
+// own output rate). Whenever the channel rate differs from the requested
+// one, a resampler takes it to exactly m_sampRate.
+//
+void
+ZeroMQConsumer::setInputRate(SUFLOAT rate)
+{
+  if (m_resampler != nullptr) {
+    delete m_resampler;
+    m_resampler = nullptr;
+  }
+
+  if (m_sampRate <= 0)
+    m_sampRate = rate;
+  else if (!sufeq(rate, m_sampRate, ZMQ_RATE_TOLERANCE))
+    m_resampler = new Resampler(rate, m_sampRate);
+
+  m_outRate = m_sampRate;
+}
+
 unsigned int
 ZeroMQConsumer::calcBufLen() const
 {
@@ -177,14 +732,26 @@ ZeroMQConsumer::opened(
   m_config   = config;
   m_analyzer = analyzer;
   m_handle   = handle;
+  m_audio    = channel.inspClass == "audio" && !channel.attached
+      && channel.owner == nullptr; // Sharers leave it to the owner
+  m_outRate  = m_sampRate;
+  m_appliedEnabled = isEnabled();
+
+  // New inspector, new squelch history
+  m_squelchOpen = true;
+  m_hangover    = 0;
+  m_noiseFloor  = 0;
+  m_suppressed  = 0;
+  m_prerollSize = 0;
+  m_preroll.clear();
 
-  if (channel.inspClass == "raw") {
-    m_sampRate = channel.sampRate;
-  } else if (channel.inspClass == "audio") {
+  if (channel.inspClass == "raw" || channel.attached) {
+    setInputRate(channel.sampRate);
+  } else if (m_audio) {
     SUFREQ f_edge;
     SUFLOAT bw_new = m_sampRate * .5;
     Suscan::AnalyzerSourceInfo info = analyzer->getSourceInfo();
-    uint64_t demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_DISABLED;
+    uint64_t demod = demodulator(isEnabled());
     // Audio inspector. In this case, we need to configure the appropriate
     // demodulator accordingly
 
@@ -192,17 +759,6 @@ ZeroMQConsumer::opened(
     m_config.set("audio.cutoff", static_cast<SUFLOAT>(bw_new));
     m_config.set("audio.volume", 1.f);
 
-    if (isEnabled()) {
-      if (m_channelType == "audio:fm")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_FM;
-      else if (m_channelType == "audio:am")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_AM;
-      else if (m_channelType == "audio:usb")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_USB;
-      else if (m_channelType == "audio:lsb")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_LSB;
-    }
-
     m_config.set("audio.demodulator", demod);
 
 
@@ -218,12 +774,20 @@ ZeroMQConsumer::opened(
     //    2. The new bandwidth is again bw_new = m_sampRate * .45
     //    3. The new center is going to be at f_edge - bw_new / 2
 
+    m_loShift = 0;
+
+    // Filter displacement depends on the sideband, not on whether the
+    // channel is currently enabled.
+    demod = demodulator(true);
+
     if (demod == SUSCAN_INSPECTOR_AUDIO_DEMOD_USB) {
-      f_edge = channel.offset - channel.bandwidth / 2;
+      f_edge = channel.loFreq - channel.bandwidth / 2;
+      m_loShift = f_edge + bw_new / 2 - channel.loFreq;
       m_analyzer->setInspectorFreq(m_handle, f_edge + bw_new / 2);
       m_analyzer->setInspectorBandwidth(m_handle, bw_new);
     } else if (demod == SUSCAN_INSPECTOR_AUDIO_DEMOD_LSB) {
-      f_edge = channel.offset + channel.bandwidth / 2;
+      f_edge = channel.loFreq + channel.bandwidth / 2;
+      m_loShift = f_edge - bw_new / 2 - channel.loFreq;
       m_analyzer->setInspectorFreq(m_handle, f_edge - bw_new / 2);
       m_analyzer->setInspectorBandwidth(m_handle, bw_new);
     }
@@ -234,6 +798,18 @@ ZeroMQConsumer::opened(
     m_analyzer->setInspectorWatermark(m_handle, calcBufLen());
   }
 
+  {
+    std::lock_guard<std::mutex> guard(m_outputMutex);
+    for (auto &p : m_extraOutputs)
+      p.suppressed = 0;
+    if (!m_extraOutputs.empty())
+      buildCascade();
+    m_opened = true;
+  }
+
+  if (m_udp != nullptr)
+    m_udp->start(m_outRate);
+
   fileString = QString::fromStdString(m_channelType) + "_" + QString::number(m_sampRate) + ".raw";
   file = fileString.toStdString();
 
@@ -243,14 +819,80 @@ ZeroMQConsumer::opened(
 void
 ZeroMQConsumer::samples(const SUCOMPLEX *samples, SUSCOUNT size)
 {
-  m_zmq_sink->write(
-        m_topic.c_str(),
-        static_cast<unsigned>(m_sampRate),
-        samples,
-        size,
-        m_mask);
+  // Paused channels keep their inspector, but nothing is published
+  if (!isEnabled())
+    return;
+
+  if (m_resampler != nullptr) {
+    m_resampler->process(samples, size);
+    samples = m_resampler->output();
+    size    = m_resampler->size();
+
+    if (size == 0)
+      return;
+  }
+
+  publish(samples, size);
+
+  // Same squelch as the main topic, without pre-roll. What it holds back
+  // is reported in a gap marker when it opens again.
+  if (m_udp != nullptr) {
+    if (m_squelchOpen)
+      m_udp->samples(samples, size);
+    else
+      m_udp->skip(size);
+  }
+
   if (m_fp != nullptr)
     fwrite(samples, size * sizeof(SUCOMPLEX), 1, m_fp);
+
+  writeExtraOutputs(samples, size);
+}
+
+//
+// Samples lost before reaching this consumer, at the channel rate. Gaps
+// are reported like the ones of the squelch: right away while it is open,
+// when it opens again otherwise. The pre-roll held so far is no longer
+// contiguous with what comes next, so it goes into the gap too.
+//
+void
+ZeroMQConsumer::dropped(SUSCOUNT size)
+{
+  SUFLOAT inRate = m_resampler != nullptr ? m_resampler->inRate() : m_outRate;
+  unsigned int rate = static_cast<unsigned>(m_outRate);
+  uint64_t count;
+
+  if (!isEnabled() || inRate <= 0)
+    return;
+
+  count = static_cast<uint64_t>(size * m_outRate / inRate);
+  if (count == 0)
+    return;
+
+  if (m_squelchOpen) {
+    m_zmq_sink->writeGap(m_topic.c_str(), rate, count);
+  } else {
+    m_suppressed += m_prerollSize + count;
+    m_prerollSize = 0;
+    m_preroll.clear();
+  }
+
+  if (m_udp != nullptr)
+    m_udp->skip(count);
+
+  std::lock_guard<std::mutex> guard(m_outputMutex);
+
+  for (auto &p : m_extraOutputs) {
+    uint64_t extra = static_cast<uint64_t>(count * p.rate / m_outRate);
+
+    if (m_squelchOpen)
+      m_zmq_sink->writeGap(
+            p.topic.c_str(),
+            static_cast<unsigned>(p.rate),
+            extra);
+    else
+      p.suppressed += extra;
+  }
 }
 
 void
@@ -259,28 +901,191 @@ ZeroMQConsumer::closed()
   if (m_fp != nullptr)
     fclose(m_fp);
 
+  if (m_resampler != nullptr)
+    delete m_resampler;
+
+  {
+    std::lock_guard<std::mutex> guard(m_outputMutex);
+    clearCascade();
+    m_opened = false;
+  }
+
+  if (m_udp != nullptr)
+    m_udp->closed();
+
   m_analyzer = nullptr;
+  m_resampler = nullptr;
   m_fp = nullptr;
 }
 
 void
-ZeroMQConsumer::enableStateChanged(bool state)
-{
-  if (m_analyzer != nullptr) {
-    uint64_t demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_DISABLED;
-
-    if (state) {
-      if (m_channelType == "audio:fm")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_FM;
-      else if (m_channelType == "audio:am")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_AM;
-      else if (m_channelType == "audio:usb")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_USB;
-      else if (m_channelType == "audio:lsb")
-        demod = SUSCAN_INSPECTOR_AUDIO_DEMOD_LSB;
-    }
+ZeroMQConsumer::retuned(
+    Suscan::Analyzer *analyzer,
+    Suscan::Handle handle,
+    ChannelDescription const &channel)
+{
+  // Keep the SSB filter displacement we applied when the channel was opened
+  analyzer->setInspectorFreq(handle, channel.loFreq + m_loShift);
+}
 
-    m_config.set("audio.demodulator", demod);
-    m_analyzer->setInspectorConfig(m_handle, m_config);
+void
+ZeroMQConsumer::enableStateChanged(bool)
+{
+  // Warm standby: samples() drops everything while disabled. The
+  // demodulator is turned off later, in syncEnableState(), so that
+  // quick toggles do not cost a configuration message each.
+}
+
+bool
+ZeroMQConsumer::syncEnableState(bool inUse)
+{
+  if (m_analyzer == nullptr || !m_audio || m_appliedEnabled == inUse)
+    return false;
+
+  m_config.set("audio.demodulator", demodulator(inUse));
+  m_analyzer->setInspectorConfig(m_handle, m_config);
+  m_appliedEnabled = inUse;
+
+  return true;
+}
+
+///////////////////////////// Spectrum consumer /////////////////////////////
+ZeroMQSpectrumConsumer::ZeroMQSpectrumConsumer(
+    ZeroMQSink *sink,
+    std::string const &master)
+{
+  m_zmq_sink = sink;
+  m_topic    = master + "_psd";
+}
+
+std::string const &
+ZeroMQSpectrumConsumer::topic() const
+{
+  return m_topic;
+}
+
+void
+ZeroMQSpectrumConsumer::spectrum(
+    SUFREQ center,
+    SUFLOAT sampRate,
+    const SUFLOAT *psd,
+    unsigned int bins)
+{
+  m_zmq_sink->writeSpectrum(
+        m_topic.c_str(),
+        static_cast<unsigned>(sampRate),
+        center,
+        psd,
+        bins);
+}
+
+////////////////////////////// Master consumer //////////////////////////////
+ZeroMQMasterConsumer::ZeroMQMasterConsumer(
+    ZeroMQSink *sink,
+    std::string const &master,
+    ZeroMQSampleFormat format)
+{
+  m_zmq_sink = sink;
+  m_topic    = master + "_iq";
+  m_format   = format;
+}
+
+ZeroMQSampleFormat
+ZeroMQMasterConsumer::format() const
+{
+  return m_format;
+}
+
+const char *
+ZeroMQMasterConsumer::formatName(ZeroMQSampleFormat format)
+{
+  switch (format) {
+    case ZEROMQ_FORMAT_FLOAT32:
+      return "float32";
+
+    default:
+      return "int16";
   }
 }
+
+bool
+ZeroMQMasterConsumer::formatFromName(
+    std::string const &name,
+    ZeroMQSampleFormat &format)
+{
+  if (name == "" || name == "int16")
+    format = ZEROMQ_FORMAT_INT16;
+  else if (name == "float32")
+    format = ZEROMQ_FORMAT_FLOAT32;
+  else
+    return false;
+
+  return true;
+}
+
+void
+ZeroMQMasterConsumer::opened(
+    Suscan::Analyzer *,
+    Suscan::Handle,
+    ChannelDescription const &channel,
+    Suscan::Config const &)
+{
+  m_sampRate = channel.sampRate;
+}
+
+void
+ZeroMQMasterConsumer::samples(const SUCOMPLEX *samples, SUSCOUNT size)
+{
+  unsigned int rate = static_cast<unsigned>(m_sampRate);
+
+  static_assert(
+        sizeof(SUCOMPLEX) == 2 * sizeof(float),
+        "float32 IQ is sent without conversion");
+
+  if (!isEnabled())
+    return;
+
+  if (m_format == ZEROMQ_FORMAT_FLOAT32)
+    m_zmq_sink->send(
+          m_topic.c_str(),
+          rate | ZEROMQ_FLOAT_FLAG,
+          samples,
+          size * sizeof(SUCOMPLEX));
+  else
+    m_zmq_sink->write(
+          m_topic.c_str(),
+          rate,
+          samples,
+          size,
+          ZEROMQ_DELIVER_COMPLEX);
+}
+
+void
+ZeroMQMasterConsumer::dropped(SUSCOUNT size)
+{
+  if (isEnabled())
+    m_zmq_sink->writeGap(
+          m_topic.c_str(),
+          static_cast<unsigned>(m_sampRate),
+          size);
+}
+
+void
+ZeroMQMasterConsumer::closed()
+{
+}
+
+void
+ZeroMQMasterConsumer::enableStateChanged(bool)
+{
+}
+
+bool
+ZeroMQMasterConsumer::canUpdateFrom(ChannelConsumer const &consumer) const
+{
+  auto other = dynamic_cast<const ZeroMQMasterConsumer *>(&consumer);
+
+  return other != nullptr
+      && other->m_topic == m_topic
+      && other->m_format == m_format;
+}
@@ -21,10 +21,16 @@
 #define ZEROMQSINK_H
 
 #include <MultiChannelForwarder.h>
+#include <Resampler.h>
 #include <string>
 #include <vector>
 #include <zmq.hpp>
 #include <cstdio>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+class UdpConsumer;
 
 enum ZeroMQDeliveryMask {
   ZEROMQ_DELIVER_REAL = 1,
@@ -32,15 +38,66 @@ enum ZeroMQDeliveryMask {
   ZEROMQ_DELIVER_COMPLEX = 3
 };
 
+// Set in the rate frame of gap markers. Their payload is the number of
+// samples suppressed by the squelch or lost on the way to the consumer
+// (uint64_t) instead of samples.
+#define ZEROMQ_GAP_FLAG 0x80000000u
+
+// Set in the rate frame of master spectra (<master>_psd). Their payload is
+// the center frequency (double, Hz) followed by the bins (float, dB),
+// lowest frequency first.
+#define ZEROMQ_SPECTRUM_FLAG 0x40000000u
+
+// Set in the rate frame of float32 IQ (interleaved I and Q)
+#define ZEROMQ_FLOAT_FLAG 0x20000000u
+
+enum ZeroMQSampleFormat {
+  ZEROMQ_FORMAT_INT16,
+  ZEROMQ_FORMAT_FLOAT32
+};
+
+enum ZeroMQSquelch {
+  ZEROMQ_SQUELCH_OFF,
+  ZEROMQ_SQUELCH_ENERGY, // Level is absolute, in dBFS
+  ZEROMQ_SQUELCH_SNR     // Level is relative to the noise floor, in dB
+};
+
 class ZeroMQSink {
   bool m_state = false;
   zmq::context_t m_zmq_ctx;
   zmq::socket_t *m_zmq_socket = nullptr;
-
-  std::vector<int16_t> m_sampleBuffer;
+  std::mutex m_mutex; // Sockets are not thread safe
+  std::vector<int> m_ioCpus;
+  bool m_ctxDirty = false; // I/O affinity changed since the context started
 
 public:
+  // CPUs of the ZeroMQ I/O thread. Takes effect on the next bind().
+  // Needs ZMQ_THREAD_AFFINITY_CPU_ADD, which is part of the draft API of
+  // libzmq: returns false (and is ignored) if it is not available.
+  static bool ioAffinitySupported();
+  bool setIoAffinity(std::vector<int> const &);
   bool bind(const char *url);
+
+  // Converts to int16 and returns the mean power of the delivered part,
+  // computed in the same pass.
+  SUFLOAT convert(
+      const SUCOMPLEX *samples,
+      SUSCOUNT size,
+      ZeroMQDeliveryMask mask,
+      std::vector<int16_t> &);
+  bool send(
+      const char *topic,
+      uint32_t sampleRate,
+      const void *data,
+      size_t bytes);
+  bool writeGap(const char *topic, unsigned int sampleRate, uint64_t count);
+  bool writeSpectrum(
+      const char *topic,
+      unsigned int sampleRate,
+      SUFREQ center,
+      const SUFLOAT *psd,
+      unsigned int bins);
+
   bool write(
       const char *topic,
       unsigned int sampleRate,
@@ -51,34 +108,153 @@ public:
   ~ZeroMQSink();
 };
 
+//
+// Additional rate published by a channel, under its own topic
+// (<topic>_<rate>). It is taken from the half-band cascade at the stage
+// closest to (and above) the desired rate, and resampled from there if
+// the rate is not a power-of-two fraction of the channel rate.
+//
+struct ZeroMQExtraOutput {
+  SUFLOAT      rate;
+  unsigned int stage = 0;
+  std::string  topic;
+  Resampler   *resampler = nullptr;
+  uint64_t     suppressed = 0; // Held back by the squelch since the last gap
+};
+
 class ZeroMQConsumer : public ChannelConsumer
 {
   SUFLOAT m_sampRate = 0;
+  SUFLOAT m_reqRate = 0; // As requested (0: whatever the channel gives)
+  SUFLOAT m_outRate = 0; // Rate of the published samples
+  Resampler *m_resampler = nullptr; // From the channel rate to m_sampRate
+  std::vector<ZeroMQExtraOutput> m_extraOutputs;
+  std::vector<HalfBandDecimator *> m_cascade; // Shared by m_extraOutputs
+  mutable std::mutex m_outputMutex; // Extra outputs can be added while open
+  bool m_opened = false; // Between opened() and closed(), under m_outputMutex
+
+  // Squelch. Settings may change at any time, the state belongs to the
+  // thread delivering the samples.
+  std::atomic<int> m_squelchMode{ZEROMQ_SQUELCH_OFF};
+  std::atomic<SUFLOAT> m_squelchLevel{0};
+  bool m_squelchOpen = true;
+  SUSCOUNT m_hangover = 0;    // Samples left before closing
+  SUFLOAT m_noiseFloor = 0;
+  uint64_t m_suppressed = 0;  // Samples not sent since the last gap marker
+  std::deque<std::vector<int16_t>> m_preroll;
+  SUSCOUNT m_prerollSize = 0; // In samples
+  std::vector<int16_t> m_converted;
   std::string m_channelType;
   std::string m_topic;
   ZeroMQSink *m_zmq_sink = nullptr;
   ZeroMQDeliveryMask m_mask;
   FILE *m_fp = nullptr;
+  UdpConsumer *m_udp = nullptr; // Main output, also sent over UDP
   Suscan::Config m_config;
-  Suscan::Analyzer *m_analyzer;
+  Suscan::Analyzer *m_analyzer = nullptr;
   Suscan::Handle m_handle;
+  SUFREQ m_loShift = 0; // SSB filter displacement w.r.t. the channel LO
+  bool m_audio = false;
+  bool m_appliedEnabled = true; // Enable state last pushed to the inspector
   unsigned int calcBufLen() const;
+  uint64_t demodulator(bool enabled) const;
+  void setInputRate(SUFLOAT);
+  void buildCascade();
+  void clearCascade();
+  void writeExtraOutputs(const SUCOMPLEX *, SUSCOUNT);
+  void publish(const SUCOMPLEX *, SUSCOUNT);
+  bool squelchActive(ZeroMQSquelch, SUFLOAT power, SUSCOUNT);
 
 public:
   ZeroMQConsumer(ZeroMQSink *, const char *type, SUFLOAT audioSampRate);
   SUFLOAT getSampRate() const;
   std::string getChannelType() const;
 
+  bool addOutputRate(SUFLOAT);
+  std::vector<SUFLOAT> getOutputRates() const;
+
+  // UDP destinations of the main output (see UdpConsumer). Only before
+  // the channel is opened.
+  bool addUdpDestination(std::string const &);
+  std::vector<std::string> getUdpDestinations() const;
+  void setUdpTtl(int);
+  int getUdpTtl() const;
+
+  void setSquelch(ZeroMQSquelch, SUFLOAT level);
+  ZeroMQSquelch getSquelch() const;
+  SUFLOAT getSquelchLevel() const;
+  static const char *squelchName(ZeroMQSquelch);
+  static bool squelchFromName(std::string const &, ZeroMQSquelch &);
+
   virtual void opened(
       Suscan::Analyzer *,
       Suscan::Handle,
       ChannelDescription const &,
       Suscan::Config const &) override;
   virtual void samples(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
   virtual void closed() override;
   virtual void enableStateChanged(bool) override;
+  virtual bool syncEnableState(bool) override;
+  virtual void retuned(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &) override;
+  virtual ChannelDemodulator channelDemodulator() const override;
+  virtual bool canUpdateFrom(ChannelConsumer const &) const override;
+  virtual void updateFrom(ChannelConsumer const &) override;
+  virtual bool configuresInspector() const override;
+  virtual bool sharesInspectorWith(ChannelConsumer const &) const override;
 
   virtual ~ZeroMQConsumer();
 };
 
+class ZeroMQSpectrumConsumer : public SpectrumConsumer
+{
+  ZeroMQSink *m_zmq_sink;
+  std::string m_topic;
+
+public:
+  ZeroMQSpectrumConsumer(ZeroMQSink *, std::string const &master);
+  std::string const &topic() const;
+
+  virtual void spectrum(
+      SUFREQ center,
+      SUFLOAT sampRate,
+      const SUFLOAT *psd,
+      unsigned int bins) override;
+};
+
+//
+// Raw IQ of a whole master, published under <master>_iq at the rate of
+// its tap, for external channelizers.
+//
+class ZeroMQMasterConsumer : public ChannelConsumer
+{
+  ZeroMQSink *m_zmq_sink;
+  std::string m_topic;
+  ZeroMQSampleFormat m_format;
+  SUFLOAT m_sampRate = 0;
+
+public:
+  ZeroMQMasterConsumer(
+      ZeroMQSink *,
+      std::string const &master,
+      ZeroMQSampleFormat);
+  ZeroMQSampleFormat format() const;
+  static const char *formatName(ZeroMQSampleFormat);
+  static bool formatFromName(std::string const &, ZeroMQSampleFormat &);
+
+  virtual void opened(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &,
+      Suscan::Config const &) override;
+  virtual void samples(const SUCOMPLEX *, SUSCOUNT) override;
+  virtual void dropped(SUSCOUNT) override;
+  virtual void closed() override;
+  virtual void enableStateChanged(bool) override;
+  virtual bool canUpdateFrom(ChannelConsumer const &) const override;
+};
+
 #endif // ZEROMQSINK_H
@@ -26,15 +26,42 @@
 #include <AddChanDialog.h>
 #include <AddMasterDialog.h>
 #include <QMessageBox>
+#include <Suscan/Library.h>
 #include <ZeroMQSink.h>
 #include <SettingsManager.h>
+#include <SpectrumMonitor.h>
+#include <Affinity.h>
+#include <ControlServer.h>
 #include <QFileDialog>
 #include <QDir>
+#include <QTimer>
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QMenu>
+#include <QJsonObject>
+#include <QJsonArray>
 #include <UIMediator.h>
 #include <MainSpectrum.h>
+#include <algorithm>
 
 using namespace SigDigger;
 
+// Width of the region around the tuner frequency that placement avoids
+// when the channel plan asks for DC bias correction.
+#define ZEROMQ_DC_GUARD_BW 5e3
+
+// Time a disable waits before reaching the inspector (enables are applied
+// immediately). Channels toggled off and on again within this time cost no
+// messages at all.
+#define ZEROMQ_SYNC_ENABLE_DELAY_MS 2000
+
+// Minimum time between two LO updates while the tuner is moving
+#define ZEROMQ_RETUNE_INTERVAL_MS 50
+
+// Editors often save a file in several writes (or replace it). The watched
+// channel file is reloaded once it has been quiet for this long.
+#define ZEROMQ_RELOAD_DELAY_MS 500
+
 #define STRINGFY(x) #x
 #define STORE(field) obj.set(STRINGFY(field), this->field)
 #define LOAD(field) this->field = conf.get(STRINGFY(field), this->field)
@@ -48,6 +75,14 @@ ZeroMQWidgetConfig::deserialize(Suscan::Object const &conf)
   LOAD(trackTuner);
   LOAD(zmqURL);
   LOAD(startPublish);
+  LOAD(consumerCpus);
+  LOAD(workerCpus);
+  LOAD(zmqCpus);
+  LOAD(watchPlan);
+  LOAD(planFile);
+  LOAD(controlURL);
+  LOAD(extraSources);
+  LOAD(topology);
 }
 
 Suscan::Object &&
@@ -61,6 +96,14 @@ ZeroMQWidgetConfig::serialize()
   STORE(trackTuner);
   STORE(zmqURL);
   STORE(startPublish);
+  STORE(consumerCpus);
+  STORE(workerCpus);
+  STORE(zmqCpus);
+  STORE(watchPlan);
+  STORE(planFile);
+  STORE(controlURL);
+  STORE(extraSources);
+  STORE(topology);
 
   return persist(obj);
 }
@@ -79,6 +122,7 @@ ZeroMQWidget::ZeroMQWidget(
   m_forwarder = new MultiChannelForwarder();
   m_treeModel = new MultiChannelTreeModel(m_forwarder);
   m_smanager  = new SettingsManager(this);
+  m_plan      = new ChannelPlan;
 
   m_ui->treeView->setModel(m_treeModel);
 
@@ -87,11 +131,29 @@ ZeroMQWidget::ZeroMQWidget(
 
   m_zmqSink = new ZeroMQSink();
 
+  m_syncTimer = new QTimer(this);
+  m_syncTimer->setSingleShot(true);
+  m_syncTimer->setInterval(ZEROMQ_SYNC_ENABLE_DELAY_MS);
+
+  m_retuneTimer = new QTimer(this);
+  m_retuneTimer->setSingleShot(true);
+  m_retuneTimer->setInterval(ZEROMQ_RETUNE_INTERVAL_MS);
+
+  m_planWatcher = new QFileSystemWatcher(this);
+  m_reloadTimer = new QTimer(this);
+  m_reloadTimer->setSingleShot(true);
+  m_reloadTimer->setInterval(ZEROMQ_RELOAD_DELAY_MS);
+
+  m_control = new ControlServer(this);
+
+  m_ui->treeView->setContextMenuPolicy(Qt::CustomContextMenu);
+
   assertConfig();
 
   setProperty("collapsed", m_panelConfig->collapsed);
 
   refreshUi();
+  refreshRetuneStats();
 
   connectAll();
 }
@@ -101,6 +163,10 @@ ZeroMQWidget::~ZeroMQWidget()
   delete m_ui;
   delete m_forwarder;
   delete m_zmqSink;
+  delete m_plan;
+
+  for (auto analyzer : m_extraAnalyzers)
+    delete analyzer;
 }
 
 // LO has changed. We have two choices here:
@@ -126,24 +192,13 @@ ZeroMQWidget::checkRecentering()
     m_lastTunerFrequency = info.getFrequency();
   }
 
-  if (m_forwarder->isOpen()) {
+  if (m_forwarder->isPartiallyOpen()) {
     if (m_ui->trackTunerCheck->isChecked()) {
-      // TRACK TUNER
-      if (!m_forwarder->canOpen()) {
-        m_ui->togglePublishingButton->setChecked(false);
-        checkStartStop();
-
-        QMessageBox::warning(
-              this,
-              "Channels out of limits",
-              "Multichannel forwarder was automatically disabled, as the current source "
-              "frequency and sample rate cannot keep all channels opened at the same time. "
-              "You can open the channels again by recentering the source frequency to "
-              "a value close to "
-              + SuWidgetsHelpers::formatQuantity(m_forwarder->getCenter(), "Hz"));
-      } else {
-        m_forwarder->adjustLo();
-      }
+      // TRACK TUNER: masters that fell outside the passband are suspended
+      // and reopened automatically once the tuner gets back to them. The
+      // rest keep streaming.
+      if (m_forwarder->retune())
+        refreshUi();
     } else {
       // NO TRACK TUNER
       lagNamedChannels();
@@ -151,6 +206,44 @@ ZeroMQWidget::checkRecentering()
   }
 }
 
+// Frequency changes may come in bursts (spectrum drags, sweeps). The first
+// change of a burst is applied right away, the rest are folded into one
+// update per ZEROMQ_RETUNE_INTERVAL_MS. LO targets are still recorded for
+// every change so that the statistics reflect what we saved.
+void
+ZeroMQWidget::scheduleRecentering()
+{
+  if (m_retuneTimer->isActive()) {
+    m_retunePending = true;
+
+    if (m_forwarder->isPartiallyOpen() && m_ui->trackTunerCheck->isChecked())
+      m_forwarder->adjustLo();
+
+    return;
+  }
+
+  checkRecentering();
+  m_forwarder->flushLo();
+  refreshRetuneStats();
+
+  m_retuneTimer->start();
+}
+
+void
+ZeroMQWidget::refreshRetuneStats()
+{
+  RetuneStats stats = m_forwarder->retuneStats();
+  uint64_t saved = stats.requested > stats.sent
+      ? stats.requested - stats.sent
+      : 0;
+
+  m_ui->retuneStatsLabel->setText(
+        QString::number(stats.sent)
+        + " sent, "
+        + QString::number(saved)
+        + " saved");
+}
+
 void
 ZeroMQWidget::applySpectrumState()
 {
@@ -252,12 +345,60 @@ ZeroMQWidget::connectAll()
         this,
         SLOT(onFileMakeMaster(QString,double,float,bool)));
 
+  connect(
+        m_smanager,
+        SIGNAL(setMasterEngine(QString,QString,float)),
+        this,
+        SLOT(onFileSetMasterEngine(QString,QString,float)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setMasterActivity(QString,float,float)),
+        this,
+        SLOT(onFileSetMasterActivity(QString,float,float)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setMasterSpectrum(QString,qint64,float)),
+        this,
+        SLOT(onFileSetMasterSpectrum(QString,qint64,float)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setMasterIQ(QString,QString)),
+        this,
+        SLOT(onFileSetMasterIQ(QString,QString)));
+
   connect(
         m_smanager,
         SIGNAL(createVFO(QString,double,float,QString,qint64,bool)),
         this,
         SLOT(onFileMakeChannel(QString,double,float,QString,qint64,bool)));
 
+  connect(
+        m_smanager,
+        SIGNAL(setChannelRates(QString,QString)),
+        this,
+        SLOT(onFileSetChannelRates(QString,QString)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setChannelSquelch(QString,QString,float)),
+        this,
+        SLOT(onFileSetChannelSquelch(QString,QString,float)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setChannelUdp(QString,QString,qint64)),
+        this,
+        SLOT(onFileSetChannelUdp(QString,QString,qint64)));
+
+  connect(
+        m_smanager,
+        SIGNAL(setChannelPriority(QString,float)),
+        this,
+        SLOT(onFileSetChannelPriority(QString,float)));
+
   connect(
         m_ui->openButton,
         SIGNAL(clicked(bool)),
@@ -276,14 +417,58 @@ ZeroMQWidget::connectAll()
         this,
         SLOT(onToggleTrackTuner()));
 
+  connect(
+        m_ui->watchPlanCheck,
+        SIGNAL(toggled(bool)),
+        this,
+        SLOT(onToggleWatchPlan()));
+
+  connect(
+        m_planWatcher,
+        SIGNAL(fileChanged(QString)),
+        this,
+        SLOT(onPlanFileChanged()));
+
+  connect(
+        m_reloadTimer,
+        SIGNAL(timeout()),
+        this,
+        SLOT(onReloadPlan()));
+
+  // The reply is filled by the slot: it must run before command() returns
+  connect(
+        m_control,
+        SIGNAL(command(QJsonObject,QJsonObject&)),
+        this,
+        SLOT(onControlCommand(QJsonObject,QJsonObject&)),
+        Qt::DirectConnection);
+
   connect(
         m_treeModel,
         SIGNAL(dataChanged(QModelIndex,QModelIndex,QList<int>)),
         this,
         SLOT(onDataChanged(QModelIndex,QModelIndex,QList<int>)));
+
+  connect(
+        m_ui->treeView,
+        SIGNAL(customContextMenuRequested(QPoint)),
+        this,
+        SLOT(onTreeContextMenu(QPoint)));
+
+  connect(
+        m_syncTimer,
+        SIGNAL(timeout()),
+        this,
+        SLOT(onSyncEnableStates()));
+
+  connect(
+        m_retuneTimer,
+        SIGNAL(timeout()),
+        this,
+        SLOT(onRetuneTimeout()));
 }
 
-void
+bool
 ZeroMQWidget::colorizeMaster(
     std::string const &name,
     NamedChannelSetIterator &it)
@@ -294,9 +479,12 @@ ZeroMQWidget::colorizeMaster(
   QColor color;
 
   if (master != nullptr) {
-    bool opened = master->handle != SUSCAN_INVALID_HANDLE_VALUE;
+    bool opened = master->handle != SUSCAN_INVALID_HANDLE_VALUE
+        || (master->direct && master->open_count > 0);
 
-    if (!master->enabled) {
+    if (master->suspended) {
+      color = QColor(255, 64, 64);
+    } else if (!master->enabled) {
       color = opened ? QColor(0, 127, 0) : QColor(127, 127, 127);
     } else {
       color = opened ? QColor(0, 255, 0) : QColor(255, 255, 255);
@@ -305,12 +493,15 @@ ZeroMQWidget::colorizeMaster(
     color = QColor(127, 127, 127);
   }
 
+  if (namCh->markerColor == color)
+    return false;
+
   namCh->cutOffColor = namCh->markerColor = namCh->boxColor = color;
 
-  m_spectrum->refreshChannel(it);
+  return true;
 }
 
-void
+bool
 ZeroMQWidget::colorizeChannel(
     std::string const &name,
     NamedChannelSetIterator &it)
@@ -321,7 +512,7 @@ ZeroMQWidget::colorizeChannel(
   QColor color;
 
   if (chan != nullptr) {
-    bool opened = chan->handle != SUSCAN_INVALID_HANDLE_VALUE;
+    bool opened = chan->source()->handle != SUSCAN_INVALID_HANDLE_VALUE;
 
     if (!chan->consumer->isEnabled() || !chan->parent->enabled)
       color = opened ? QColor(127, 82, 0) : QColor(100, 100, 100);
@@ -331,9 +522,12 @@ ZeroMQWidget::colorizeChannel(
     color = QColor(127, 127, 127);
   }
 
+  if (namCh->markerColor == color)
+    return false;
+
   namCh->cutOffColor = namCh->markerColor = namCh->boxColor = color;
 
-  m_spectrum->refreshChannel(it);
+  return true;
 }
 
 
@@ -365,60 +559,142 @@ ZeroMQWidget::refreshUi()
   m_ui->togglePublishingButton->setText(text);
   m_ui->togglePublishingButton->setStyleSheet(style);
 
-  for (auto p = m_masterMarkers.begin(); p != m_masterMarkers.end(); ++p)
-    colorizeMaster(p->first, p->second);
+  refreshMarkers();
+}
+
+void
+ZeroMQWidget::markMasterDirty(MasterChannel const *master, bool withChannels)
+{
+  m_dirtyMasters.insert(master->name);
+
+  if (withChannels)
+    for (auto &c : master->channels)
+      m_dirtyChannels.insert(c.name);
+}
 
-  for (auto p = m_channelMarkers.begin(); p != m_channelMarkers.end(); ++p)
-    colorizeChannel(p->first, p->second);
+void
+ZeroMQWidget::markChannelDirty(ChannelDescription const *channel)
+{
+  m_dirtyChannels.insert(channel->name);
 }
 
+// For changes that replace every entry at once (loading a file). The
+// ones made by the forwarder itself are taken from it in refreshMarkers()
 void
-ZeroMQWidget::doRemoveMaster(MasterChannel *master)
+ZeroMQWidget::markAllDirty()
+{
+  m_allMarkersDirty = true;
+}
+
+//
+// Only the markers whose color actually changed are touched, and the
+// spectrum is repainted once for all of them. Colors do not affect the
+// position of a marker in the spectrum, so refreshing any of them
+// repaints the whole set.
+//
+void
+ZeroMQWidget::refreshMarkers()
+{
+  NamedChannelSetIterator *changed = nullptr;
+
+  m_forwarder->takeChanges(m_dirtyMasters, m_dirtyChannels);
+
+  if (m_allMarkersDirty) {
+    for (auto p = m_masterMarkers.begin(); p != m_masterMarkers.end(); ++p)
+      if (colorizeMaster(p->first, p->second))
+        changed = &p->second;
+
+    for (auto p = m_channelMarkers.begin(); p != m_channelMarkers.end(); ++p)
+      if (colorizeChannel(p->first, p->second))
+        changed = &p->second;
+  } else {
+    for (auto const &name : m_dirtyMasters) {
+      auto p = m_masterMarkers.find(name);
+      if (p != m_masterMarkers.end() && colorizeMaster(p->first, p->second))
+        changed = &p->second;
+    }
+
+    for (auto const &name : m_dirtyChannels) {
+      auto p = m_channelMarkers.find(name);
+      if (p != m_channelMarkers.end() && colorizeChannel(p->first, p->second))
+        changed = &p->second;
+    }
+  }
+
+  m_allMarkersDirty = false;
+  m_dirtyMasters.clear();
+  m_dirtyChannels.clear();
+
+  if (changed != nullptr)
+    m_spectrum->refreshChannel(*changed);
+}
+
+// Markers are indexed by frequency in the spectrum, so every marker
+// that moves needs its own refresh. The ones that stay are skipped.
+bool
+ZeroMQWidget::moveMarker(NamedChannelSetIterator &it, SUFREQ frequency)
+{
+  if (it.value()->frequency == frequency)
+    return false;
+
+  it.value()->frequency = frequency;
+  m_spectrum->refreshChannel(it);
+
+  return true;
+}
+
+void
+ZeroMQWidget::removeMarkers(MasterChannel const *master)
 {
-  // Remove from markers
   auto iter = m_masterMarkers.find(master->name);
 
   if (iter != m_masterMarkers.end()) {
     m_spectrum->removeChannel(iter->second);
-    m_masterMarkers.erase(master->name);
+    m_masterMarkers.erase(iter);
   }
 
   // We also need to traverse all children belonging to this master
   // and remove them accordingly
-  for (auto i = master->channels.begin(); i != master->channels.end(); ++i) {
-    auto c = m_channelMarkers.find(i->name);
-    if (c != m_channelMarkers.end()) {
-      m_spectrum->removeChannel(c->second);
-      m_channelMarkers.erase(c->first);
-    }
+  for (auto i = master->channels.begin(); i != master->channels.end(); ++i)
+    removeMarker(&*i);
+}
+
+void
+ZeroMQWidget::removeMarker(ChannelDescription const *channel)
+{
+  auto iter = m_channelMarkers.find(channel->name);
+
+  if (iter != m_channelMarkers.end()) {
+    m_spectrum->removeChannel(iter->second);
+    m_channelMarkers.erase(iter);
   }
+}
+
+void
+ZeroMQWidget::doRemoveMaster(MasterChannel *master)
+{
+  removeMarkers(master);
+
+  // Update view, while the master still exists
+  m_treeModel->removeMaster(master);
 
   // Remove from forwarder
   m_forwarder->removeMaster(master);
 
-  // Update view
-  m_treeModel->rebuildStructure();
-  m_ui->treeView->expandAll();
   refreshUi();
 }
 
 void
 ZeroMQWidget::doRemoveChannel(ChannelDescription *channel)
 {
-  // Remove from markers
-  auto iter = m_channelMarkers.find(channel->name);
+  removeMarker(channel);
 
-  if (iter != m_channelMarkers.end()) {
-    m_spectrum->removeChannel(iter->second);
-    m_channelMarkers.erase(channel->name);
-  }
+  // Update view, while the channel still exists
+  m_treeModel->removeChannel(channel);
 
   // Remove from forwarder
   m_forwarder->removeChannel(channel);
 
-  // Update view
-  m_treeModel->rebuildStructure();
-  m_ui->treeView->expandAll();
   refreshUi();
 }
 
@@ -435,17 +711,52 @@ ZeroMQWidget::checkStartStop()
       recenterNamedChannels();
       refreshUi();
     } else {
+      bool partial = m_forwarder->canOpenAny();
+
       if (!m_forwarder->canOpen()) {
-        m_ui->togglePublishingButton->setChecked(false);
-        if (m_forwarder->canCenter()) {
-          auto freq = m_forwarder->getCenter();
+        TunerPlacement placement;
+
+        if (!partial)
+          m_ui->togglePublishingButton->setChecked(false);
+
+        if (m_forwarder->findPlacement(placement)) {
+          auto freq = placement.frequency;
+          QString details =
+              QString::number(placement.channels)
+              + " out of "
+              + QString::number(placement.totalChannels)
+              + " channels";
+
+          if (!m_forwarder->canCenter())
+            details += " (the sample rate is too low to fit all of them)";
+
+          // Channels with different priorities: say how much of the
+          // total weight is kept
+          if (placement.maxScore != placement.totalChannels)
+            details += " ("
+                + QString::number(
+                  qRound(100 * placement.score / placement.maxScore))
+                + "% of the total priority)";
+
+          if (placement.nearDc > 0)
+            details += ", leaving "
+                + QString::number(placement.nearDc)
+                + " channel(s) out to avoid the DC spike";
+
           auto answer = QMessageBox::question(
                 this,
                 "ZeroMQ forwarder",
-                "ZeroMQ forwarder was disabled because some of the channels fall outside of the current portion of the spectrum. "
-                "Do you want to attempt to shift the current spectrum to the optimal center frequency "
+                (partial
+                 ? "Some of the master channels fall outside of the current portion of the spectrum "
+                   "and will remain suspended until the tuner gets back to them. "
+                 : "ZeroMQ forwarder was disabled because all of the channels fall outside of the current portion of the spectrum. ")
+                + QString(
+                  "Do you want to attempt to shift the current spectrum to the optimal center frequency ")
                   + SuWidgetsHelpers::formatQuantity(freq, "Hz")
-                  + " before trying again?",
+                  + (partial ? "" : " before trying again")
+                  + "? This placement keeps "
+                  + details
+                  + ".",
                 QMessageBox::Yes | QMessageBox::No);
           if (answer == QMessageBox::Yes) {
             try {
@@ -463,17 +774,23 @@ ZeroMQWidget::checkStartStop()
           QMessageBox::warning(
                 this,
                 "ZeroMQ forwarder",
-                "ZeroMQ forwarder was disabled because the sample rate is too low "
-                "to keep all channels opened at the same time. Note that the current channel "
+                (partial
+                 ? QString("Some of the master channels will remain suspended because the sample rate is too low ")
+                 : QString("ZeroMQ forwarder was disabled because the sample rate is too low "))
+                + "to keep all channels opened at the same time. Note that the current channel "
                 "configuration requires a a sample rate of at least "
                 + SuWidgetsHelpers::formatQuantity(m_forwarder->span(), "sps")
                 + ".");
         }
-      } else {
-        // Open All: use this as reference frequency
+      }
+
+      if (partial && m_ui->togglePublishingButton->isChecked()) {
+        // Open All: use this as reference frequency. Masters outside the
+        // passband are left suspended.
         Suscan::AnalyzerSourceInfo info = m_analyzer->getSourceInfo();
         m_lastRefFrequency = info.getFrequency();
         m_forwarder->openAll();
+        refreshUi();
       }
     }
   }
@@ -493,23 +810,21 @@ ZeroMQWidget::lagNamedChannels()
       auto master = *i;
       auto marker = m_masterMarkers.find(master->name);
 
-      if (marker != m_masterMarkers.end()) {
-        auto it = marker->second;
-        it.value()->frequency = master->frequency + diffFreq;
-        m_spectrum->refreshChannel(it);
-        m_masterMarkers[master->name] = it;
-      }
+      // Opened on an extra source: the main tuner does not move it
+      if (master->analyzer != nullptr && master->analyzer != m_analyzer)
+        continue;
+
+      if (marker != m_masterMarkers.end())
+        moveMarker(marker->second, master->frequency + diffFreq);
 
       for (auto j = master->channels.begin(); j != master->channels.end(); ++j) {
         auto marker = m_channelMarkers.find(j->name);
         auto channel = &*j;
 
-        if (marker != m_channelMarkers.end()) {
-          auto it = marker->second;
-          it.value()->frequency = master->frequency + channel->offset + diffFreq;
-          m_spectrum->refreshChannel(it);
-          m_channelMarkers[channel->name] = it;
-        }
+        if (marker != m_channelMarkers.end())
+          moveMarker(
+                marker->second,
+                master->frequency + channel->offset + diffFreq);
       }
     }
   }
@@ -522,70 +837,82 @@ ZeroMQWidget::recenterNamedChannels()
     auto master = *i;
     auto marker = m_masterMarkers.find(master->name);
 
-    if (marker != m_masterMarkers.end()) {
-      auto it = marker->second;
-      it.value()->frequency = master->frequency;
-      m_spectrum->refreshChannel(it);
-      m_masterMarkers[master->name] = it;
-    }
+    if (marker != m_masterMarkers.end())
+      moveMarker(marker->second, master->frequency);
 
     for (auto j = master->channels.begin(); j != master->channels.end(); ++j) {
       auto marker = m_channelMarkers.find(j->name);
       auto channel = &*j;
 
-      if (marker != m_channelMarkers.end()) {
-        auto it = marker->second;
-        it.value()->frequency = master->frequency + channel->offset;
-        m_spectrum->refreshChannel(it);
-        m_channelMarkers[channel->name] = it;
-      }
+      if (marker != m_channelMarkers.end())
+        moveMarker(marker->second, master->frequency + channel->offset);
     }
   }
 }
 
+NamedChannelSetIterator
+ZeroMQWidget::addMasterMarker(
+    QString qName,
+    SUFREQ frequency,
+    SUFLOAT bandwidth,
+    bool refresh)
+{
+  NamedChannelSetIterator it =
+      m_spectrum->addChannel(
+        qName,
+        frequency,
+        - bandwidth / 2,
+        + bandwidth / 2,
+        QColor(127, 127, 127),
+        QColor(127, 127, 127),
+        QColor(127, 127, 127));
+  it.value()->bandLike = true;
+  m_masterMarkers[qName.toStdString()] = it;
+
+  if (refresh)
+    m_spectrum->refreshChannel(it);
+
+  return it;
+}
+
 bool
 ZeroMQWidget::doAddMaster(
     QString qName,
     SUFREQ frequency,
     SUFLOAT bandwidth,
     bool enabled,
-    bool refresh)
+    bool refresh,
+    QString *error)
 {
   std::string name = qName.toStdString();
+
+  m_forwarder->clearErrors();
   MasterChannel *master = m_forwarder->makeMaster(
         name.c_str(),
         frequency,
         bandwidth);
 
-  master->setEnabled(enabled);
-
   if (master == nullptr) {
-    QString error = QString::fromStdString(m_forwarder->getErrors());
+    QString errors = QString::fromStdString(m_forwarder->getErrors());
 
-    QMessageBox::warning(
-          this,
-          "Failed to create master",
-          "Master channel creation failed: " + error);
+    if (error != nullptr)
+      *error = errors;
+    else
+      QMessageBox::warning(
+            this,
+            "Failed to create master",
+            "Master channel creation failed: " + errors);
 
     return false;
   }
 
-  NamedChannelSetIterator it =
-      m_spectrum->addChannel(
-        qName,
-        frequency,
-        - bandwidth / 2,
-        + bandwidth / 2,
-        QColor(127, 127, 127),
-        QColor(127, 127, 127),
-        QColor(127, 127, 127));
-  it.value()->bandLike = true;
-  m_masterMarkers[name] = it;
-  m_spectrum->refreshChannel(it);
+  master->setEnabled(enabled);
+  addMasterMarker(qName, frequency, bandwidth);
 
   if (refresh) {
-    m_treeModel->rebuildStructure();
-    m_ui->treeView->expandAll();
+    m_treeModel->addMaster(master);
+    m_ui->treeView->expand(m_treeModel->masterIndex(master));
+    markMasterDirty(master);
     refreshUi();
   }
 
@@ -595,7 +922,13 @@ ZeroMQWidget::doAddMaster(
 bool
 ZeroMQWidget::doRemoveAll()
 {
+  // The tree must not point to the entries about to be freed, not even
+  // while the message box below runs its event loop
+  m_treeModel->reset();
+
   if (!m_forwarder->removeAll()) {
+    m_treeModel->rebuildStructure();
+    m_ui->treeView->expandAll();
     QMessageBox::critical(
           this,
           "Cannot clear channel list",
@@ -615,6 +948,33 @@ ZeroMQWidget::doRemoveAll()
   return true;
 }
 
+NamedChannelSetIterator
+ZeroMQWidget::addChannelMarker(
+    QString qName,
+    SUFREQ frequency,
+    SUFLOAT bandwidth,
+    bool refresh)
+{
+  NamedChannelSetIterator it =
+      m_spectrum->addChannel(
+        qName,
+        frequency,
+        - bandwidth / 2,
+        + bandwidth / 2,
+        QColor(127, 127, 127),
+        QColor(127, 127, 127),
+        QColor(127, 127, 127));
+  it.value()->bandLike = false;
+  it.value()->nestLevel = 1;
+
+  m_channelMarkers[qName.toStdString()] = it;
+
+  if (refresh)
+    m_spectrum->refreshChannel(it);
+
+  return it;
+}
+
 bool
 ZeroMQWidget::doAddChannel(
     QString qName,
@@ -623,12 +983,15 @@ ZeroMQWidget::doAddChannel(
     QString qChanType,
     qint64 sampleRate,
     bool enabled,
-    bool refresh)
+    bool refresh,
+    QString *error)
 {
   std::string chanType = qChanType.toStdString();
   std::string inspClass = chanType == "raw" ? "raw" : "audio";
   unsigned int sampRate = static_cast<unsigned>(sampleRate);
   std::string name = qName.toStdString();
+  ChannelConsumer *consumer =
+      new ZeroMQConsumer(m_zmqSink, chanType.c_str(), sampRate);
 
   m_forwarder->clearErrors();
   ChannelDescription *channel = m_forwarder->makeChannel(
@@ -636,44 +999,293 @@ ZeroMQWidget::doAddChannel(
         frequency,
         bandwidth,
         inspClass.c_str(),
-        new ZeroMQConsumer(m_zmqSink, chanType.c_str(), sampRate));
-
-  channel->consumer->setEnabled(enabled);
+        consumer);
 
   if (channel == nullptr) {
-    QString error = QString::fromStdString(m_forwarder->getErrors());
+    QString errors = QString::fromStdString(m_forwarder->getErrors());
 
-    QMessageBox::warning(
-          this,
-          "Failed to create channel",
-          "Channel creation failed: " + error);
+    delete consumer;
+
+    if (error != nullptr)
+      *error = errors;
+    else
+      QMessageBox::warning(
+            this,
+            "Failed to create channel",
+            "Channel creation failed: " + errors);
     return false;
   }
 
-  NamedChannelSetIterator it =
-      m_spectrum->addChannel(
-        qName,
-        frequency,
-        - bandwidth / 2,
-        + bandwidth / 2,
-        QColor(127, 127, 127),
-        QColor(127, 127, 127),
-        QColor(127, 127, 127));
-  it.value()->bandLike = false;
-  it.value()->nestLevel = 1;
-
-  m_channelMarkers[name] = it;
-  m_spectrum->refreshChannel(it);
+  channel->consumer->setEnabled(enabled);
+  addChannelMarker(qName, frequency, bandwidth);
 
   if (refresh) {
-    m_treeModel->rebuildStructure();
-    m_ui->treeView->expandAll();
+    m_treeModel->addChannel(channel);
+    m_ui->treeView->expand(m_treeModel->masterIndex(channel->parent));
+    markChannelDirty(channel);
     refreshUi();
   }
 
   return true;
 }
 
+//
+// Applies the channels collected while loading a file. Markers are only
+// created once the forwarder accepted the whole plan, and the spectrum is
+// repainted once.
+//
+bool
+ZeroMQWidget::doImportPlan()
+{
+  struct Marker {
+    QString name;
+    SUFREQ  frequency;
+    SUFLOAT bandwidth;
+  };
+  std::vector<Marker> masters, channels;
+  NamedChannelSetIterator last;
+  bool haveMarkers = false;
+
+  for (auto &m : m_plan->masters)
+    masters.push_back({QString::fromStdString(m.name), m.frequency, m.bandwidth});
+
+  for (auto &c : m_plan->channels)
+    channels.push_back({QString::fromStdString(c.name), c.frequency, c.bandwidth});
+
+  m_forwarder->clearErrors();
+  if (!m_forwarder->importPlan(*m_plan)) {
+    QMessageBox::warning(
+          this,
+          "Failed to load channels",
+          "The channel plan was not loaded: "
+          + QString::fromStdString(m_forwarder->getErrors()));
+    return false;
+  }
+
+  for (auto &m : masters) {
+    last = addMasterMarker(m.name, m.frequency, m.bandwidth, false);
+    haveMarkers = true;
+  }
+
+  for (auto &c : channels) {
+    last = addChannelMarker(c.name, c.frequency, c.bandwidth, false);
+    haveMarkers = true;
+  }
+
+  // Markers are not modified after being added: a single refresh is
+  // enough to repaint all of them.
+  if (haveMarkers)
+    m_spectrum->refreshChannel(last);
+
+  return true;
+}
+
+// Brings the channels to what the watched file says. Only the entries
+// that changed are closed and opened again: the rest keep streaming.
+bool
+ZeroMQWidget::doReloadPlan()
+{
+  PlanDiff diff;
+  NamedChannelSetIterator last;
+  bool haveMarkers = false;
+  bool applied;
+
+  m_plan->discard();
+  if (!m_smanager->loadSettings(m_panelConfig->planFile.c_str())) {
+    m_plan->discard();
+    return false;
+  }
+
+  m_forwarder->clearErrors();
+  if (!m_forwarder->diffPlan(*m_plan, diff)) {
+    QMessageBox::warning(
+          this,
+          "Failed to reload channels",
+          "The changes in the channel file were not applied: "
+          + QString::fromStdString(m_forwarder->getErrors()));
+    return false;
+  }
+
+  // Entries about to go are taken out of the UI while they still exist
+  for (auto channel : diff.removedChannels) {
+    removeMarker(channel);
+    m_treeModel->removeChannel(channel);
+  }
+
+  for (auto master : diff.removedMasters) {
+    removeMarkers(master);
+    m_treeModel->removeMaster(master);
+  }
+
+  applied = m_forwarder->applyPlan(*m_plan, diff);
+
+  for (auto master : diff.addedMasters) {
+    last = addMasterMarker(
+          QString::fromStdString(master->name),
+          master->frequency,
+          master->bandwidth,
+          false);
+    haveMarkers = true;
+
+    m_treeModel->addMaster(master);
+    m_ui->treeView->expand(m_treeModel->masterIndex(master));
+  }
+
+  for (auto channel : diff.addedChannels) {
+    last = addChannelMarker(
+          QString::fromStdString(channel->name),
+          channel->parent->frequency + channel->offset,
+          channel->bandwidth,
+          false);
+    haveMarkers = true;
+
+    m_treeModel->addChannel(channel);
+  }
+
+  if (haveMarkers)
+    m_spectrum->refreshChannel(last);
+
+  m_forwarder->setDcGuard(
+        m_smanager->getCorrectDC() ? ZEROMQ_DC_GUARD_BW : 0);
+
+  // Kept channels may have been enabled or disabled. Enables are applied
+  // right away, disables in a single batch later.
+  m_forwarder->syncEnableStates(false);
+  m_syncTimer->start();
+  m_ui->treeView->viewport()->update();
+
+  markAllDirty();
+  refreshUi();
+
+  // What could be created is already in place
+  if (!applied)
+    QMessageBox::warning(
+          this,
+          "Failed to reload channels",
+          "Some entries of the channel file could not be created: "
+          + QString::fromStdString(m_forwarder->getErrors()));
+
+  return true;
+}
+
+void
+ZeroMQWidget::applyWatch()
+{
+  QStringList files = m_planWatcher->files();
+
+  if (!files.isEmpty())
+    m_planWatcher->removePaths(files);
+
+  if (m_panelConfig->watchPlan && !m_panelConfig->planFile.empty())
+    m_planWatcher->addPath(QString::fromStdString(m_panelConfig->planFile));
+}
+
+void
+ZeroMQWidget::applyControl()
+{
+  m_control->unbind();
+
+  if (m_panelConfig->controlURL.empty())
+    return;
+
+  try {
+    m_control->bind(m_panelConfig->controlURL.c_str());
+  } catch (zmq::error_t &e) {
+    QMessageBox::warning(
+          this,
+          "Cannot bind control endpoint",
+          "Channels cannot be managed remotely due to ZeroMQ errors: "
+          + QString(e.what()));
+  }
+}
+
+QJsonArray
+ZeroMQWidget::listChannels() const
+{
+  QJsonArray masters;
+
+  for (auto i = m_forwarder->cbegin(); i != m_forwarder->cend(); ++i) {
+    const MasterChannel *master = *i;
+    QJsonObject m;
+    QJsonArray channels;
+
+    if (master->deleted)
+      continue;
+
+    m["name"]      = QString::fromStdString(master->name);
+    m["frequency"] = master->frequency;
+    m["bandwidth"] = master->bandwidth;
+    m["enabled"]   = master->enabled;
+    m["suspended"] = master->suspended;
+    m["open"]      = master->handle != SUSCAN_INVALID_HANDLE_VALUE
+        || (master->direct && master->open_count > 0);
+
+    // In creation order, as in the tree
+    for (auto j = master->channels.rbegin(); j != master->channels.rend(); ++j) {
+      auto consumer = static_cast<const ZeroMQConsumer *>(j->consumer);
+      QJsonObject c;
+
+      if (j->deleted)
+        continue;
+
+      c["name"]      = QString::fromStdString(j->name);
+      c["frequency"] = master->frequency + j->offset;
+      c["bandwidth"] = j->bandwidth;
+      c["type"]      = QString::fromStdString(consumer->getChannelType());
+      c["rate"]      = consumer->getSampRate();
+      c["enabled"]   = consumer->isEnabled();
+      c["priority"]  = j->priority;
+      c["open"]      = j->source()->handle != SUSCAN_INVALID_HANDLE_VALUE;
+      c["inspector"] = QString::fromStdString(j->source()->name);
+
+      QJsonArray udp;
+      for (auto &dest : consumer->getUdpDestinations())
+        udp.append(QString::fromStdString(dest));
+
+      if (!udp.isEmpty())
+        c["udp"] = udp;
+
+      channels.append(c);
+    }
+
+    m["channels"] = channels;
+    masters.append(m);
+  }
+
+  return masters;
+}
+
+QJsonObject
+ZeroMQWidget::stats() const
+{
+  RetuneStats retune = m_forwarder->retuneStats();
+  QJsonObject result;
+  unsigned int masters = 0, channels = 0;
+
+  for (auto i = m_forwarder->cbegin(); i != m_forwarder->cend(); ++i) {
+    if ((*i)->deleted)
+      continue;
+
+    ++masters;
+    for (auto &c : (*i)->channels)
+      if (!c.deleted)
+        ++channels;
+  }
+
+  result["publishing"]   = m_ui->togglePublishingButton->isChecked();
+  result["open"]         = m_forwarder->isOpen();
+  result["masters"]      = static_cast<int>(masters);
+  result["channels"]     = static_cast<int>(channels);
+  result["suspended"]    = static_cast<int>(m_forwarder->suspendedCount());
+  result["standby"]      = static_cast<int>(m_forwarder->standbyCount());
+  result["topology"]     =
+      MultiChannelForwarder::topologyName(m_forwarder->topology());
+  result["lo_requested"] = static_cast<double>(retune.requested);
+  result["lo_sent"]      = static_cast<double>(retune.sent);
+  result["dropped"]      = static_cast<double>(m_forwarder->dispatchDropped());
+
+  return result;
+}
 
 void
 ZeroMQWidget::fwdAddMaster()
@@ -712,10 +1324,167 @@ ZeroMQWidget::applyConfig()
   m_ui->urlEdit->setText(QString::fromStdString(m_panelConfig->zmqURL));
   m_ui->togglePublishingButton->setChecked(m_panelConfig->startPublish);
   m_ui->trackTunerCheck->setChecked(m_panelConfig->trackTuner);
+  m_ui->watchPlanCheck->setChecked(m_panelConfig->watchPlan);
+
+  applyAffinity();
+  applyTopology();
+  applyWatch();
+  applyControl();
+
+  // Watching: the file is the source of truth, also across restarts
+  if (m_panelConfig->watchPlan && !m_panelConfig->planFile.empty())
+    doReloadPlan();
 
   refreshUi();
 }
 
+// Unknown names fall back to the automatic choice
+void
+ZeroMQWidget::applyTopology()
+{
+  MultiChannelTopology topology;
+
+  if (!MultiChannelForwarder::topologyFromName(
+        m_panelConfig->topology,
+        topology))
+    topology = MULTI_CHANNEL_TOPOLOGY_AUTO;
+
+  m_forwarder->setTopology(topology);
+}
+
+// Lists that cannot be parsed leave the threads unrestricted
+void
+ZeroMQWidget::applyAffinity()
+{
+  std::vector<int> consumers, workers, zmq;
+
+  if (!parseCpuList(m_panelConfig->consumerCpus, consumers))
+    consumers.clear();
+
+  if (!parseCpuList(m_panelConfig->workerCpus, workers))
+    workers.clear();
+
+  if (!parseCpuList(m_panelConfig->zmqCpus, zmq))
+    zmq.clear();
+
+  m_forwarder->setAffinity(consumers, workers);
+
+  if (!m_zmqSink->setIoAffinity(zmq))
+    QMessageBox::warning(
+          this,
+          "ZeroMQ forwarder",
+          "The ZeroMQ library this plugin was built against does not "
+          "support I/O thread affinity (draft API). The ZeroMQ CPU list "
+          "is ignored.");
+}
+
+void
+ZeroMQWidget::connectAnalyzer(Suscan::Analyzer *analyzer)
+{
+  connect(
+        analyzer,
+        SIGNAL(inspector_message(Suscan::InspectorMessage)),
+        this,
+        SLOT(onInspectorMessage(Suscan::InspectorMessage)));
+
+  connect(
+        analyzer,
+        SIGNAL(psd_message(Suscan::PSDMessage)),
+        this,
+        SLOT(onPSDMessage(Suscan::PSDMessage)));
+
+  // The forwarder only queues the samples for its dispatch thread
+  connect(
+        analyzer,
+        SIGNAL(samples_message(Suscan::SamplesMessage)),
+        this,
+        SLOT(onSamplesMessage(Suscan::SamplesMessage)));
+}
+
+void
+ZeroMQWidget::openExtraAnalyzers()
+{
+  QStringList names =
+      QString::fromStdString(m_panelConfig->extraSources).split(",");
+
+  for (auto &name : names) {
+    Suscan::Source::Config *profile;
+    Suscan::Analyzer *analyzer;
+
+    if (name.trimmed().isEmpty())
+      continue;
+
+    profile = Suscan::Singleton::get()->getProfile(
+          name.trimmed().toStdString());
+
+    if (profile == nullptr) {
+      QMessageBox::warning(
+            this,
+            "ZeroMQ forwarder",
+            "Extra source profile `" + name.trimmed() + "' does not exist");
+      continue;
+    }
+
+    try {
+      Suscan::AnalyzerParams params;
+      analyzer = new Suscan::Analyzer(params, *profile);
+    } catch (Suscan::Exception const &e) {
+      QMessageBox::warning(
+            this,
+            "ZeroMQ forwarder",
+            "Cannot open extra source `" + name.trimmed() + "': "
+            + QString::fromStdString(e.what()));
+      continue;
+    }
+
+    connect(
+          analyzer,
+          SIGNAL(source_info_message(Suscan::SourceInfoMessage)),
+          this,
+          SLOT(onExtraSourceInfoMessage(Suscan::SourceInfoMessage)));
+
+    connect(
+          analyzer,
+          SIGNAL(halted()),
+          this,
+          SLOT(onExtraAnalyzerHalted()));
+
+    connect(
+          analyzer,
+          SIGNAL(eos()),
+          this,
+          SLOT(onExtraAnalyzerHalted()));
+
+    connectAnalyzer(analyzer);
+
+    m_extraAnalyzers.push_back(analyzer);
+    m_forwarder->addAnalyzer(analyzer);
+  }
+}
+
+void
+ZeroMQWidget::closeExtraAnalyzers()
+{
+  for (auto analyzer : m_extraAnalyzers) {
+    m_forwarder->removeAnalyzer(analyzer);
+    analyzer->disconnect(this);
+
+    // Messages it already posted are delivered before it goes away
+    analyzer->deleteLater();
+  }
+
+  m_extraAnalyzers.clear();
+}
+
+// Analyzer whose signal is being handled
+Suscan::Analyzer *
+ZeroMQWidget::messageAnalyzer()
+{
+  Suscan::Analyzer *analyzer = qobject_cast<Suscan::Analyzer *>(sender());
+
+  return analyzer != nullptr ? analyzer : m_analyzer;
+}
+
 bool
 ZeroMQWidget::event(QEvent *event)
 {
@@ -742,17 +1511,7 @@ ZeroMQWidget::setState(int state, Suscan::Analyzer *analyzer)
           this,
           SLOT(onSourceInfoMessage(Suscan::SourceInfoMessage)));
 
-    connect(
-          analyzer,
-          SIGNAL(inspector_message(Suscan::InspectorMessage)),
-          this,
-          SLOT(onInspectorMessage(Suscan::InspectorMessage)));
-
-    connect(
-          analyzer,
-          SIGNAL(samples_message(Suscan::SamplesMessage)),
-          this,
-          SLOT(onSamplesMessage(Suscan::SamplesMessage)));
+    connectAnalyzer(analyzer);
 
     refreshUi();
     applySpectrumState();
@@ -765,10 +1524,15 @@ ZeroMQWidget::setState(int state, Suscan::Analyzer *analyzer)
     m_analyzer = analyzer;
     m_lastTunerFrequency = INFINITY;
 
-    if (m_analyzer == nullptr)
+    if (m_analyzer == nullptr) {
+      closeExtraAnalyzers();
       recenterNamedChannels();
+    }
 
     m_forwarder->setAnalyzer(analyzer);
+
+    if (m_analyzer != nullptr && m_extraAnalyzers.empty())
+      openExtraAnalyzers();
   }
 
   refreshUi();
@@ -816,7 +1580,7 @@ ZeroMQWidget::onSpectrumLoChanged(qint64)
 void
 ZeroMQWidget::onSpectrumFrequencyChanged(qint64)
 {
-  checkRecentering();
+  scheduleRecentering();
 
   applySpectrumState();
 }
@@ -832,7 +1596,7 @@ ZeroMQWidget::onSourceInfoMessage(Suscan::SourceInfoMessage const &info)
     refreshUi();
   }
 
-  checkRecentering();
+  scheduleRecentering();
 }
 
 void
@@ -840,7 +1604,7 @@ ZeroMQWidget::onInspectorMessage(const Suscan::InspectorMessage &msg)
 {
   m_forwarder->clearErrors();
 
-  if (m_forwarder->processMessage(msg)) {
+  if (m_forwarder->processMessage(messageAnalyzer(), msg)) {
     if (m_forwarder->failed()) {
       QMessageBox::warning(
             this,
@@ -852,6 +1616,7 @@ ZeroMQWidget::onInspectorMessage(const Suscan::InspectorMessage &msg)
       recenterNamedChannels();
     }
 
+    // The forwarder reports the entries it opened or closed
     refreshUi();
   }
 }
@@ -859,7 +1624,65 @@ ZeroMQWidget::onInspectorMessage(const Suscan::InspectorMessage &msg)
 void
 ZeroMQWidget::onSamplesMessage(const Suscan::SamplesMessage &msg)
 {
-  (void) m_forwarder->feedSamplesMessage(msg);
+  (void) m_forwarder->feedSamplesMessage(messageAnalyzer(), msg);
+}
+
+// The forwarder reads the source info of every analyzer by itself, but
+// the masters have to be moved in and out of their passbands.
+void
+ZeroMQWidget::onExtraSourceInfoMessage(Suscan::SourceInfoMessage const &)
+{
+  if (m_forwarder->isPartiallyOpen()) {
+    if (m_forwarder->retune())
+      refreshUi();
+
+    m_forwarder->flushLo();
+  }
+}
+
+void
+ZeroMQWidget::onExtraAnalyzerHalted()
+{
+  Suscan::Analyzer *analyzer = qobject_cast<Suscan::Analyzer *>(sender());
+  auto it = std::find(
+        m_extraAnalyzers.begin(),
+        m_extraAnalyzers.end(),
+        analyzer);
+
+  if (it == m_extraAnalyzers.end())
+    return;
+
+  m_extraAnalyzers.erase(it);
+  m_forwarder->removeAnalyzer(analyzer);
+  analyzer->disconnect(this);
+  analyzer->deleteLater();
+
+  refreshUi();
+}
+
+void
+ZeroMQWidget::onPSDMessage(const Suscan::PSDMessage &msg)
+{
+  ActivityUpdate update = m_forwarder->feedPsd(
+        messageAnalyzer(),
+        msg.getFrequency(),
+        msg.getSampleRate(),
+        msg.get(),
+        static_cast<unsigned>(msg.size()));
+
+  if (update.enabled + update.disabled == 0)
+    return;
+
+  // New carriers are not deferred, so that the start of a burst is not
+  // lost. Channels going quiet can wait for the next batch.
+  if (update.enabled > 0)
+    m_forwarder->syncEnableStates(false);
+
+  if (update.disabled > 0)
+    m_syncTimer->start();
+
+  m_ui->treeView->viewport()->update();
+  refreshMarkers();
 }
 
 void
@@ -955,8 +1778,105 @@ ZeroMQWidget::onFileMakeMaster(
     SUFLOAT bw,
     bool enabled)
 {
-  if (!doAddMaster(masterName, freq, bw, enabled))
-    m_smanager->abortLoad();
+  MasterPlanEntry entry;
+
+  entry.name      = masterName.toStdString();
+  entry.frequency = freq;
+  entry.bandwidth = bw;
+  entry.enabled   = enabled;
+
+  m_plan->masters.push_back(entry);
+}
+
+void
+ZeroMQWidget::onFileSetMasterEngine(
+    QString masterName,
+    QString engineName,
+    SUFLOAT spacing)
+{
+  MasterPlanEntry *master = m_plan->findMaster(masterName.toStdString());
+  MasterEngine engine;
+
+  if (master == nullptr)
+    return;
+
+  if (!MultiChannelForwarder::engineFromName(engineName.toStdString(), engine)) {
+    QMessageBox::warning(
+          this,
+          "Unknown channelizer engine",
+          "Master channel " + masterName + " requests an unknown engine ("
+          + engineName + "). Falling back to one inspector per channel.");
+    return;
+  }
+
+  master->engine      = engine;
+  master->gridSpacing = spacing;
+}
+
+void
+ZeroMQWidget::onFileSetMasterActivity(
+    QString masterName,
+    SUFLOAT snr,
+    SUFLOAT hold)
+{
+  MasterPlanEntry *master = m_plan->findMaster(masterName.toStdString());
+
+  if (master != nullptr) {
+    master->activityDriven = true;
+    master->activitySnr    = snr;
+    master->activityHold   = hold;
+  }
+}
+
+void
+ZeroMQWidget::onFileSetMasterSpectrum(
+    QString masterName,
+    qint64 bins,
+    SUFLOAT rate)
+{
+  std::string name = masterName.toStdString();
+  MasterPlanEntry *master = m_plan->findMaster(name);
+
+  if (master == nullptr)
+    return;
+
+  if (bins <= 0 || rate <= 0) {
+    QMessageBox::warning(
+          this,
+          "Invalid master spectrum",
+          "Master channel " + masterName + " requests a spectrum of "
+          + QString::number(bins) + " bins at " + QString::number(rate)
+          + " updates per second. The spectrum will not be published.");
+    return;
+  }
+
+  delete master->spectrum;
+  master->spectrum     = new ZeroMQSpectrumConsumer(m_zmqSink, name);
+  master->spectrumBins = static_cast<unsigned>(bins);
+  master->spectrumRate = rate;
+}
+
+void
+ZeroMQWidget::onFileSetMasterIQ(QString masterName, QString formatName)
+{
+  std::string name = masterName.toStdString();
+  MasterPlanEntry *master = m_plan->findMaster(name);
+  ZeroMQSampleFormat format;
+
+  if (master == nullptr)
+    return;
+
+  if (!ZeroMQMasterConsumer::formatFromName(formatName.toStdString(), format)) {
+    QMessageBox::warning(
+          this,
+          "Unknown sample format",
+          "Master channel " + masterName + " requests an unknown IQ format ("
+          + formatName + "). Its IQ will not be published.");
+    return;
+  }
+
+  delete master->iq;
+  master->iq = new ZeroMQMasterConsumer(m_zmqSink, name, format);
 }
 
 void
@@ -968,7 +1888,114 @@ ZeroMQWidget::onFileMakeChannel(
     qint64 rate,
     bool enabled)
 {
-  doAddChannel(channelName, freq, bw, chanType, rate, enabled);
+  ChannelPlanEntry entry;
+  std::string type = chanType.toStdString();
+
+  entry.name      = channelName.toStdString();
+  entry.frequency = freq;
+  entry.bandwidth = bw;
+  entry.inspClass = type == "raw" ? "raw" : "audio";
+  entry.enabled   = enabled;
+  entry.consumer  = new ZeroMQConsumer(
+        m_zmqSink,
+        type.c_str(),
+        static_cast<unsigned>(rate));
+
+  m_plan->channels.push_back(entry);
+}
+
+void
+ZeroMQWidget::onFileSetChannelRates(QString channelName, QString rates)
+{
+  ChannelPlanEntry *channel = m_plan->findChannel(channelName.toStdString());
+  ZeroMQConsumer *consumer;
+
+  if (channel == nullptr)
+    return;
+
+  consumer = static_cast<ZeroMQConsumer *>(channel->consumer);
+
+  for (auto &p : rates.split(",")) {
+    bool ok;
+    qint64 rate = p.trimmed().toLongLong(&ok);
+
+    if (!ok || !consumer->addOutputRate(rate))
+      QMessageBox::warning(
+            this,
+            "Invalid output rate",
+            "Channel " + channelName + " requests an invalid or duplicate "
+            "extra output rate (" + p.trimmed() + "). Ignored.");
+  }
+}
+
+void
+ZeroMQWidget::onFileSetChannelSquelch(
+    QString channelName,
+    QString modeName,
+    SUFLOAT level)
+{
+  ChannelPlanEntry *channel = m_plan->findChannel(channelName.toStdString());
+  ZeroMQSquelch mode;
+
+  if (channel == nullptr)
+    return;
+
+  if (!ZeroMQConsumer::squelchFromName(modeName.toStdString(), mode)) {
+    QMessageBox::warning(
+          this,
+          "Unknown squelch mode",
+          "Channel " + channelName + " requests an unknown squelch mode ("
+          + modeName + "). Squelch disabled.");
+    return;
+  }
+
+  static_cast<ZeroMQConsumer *>(channel->consumer)->setSquelch(mode, level);
+}
+
+void
+ZeroMQWidget::onFileSetChannelUdp(
+    QString channelName,
+    QString destinations,
+    qint64 ttl)
+{
+  ChannelPlanEntry *channel = m_plan->findChannel(channelName.toStdString());
+  ZeroMQConsumer *consumer;
+
+  if (channel == nullptr)
+    return;
+
+  consumer = static_cast<ZeroMQConsumer *>(channel->consumer);
+
+  for (auto &p : destinations.split(",")) {
+    if (!consumer->addUdpDestination(p.trimmed().toStdString()))
+      QMessageBox::warning(
+            this,
+            "Invalid UDP destination",
+            "Channel " + channelName + " requests an invalid UDP "
+            "destination (" + p.trimmed() + "). Ignored.");
+  }
+
+  consumer->setUdpTtl(static_cast<int>(ttl));
+}
+
+void
+ZeroMQWidget::onFileSetChannelPriority(QString channelName, SUFLOAT priority)
+{
+  ChannelPlanEntry *channel = m_plan->findChannel(channelName.toStdString());
+
+  if (channel == nullptr)
+    return;
+
+  if (!(priority > 0)) {
+    QMessageBox::warning(
+          this,
+          "Invalid channel priority",
+          "Channel " + channelName + " requests a non-positive priority ("
+          + QString::number(priority) + "). Using 1.");
+    return;
+  }
+
+  channel->priority = priority;
 }
 
 void
@@ -999,12 +2026,23 @@ ZeroMQWidget::onOpenSettings()
     if (!doRemoveAll())
       return;
 
-    if (!m_smanager->loadSettings(asStdString.c_str()))
+    // Everything in the file is applied at once, at the end
+    m_plan->discard();
+    if (!m_smanager->loadSettings(asStdString.c_str()) || !doImportPlan())
       m_forwarder->removeAll();
+    m_plan->discard();
+
+    m_forwarder->setDcGuard(
+          m_smanager->getCorrectDC() ? ZEROMQ_DC_GUARD_BW : 0);
 
     m_treeModel->rebuildStructure();
     m_ui->treeView->expandAll();
+    markAllDirty();
     refreshUi();
+
+    // This is the file to watch from now on
+    m_panelConfig->planFile = asStdString;
+    applyWatch();
   }
 }
 
@@ -1046,39 +2084,326 @@ ZeroMQWidget::onToggleTrackTuner()
   m_panelConfig->trackTuner = m_ui->trackTunerCheck->isChecked();
 }
 
+void
+ZeroMQWidget::onToggleWatchPlan()
+{
+  m_panelConfig->watchPlan = m_ui->watchPlanCheck->isChecked();
+  applyWatch();
+
+  // Catch up with the changes made while not watching
+  if (m_panelConfig->watchPlan && !m_panelConfig->planFile.empty())
+    doReloadPlan();
+}
+
+void
+ZeroMQWidget::onPlanFileChanged()
+{
+  if (m_panelConfig->watchPlan)
+    m_reloadTimer->start();
+}
+
+void
+ZeroMQWidget::onReloadPlan()
+{
+  QString file = QString::fromStdString(m_panelConfig->planFile);
+
+  if (!m_panelConfig->watchPlan || file.isEmpty())
+    return;
+
+  // Saved by replacing it: the new file may not be there yet
+  if (!QFileInfo::exists(file)) {
+    m_reloadTimer->start();
+    return;
+  }
+
+  // Replaced files are no longer watched
+  applyWatch();
+  doReloadPlan();
+}
+
+// Numeric arguments of the control commands have no sensible default
+static bool
+positiveArgument(QJsonObject const &request, const char *field, QString &error)
+{
+  QJsonValue value = request[field];
+
+  if (!value.isDouble() || !(value.toDouble() > 0)) {
+    error = QString("`") + field + "' must be a positive number";
+    return false;
+  }
+
+  return true;
+}
+
+//
+// Commands of the control endpoint. They go through the same paths as
+// the GUI, so the tree and the markers follow every change.
+//
+void
+ZeroMQWidget::onControlCommand(QJsonObject const &request, QJsonObject &reply)
+{
+  QString command = request["command"].toString();
+  QString name    = request["name"].toString();
+  std::string asString = name.toStdString();
+  QString error;
+  bool ok = true;
+
+  if (command == "list") {
+    reply["masters"] = listChannels();
+  } else if (command == "stats") {
+    reply["stats"] = stats();
+  } else if (command == "add_master") {
+    if (name.isEmpty()) {
+      ok = false;
+      error = "No master name given";
+    } else if (!positiveArgument(request, "frequency", error)
+               || !positiveArgument(request, "bandwidth", error)) {
+      ok = false;
+    } else {
+      ok = doAddMaster(
+            name,
+            request["frequency"].toDouble(),
+            static_cast<SUFLOAT>(request["bandwidth"].toDouble()),
+            request["enabled"].toBool(true),
+            true,
+            &error);
+    }
+  } else if (command == "add_channel") {
+    QString type = request["type"].toString("raw");
+
+    if (name.isEmpty()) {
+      ok = false;
+      error = "No channel name given";
+    } else if (type != "raw" && type != "audio:fm" && type != "audio:am"
+               && type != "audio:usb" && type != "audio:lsb") {
+      ok = false;
+      error = "Unknown channel type `" + type + "'";
+    } else if (!positiveArgument(request, "frequency", error)
+               || !positiveArgument(request, "bandwidth", error)
+               || !positiveArgument(request, "rate", error)) {
+      ok = false;
+    } else if (!(request["priority"].toDouble(1) > 0)) {
+      ok = false;
+      error = "Channel priority must be positive";
+    } else {
+      ok = doAddChannel(
+            name,
+            request["frequency"].toDouble(),
+            static_cast<SUFLOAT>(request["bandwidth"].toDouble()),
+            type,
+            static_cast<qint64>(request["rate"].toDouble()),
+            request["enabled"].toBool(true),
+            true,
+            &error);
+
+      // Only used for tuner placement: can be set once created
+      if (ok)
+        m_forwarder->findChannel(asString.c_str())->priority =
+            static_cast<SUFLOAT>(request["priority"].toDouble(1));
+    }
+  } else if (command == "remove_master") {
+    MasterChannel *master = m_forwarder->findMaster(asString.c_str());
+
+    if (master == nullptr) {
+      ok = false;
+      error = "No such master `" + name + "'";
+    } else {
+      doRemoveMaster(master);
+    }
+  } else if (command == "remove_channel") {
+    ChannelDescription *channel = m_forwarder->findChannel(asString.c_str());
+
+    if (channel == nullptr) {
+      ok = false;
+      error = "No such channel `" + name + "'";
+    } else {
+      doRemoveChannel(channel);
+    }
+  } else if (command == "enable" || command == "disable") {
+    MasterChannel *master = m_forwarder->findMaster(asString.c_str());
+    ChannelDescription *channel = m_forwarder->findChannel(asString.c_str());
+    QModelIndex index;
+
+    if (master != nullptr)
+      index = m_treeModel->masterIndex(master);
+    else if (channel != nullptr)
+      index = m_treeModel->channelIndex(channel);
+
+    // As if clicked: markers and inspectors are updated from onDataChanged
+    if (!index.isValid()) {
+      ok = false;
+      error = "No such master or channel `" + name + "'";
+    } else {
+      m_treeModel->setData(
+            index,
+            command == "enable" ? Qt::Checked : Qt::Unchecked,
+            Qt::CheckStateRole);
+    }
+  } else if (command == "retune") {
+    if (m_analyzer == nullptr) {
+      ok = false;
+      error = "No source is running";
+    } else if (!positiveArgument(request, "frequency", error)) {
+      ok = false;
+    } else {
+      try {
+        m_spectrum->setFreqs(
+              static_cast<qint64>(request["frequency"].toDouble()),
+              static_cast<qint64>(m_analyzer->getLnbFrequency()));
+      } catch (Suscan::Exception &) {
+        ok = false;
+        error = "Failed to change analyzer frequency";
+      }
+    }
+  } else if (command == "topology") {
+    MultiChannelTopology topology;
+    QString mode = request["mode"].toString();
+
+    // Without a mode, only reports the current one
+    if (!mode.isEmpty()) {
+      if (!MultiChannelForwarder::topologyFromName(
+            mode.toStdString(),
+            topology)) {
+        ok = false;
+        error = "Unknown topology `" + mode + "'";
+      } else {
+        m_panelConfig->topology = mode.toStdString();
+        m_forwarder->setTopology(topology);
+      }
+    }
+
+    reply["mode"] = MultiChannelForwarder::topologyName(m_forwarder->topology());
+  } else {
+    // Unknown: left to ControlServer
+    return;
+  }
+
+  reply["ok"] = ok;
+  if (!ok)
+    reply["error"] = error;
+}
+
 void
 ZeroMQWidget::onURLChanged()
 {
   m_panelConfig->zmqURL = m_ui->urlEdit->text().toStdString();
 }
 
+void
+ZeroMQWidget::onTreeContextMenu(const QPoint &pos)
+{
+  QModelIndex index = m_ui->treeView->indexAt(pos);
+  MultiChannelTreeItem *item = MultiChannelTreeModel::indexData(index);
+
+  if (item == nullptr || item->type != MULTI_CHANNEL_TREE_ITEM_MASTER)
+    return;
+
+  QMenu menu(this);
+  QAction *enableAll  = menu.addAction("Enable all channels");
+  QAction *disableAll = menu.addAction("Disable all channels");
+  QAction *activity   = menu.addAction("Enable channels on activity");
+  QAction *spectrum   = menu.addAction("Publish spectrum");
+  QAction *iqInt16    = menu.addAction("Publish IQ (int16)");
+  QAction *iqFloat32  = menu.addAction("Publish IQ (float32)");
+  auto iq = static_cast<const ZeroMQMasterConsumer *>(item->master->iq);
+
+  activity->setCheckable(true);
+  activity->setChecked(item->master->activityDriven);
+  spectrum->setCheckable(true);
+  spectrum->setChecked(item->master->spectrum != nullptr);
+  iqInt16->setCheckable(true);
+  iqInt16->setChecked(iq != nullptr && iq->format() == ZEROMQ_FORMAT_INT16);
+  iqFloat32->setCheckable(true);
+  iqFloat32->setChecked(iq != nullptr && iq->format() == ZEROMQ_FORMAT_FLOAT32);
+  enableAll->setEnabled(!item->master->activityDriven);
+  disableAll->setEnabled(!item->master->activityDriven);
+
+  QAction *selected   = menu.exec(m_ui->treeView->viewport()->mapToGlobal(pos));
+
+  if (selected == enableAll) {
+    m_treeModel->setChildrenEnabled(index, true);
+  } else if (selected == disableAll) {
+    m_treeModel->setChildrenEnabled(index, false);
+  } else if (selected == activity) {
+    m_forwarder->setMasterActivity(
+          item->master,
+          activity->isChecked(),
+          item->master->activitySnr,
+          item->master->activityHold);
+    m_forwarder->syncEnableStates();
+    m_ui->treeView->viewport()->update();
+    markMasterDirty(item->master, true);
+    refreshMarkers();
+  } else if (selected == spectrum) {
+    SpectrumConsumer *consumer = nullptr;
+
+    if (spectrum->isChecked())
+      consumer = new ZeroMQSpectrumConsumer(m_zmqSink, item->master->name);
+
+    m_forwarder->setMasterSpectrum(
+          item->master,
+          consumer,
+          SPECTRUM_MONITOR_DEFAULT_BINS,
+          SPECTRUM_MONITOR_DEFAULT_RATE);
+  } else if (selected == iqInt16 || selected == iqFloat32) {
+    ChannelConsumer *consumer = nullptr;
+
+    if (selected->isChecked())
+      consumer = new ZeroMQMasterConsumer(
+            m_zmqSink,
+            item->master->name,
+            selected == iqInt16 ? ZEROMQ_FORMAT_INT16 : ZEROMQ_FORMAT_FLOAT32);
+
+    m_forwarder->setMasterIQ(item->master, consumer);
+  }
+}
+
+void
+ZeroMQWidget::onSyncEnableStates()
+{
+  m_forwarder->syncEnableStates();
+}
+
+void
+ZeroMQWidget::onRetuneTimeout()
+{
+  if (m_retunePending) {
+    m_retunePending = false;
+    checkRecentering();
+    m_forwarder->flushLo();
+    refreshRetuneStats();
+
+    m_retuneTimer->start();
+  }
+}
+
 void
 ZeroMQWidget::onDataChanged(
     const QModelIndex &topLeft,
-    const QModelIndex &,
+    const QModelIndex &bottomRight,
     const QList<int> &)
 {
-  if (topLeft.isValid()) {
-    MultiChannelTreeItem *item = MultiChannelTreeModel::indexData(topLeft);
+  if (!topLeft.isValid())
+    return;
 
-    if (item->type == MULTI_CHANNEL_TREE_ITEM_MASTER) {
-      auto it = m_masterMarkers.find(item->master->name);
-      if (it != m_masterMarkers.end()) {
-        colorizeMaster(it->first, it->second);
+  // Enabled channels get their demodulator back right away. Disables
+  // reach the inspectors in a single batch.
+  m_forwarder->syncEnableStates(false);
+  m_syncTimer->start();
 
-        for (auto p = item->master->channels.begin();
-             p != item->master->channels.end();
-             ++p) {
-          auto it = m_channelMarkers.find(p->name);
-          if (it != m_channelMarkers.end())
-            colorizeChannel(it->first, it->second);
-        }
-      }
-    } else if (item->type == MULTI_CHANNEL_TREE_ITEM_CHANNEL) {
-      auto it = m_channelMarkers.find(item->channel->name);
-      if (it != m_channelMarkers.end())
-        colorizeChannel(it->first, it->second);
-    }
+  for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+    MultiChannelTreeItem *item = MultiChannelTreeModel::indexData(
+          topLeft.sibling(row, 0));
+
+    if (item == nullptr)
+      continue;
+
+    if (item->type == MULTI_CHANNEL_TREE_ITEM_MASTER)
+      markMasterDirty(item->master, true);
+    else if (item->type == MULTI_CHANNEL_TREE_ITEM_CHANNEL)
+      markChannelDirty(item->channel);
   }
+
+  refreshMarkers();
 }
 
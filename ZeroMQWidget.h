@@ -23,6 +23,7 @@
 #include <ToolWidgetFactory.h>
 #include <QWidget>
 #include <unordered_map>
+#include <unordered_set>
 #include <MainSpectrum.h>
 
 namespace Ui {
@@ -35,8 +36,14 @@ class SettingsManager;
 
 class MasterChannel;
 class ChannelDescription;
+struct ChannelPlan;
 
 class ZeroMQSink;
+class QTimer;
+class QFileSystemWatcher;
+class QJsonObject;
+class QJsonArray;
+class ControlServer;
 
 namespace SigDigger {
   class AddChanDialog;
@@ -53,6 +60,27 @@ namespace SigDigger {
     std::string zmqURL   = "tcp://*:6003";
     bool startPublish   = false;
 
+    // CPU lists ("0-3,8"), empty for no restriction. zmqCpus needs a
+    // libzmq built with the draft API (see ZeroMQSink::setIoAffinity).
+    std::string consumerCpus = "";
+    std::string workerCpus   = "";
+    std::string zmqCpus      = "";
+
+    // Channel file reloaded (and diffed) whenever it changes
+    bool watchPlan       = false;
+    std::string planFile = "";
+
+    // Control endpoint (see ControlServer). Empty: disabled.
+    std::string controlURL = "";
+
+    // Source profiles ("name1,name2") opened next to the main analyzer
+    // while it runs. Masters they cover are opened on them instead.
+    std::string extraSources = "";
+
+    // How the channels of inspector masters are opened ("auto", "master"
+    // or "direct"). Applies to masters opened after it changes.
+    std::string topology = "auto";
+
     // Overriden methods
     void deserialize(Suscan::Object const &conf) override;
     Suscan::Object &&serialize() override;
@@ -66,11 +94,19 @@ namespace SigDigger {
 
     // Processing members
     Suscan::Analyzer *m_analyzer = nullptr; // Borrowed
+    std::vector<Suscan::Analyzer *> m_extraAnalyzers; // Owned
     bool m_haveSourceInfo = false;
     MultiChannelForwarder *m_forwarder = nullptr;
     MultiChannelTreeModel *m_treeModel = nullptr;
     ZeroMQSink *m_zmqSink = nullptr;
     SettingsManager *m_smanager = nullptr;
+    ChannelPlan *m_plan = nullptr; // Channels being loaded from a file
+    QTimer *m_syncTimer = nullptr; // Deferred inspector enable/disable
+    QTimer *m_retuneTimer = nullptr; // Rate limit for LO updates
+    bool m_retunePending = false;
+    QFileSystemWatcher *m_planWatcher = nullptr;
+    QTimer *m_reloadTimer = nullptr; // Waits for writes to the file to settle
+    ControlServer *m_control = nullptr;
 
     // UI members
     int m_state = 0;
@@ -87,17 +123,38 @@ namespace SigDigger {
     std::unordered_map<std::string, NamedChannelSetIterator> m_masterMarkers;
     std::unordered_map<std::string, NamedChannelSetIterator> m_channelMarkers;
 
+    // Markers whose color may be stale. Recolored by refreshUi().
+    std::unordered_set<std::string> m_dirtyMasters;
+    std::unordered_set<std::string> m_dirtyChannels;
+    bool m_allMarkersDirty = true;
+
     void refreshUi();
+    void refreshMarkers();
+    void markMasterDirty(MasterChannel const *, bool withChannels = false);
+    void markChannelDirty(ChannelDescription const *);
+    void markAllDirty();
 
-    void colorizeMaster(std::string const &, NamedChannelSetIterator &);
-    void colorizeChannel(std::string const &, NamedChannelSetIterator &);
+    bool colorizeMaster(std::string const &, NamedChannelSetIterator &);
+    bool colorizeChannel(std::string const &, NamedChannelSetIterator &);
+    bool moveMarker(NamedChannelSetIterator &, SUFREQ);
 
+    void removeMarkers(MasterChannel const *);
+    void removeMarker(ChannelDescription const *);
     void doRemoveMaster(MasterChannel *);
     void doRemoveChannel(ChannelDescription *);
 
-    bool doAddMaster(QString, SUFREQ, SUFLOAT, bool enabled = true, bool refresh = false);
-    bool doAddChannel(QString, SUFREQ, SUFLOAT, QString, qint64,  bool enabled = true, bool refresh = false);
+    NamedChannelSetIterator addMasterMarker(QString, SUFREQ, SUFLOAT, bool refresh = true);
+    NamedChannelSetIterator addChannelMarker(QString, SUFREQ, SUFLOAT, bool refresh = true);
+    // Errors go to the message box unless a string is given for them
+    bool doAddMaster(QString, SUFREQ, SUFLOAT, bool enabled = true, bool refresh = false, QString *error = nullptr);
+    bool doAddChannel(QString, SUFREQ, SUFLOAT, QString, qint64,  bool enabled = true, bool refresh = false, QString *error = nullptr);
     bool doRemoveAll();
+    bool doImportPlan();
+    bool doReloadPlan();
+    void applyWatch();
+    void applyControl();
+    QJsonArray listChannels() const;
+    QJsonObject stats() const;
 
     // High-level logic
 
@@ -106,10 +163,16 @@ namespace SigDigger {
 
     void applySpectrumState();
     void connectAll();
+    void connectAnalyzer(Suscan::Analyzer *);
+    void openExtraAnalyzers();
+    void closeExtraAnalyzers();
+    Suscan::Analyzer *messageAnalyzer();
 
     void checkStartStop();
 
     void checkRecentering();
+    void scheduleRecentering();
+    void refreshRetuneStats();
     void lagNamedChannels();
     void recenterNamedChannels();
 
@@ -120,6 +183,8 @@ namespace SigDigger {
     // Configuration methods
     Suscan::Serializable *allocConfig() override;
     void applyConfig() override;
+    void applyAffinity();
+    void applyTopology();
     bool event(QEvent *) override;
 
     // Overriden methods
@@ -139,6 +204,9 @@ namespace SigDigger {
     void onSourceInfoMessage(Suscan::SourceInfoMessage const &);
     void onInspectorMessage(Suscan::InspectorMessage const &);
     void onSamplesMessage(Suscan::SamplesMessage const &);
+    void onPSDMessage(Suscan::PSDMessage const &);
+    void onExtraSourceInfoMessage(Suscan::SourceInfoMessage const &);
+    void onExtraAnalyzerHalted();
 
     void onAddMaster();
     void onAddMasterConfirm();
@@ -148,16 +216,31 @@ namespace SigDigger {
 
     void onChangeCurrent();
     void onRemove();
+    void onTreeContextMenu(const QPoint &);
+    void onSyncEnableStates();
+    void onRetuneTimeout();
 
     void onTogglePublishing();
 
     void onLoadSettingsFailed(QString);
 
     void onFileMakeMaster(QString, SUFREQ, SUFLOAT, bool);
+    void onFileSetMasterEngine(QString, QString, SUFLOAT);
+    void onFileSetMasterActivity(QString, SUFLOAT, SUFLOAT);
+    void onFileSetMasterSpectrum(QString, qint64, SUFLOAT);
+    void onFileSetMasterIQ(QString, QString);
     void onFileMakeChannel(QString, SUFREQ, SUFLOAT, QString, qint64, bool);
+    void onFileSetChannelRates(QString, QString);
+    void onFileSetChannelSquelch(QString, QString, SUFLOAT);
+    void onFileSetChannelUdp(QString, QString, qint64);
+    void onFileSetChannelPriority(QString, SUFLOAT);
 
     void onOpenSettings();
     void onSaveSettings();
+    void onToggleWatchPlan();
+    void onPlanFileChanged();
+    void onReloadPlan();
+    void onControlCommand(QJsonObject const &, QJsonObject &);
 
     void onDataChanged(
         const QModelIndex &topLeft,
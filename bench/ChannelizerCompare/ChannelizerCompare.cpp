@@ -0,0 +1,548 @@
+//
+//    ChannelizerCompare.cpp: Engine audio against a reference demodulation
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+//
+// Checks the audio that the channelizer engines and the plugin-side
+// demodulators produce against a reference demodulation of the same IQ:
+//
+//   - Built-in reference: the channel is mixed to baseband, resampled to
+//     the engine output rate and filtered to its bandwidth with a much
+//     longer filter than the engines use, then demodulated.
+//   - Inspector output (-e): the audio published for the same channel by
+//     an audio inspector, e.g. the <type>_<rate>.raw file the consumer of
+//     an inspector channel writes. It is resampled to the engine rate.
+//
+// Both are aligned with the engine audio (best correlation within
+// COMPARE_MAX_LAG seconds, refined to a fraction of a sample) and scaled
+// by the least-squares gain. The
+// residual is reported as a SNR: how much of the engine audio is not in
+// the reference (leakage of neighbors, the other sideband, distortion).
+//
+// Without -i, a test signal is synthesized: the wanted signal plus tones
+// just outside the channel, which an unfiltered engine output would let
+// through.
+//
+
+#include <Channelizer.h>
+#include <Demodulator.h>
+#include <Resampler.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#define COMPARE_BLOCK_SIZE 4096
+#define COMPARE_MAX_LAG    .05 // s
+#define COMPARE_SETTLE     .2  // s, skipped at the beginning
+#define COMPARE_INTERP_HALF  16  // Half length of the delay interpolator
+#define COMPARE_REFINE_STEPS 24  // Of the fractional delay search
+#define M_PHI 1.6180339887498949
+#define COMPARE_SECONDS    4   // Of synthetic signal
+
+// Reference channel filter: transition band, as a fraction of the channel
+// bandwidth (a quarter of the one of the engines) and length limit
+#define COMPARE_REF_TRANSITION .0625
+#define COMPARE_REF_MAX_TAPS   8191
+
+struct CompareOptions {
+  std::string        iqFile;
+  std::string        inspectorFile;
+  SUFLOAT            rate          = 250000;
+  SUFLOAT            inspectorRate = 0;
+  SUFREQ             offset        = 25000;
+  SUFLOAT            bandwidth     = 3000;
+  SUFLOAT            spacing       = 12500; // PFB grid
+  SUFLOAT            resolution    = 0;     // OLS, if not 0
+  ChannelDemodulator type          = CHANNEL_DEMOD_USB;
+};
+
+class CaptureConsumer : public ChannelConsumer {
+public:
+  std::vector<SUFLOAT> audio;
+
+  virtual void
+  opened(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &,
+      Suscan::Config const &) override
+  {
+  }
+
+  virtual void
+  samples(const SUCOMPLEX *samples, SUSCOUNT size) override
+  {
+    for (SUSCOUNT i = 0; i < size; ++i)
+      audio.push_back(SU_C_REAL(samples[i]));
+  }
+
+  virtual void
+  closed() override
+  {
+  }
+
+  virtual void
+  enableStateChanged(bool) override
+  {
+  }
+};
+
+static bool
+parseType(const char *name, ChannelDemodulator &type)
+{
+  if (strcmp(name, "usb") == 0)
+    type = CHANNEL_DEMOD_USB;
+  else if (strcmp(name, "lsb") == 0)
+    type = CHANNEL_DEMOD_LSB;
+  else if (strcmp(name, "am") == 0)
+    type = CHANNEL_DEMOD_AM;
+  else if (strcmp(name, "fm") == 0)
+    type = CHANNEL_DEMOD_FM;
+  else
+    return false;
+
+  return true;
+}
+
+static bool
+readSamples(std::string const &path, std::vector<SUCOMPLEX> &samples)
+{
+  FILE *fp = fopen(path.c_str(), "rb");
+  SUCOMPLEX block[COMPARE_BLOCK_SIZE];
+  size_t got;
+
+  if (fp == nullptr)
+    return false;
+
+  while ((got = fread(block, sizeof(SUCOMPLEX), COMPARE_BLOCK_SIZE, fp)) > 0)
+    samples.insert(samples.end(), block, block + got);
+
+  fclose(fp);
+
+  return true;
+}
+
+static SUCOMPLEX
+tone(double freq, double rate, size_t n)
+{
+  double phase = 2 * M_PI * std::fmod(freq * n / rate, 1.);
+
+  return SUCOMPLEX(
+        static_cast<SUFLOAT>(std::cos(phase)),
+        static_cast<SUFLOAT>(std::sin(phase)));
+}
+
+//
+// Wanted signal (a 1 kHz tone through the modulation of the channel) and
+// two unit tones outside the channel: one next to its lower edge (the
+// other sideband, for USB), one further up.
+//
+static void
+synthesize(CompareOptions const &o, std::vector<SUCOMPLEX> &x)
+{
+  double rate   = o.rate;
+  double lower  = o.offset - .75 * o.bandwidth;
+  double upper  = o.offset + 1.25 * o.bandwidth;
+  double fmPhase = 0;
+
+  x.resize(static_cast<size_t>(COMPARE_SECONDS * rate));
+
+  for (size_t n = 0; n < x.size(); ++n) {
+    double m = std::sin(2 * M_PI * 1000 * n / rate);
+    SUCOMPLEX wanted;
+
+    switch (o.type) {
+      case CHANNEL_DEMOD_USB:
+        wanted = tone(o.offset - .5 * o.bandwidth + 1000, rate, n);
+        break;
+
+      case CHANNEL_DEMOD_LSB:
+        wanted = tone(o.offset + .5 * o.bandwidth - 1000, rate, n);
+        break;
+
+      case CHANNEL_DEMOD_AM:
+        wanted = static_cast<SUFLOAT>(1 + .5 * m) * tone(o.offset, rate, n);
+        break;
+
+      default:
+        fmPhase += 2 * M_PI * (o.offset + .125 * o.bandwidth * m) / rate;
+        wanted = SUCOMPLEX(
+              static_cast<SUFLOAT>(std::cos(fmPhase)),
+              static_cast<SUFLOAT>(std::sin(fmPhase)));
+        break;
+    }
+
+    x[n] = wanted + tone(lower, rate, n) + tone(upper, rate, n);
+  }
+}
+
+// Runs the engine as the forwarder does for an audio channel
+static bool
+runEngine(
+    CompareOptions const &o,
+    std::vector<SUCOMPLEX> const &x,
+    std::vector<SUFLOAT> &audio,
+    SUFLOAT &outRate)
+{
+  Channelizer *engine;
+  ChannelDescription channel;
+  CaptureConsumer *consumer = new CaptureConsumer();
+  bool ok;
+
+  if (o.resolution > 0)
+    engine = new OlsChannelizer(o.resolution);
+  else
+    engine = new PfbChannelizer(o.spacing);
+
+  channel.offset    = o.offset;
+  channel.bandwidth = o.bandwidth;
+  channel.consumer  = consumer;
+
+  ok = engine->setInputRate(o.rate) && engine->addChannel(&channel);
+
+  if (ok) {
+    channel.demodulator = new Demodulator(
+          o.type,
+          channel.sampRate,
+          channel.bandwidth);
+
+    for (size_t i = 0; i < x.size(); i += COMPARE_BLOCK_SIZE)
+      engine->feed(
+            x.data() + i,
+            std::min<size_t>(COMPARE_BLOCK_SIZE, x.size() - i));
+
+    audio   = consumer->audio;
+    outRate = channel.sampRate;
+  }
+
+  delete engine;
+
+  return ok;
+}
+
+// Blackman-windowed sinc lowpass, applied to the whole signal at once
+static void
+lowpass(std::vector<SUCOMPLEX> &x, SUFLOAT cutoff, SUFLOAT transition)
+{
+  unsigned int len = static_cast<unsigned>(std::ceil(5.5 / transition)) | 1;
+  std::vector<SUFLOAT> h;
+  std::vector<SUCOMPLEX> y(x.size());
+  SUFLOAT fc, mid, sum = 0;
+
+  len = std::min<unsigned>(len, COMPARE_REF_MAX_TAPS);
+  fc  = cutoff + 2.75f / len;
+  mid = .5f * (len - 1);
+  h.resize(len);
+
+  for (unsigned int i = 0; i < len; ++i) {
+    SUFLOAT t = i - mid;
+    SUFLOAT w = 2 * PI * i / (len - 1);
+    SUFLOAT sinc = t == 0 ? 1 : SU_SIN(2 * PI * fc * t) / (2 * PI * fc * t);
+
+    h[i] = sinc * (.42f - .5f * SU_COS(w) + .08f * SU_COS(2 * w));
+    sum += h[i];
+  }
+
+  // Zero-phase: centered on each output sample
+  for (size_t n = 0; n < x.size(); ++n) {
+    SUCOMPLEX acc = 0;
+
+    for (unsigned int k = 0; k < len; ++k) {
+      long m = static_cast<long>(n) + k - static_cast<long>(mid);
+
+      if (m >= 0 && m < static_cast<long>(x.size()))
+        acc += h[k] * x[m];
+    }
+
+    y[n] = acc / sum;
+  }
+
+  x.swap(y);
+}
+
+static void
+runReference(
+    CompareOptions const &o,
+    std::vector<SUCOMPLEX> const &x,
+    SUFLOAT outRate,
+    std::vector<SUFLOAT> &audio)
+{
+  std::vector<SUCOMPLEX> baseband(x.size());
+  Resampler resampler(o.rate, outRate);
+  std::vector<SUCOMPLEX> y;
+
+  for (size_t n = 0; n < x.size(); ++n)
+    baseband[n] = x[n] * SU_C_CONJ(tone(o.offset, o.rate, n));
+
+  for (size_t i = 0; i < baseband.size(); i += COMPARE_BLOCK_SIZE) {
+    resampler.process(
+          baseband.data() + i,
+          std::min<size_t>(COMPARE_BLOCK_SIZE, baseband.size() - i));
+    y.insert(y.end(), resampler.output(), resampler.output() + resampler.size());
+  }
+
+  lowpass(
+        y,
+        .5f * o.bandwidth / outRate,
+        static_cast<SUFLOAT>(COMPARE_REF_TRANSITION * o.bandwidth / outRate));
+
+  Demodulator demod(o.type, outRate, o.bandwidth);
+
+  audio.clear();
+  for (size_t i = 0; i < y.size(); i += COMPARE_BLOCK_SIZE) {
+    demod.process(
+          y.data() + i,
+          std::min<size_t>(COMPARE_BLOCK_SIZE, y.size() - i));
+
+    for (SUSCOUNT k = 0; k < demod.size(); ++k)
+      audio.push_back(SU_C_REAL(demod.output()[k]));
+  }
+}
+
+static bool
+readInspector(
+    CompareOptions const &o,
+    SUFLOAT outRate,
+    std::vector<SUFLOAT> &audio)
+{
+  std::vector<SUCOMPLEX> x;
+  Resampler resampler(o.inspectorRate, outRate);
+
+  if (!readSamples(o.inspectorFile, x))
+    return false;
+
+  // Audio only: the imaginary part is not part of the comparison
+  for (auto &s : x)
+    s = SU_C_REAL(s);
+
+  audio.clear();
+  for (size_t i = 0; i < x.size(); i += COMPARE_BLOCK_SIZE) {
+    resampler.process(
+          x.data() + i,
+          std::min<size_t>(COMPARE_BLOCK_SIZE, x.size() - i));
+
+    for (SUSCOUNT k = 0; k < resampler.size(); ++k)
+      audio.push_back(SU_C_REAL(resampler.output()[k]));
+  }
+
+  return true;
+}
+
+// a[n + delay] for a fractional delay, with a windowed-sinc interpolator
+static double
+interpolate(std::vector<SUFLOAT> const &a, long n, double delay)
+{
+  double pos = n + delay;
+  long base  = static_cast<long>(std::floor(pos));
+  double frac = pos - base;
+  double acc = 0;
+
+  for (long k = -COMPARE_INTERP_HALF + 1; k <= COMPARE_INTERP_HALF; ++k) {
+    double t = k - frac;
+    double sinc = t == 0 ? 1 : std::sin(M_PI * t) / (M_PI * t);
+    double window = .5 + .5 * std::cos(M_PI * t / COMPARE_INTERP_HALF);
+
+    acc += a[base + k] * sinc * window;
+  }
+
+  return acc;
+}
+
+// SNR of a against the reference b, after scaling a by its LS gain
+static double
+residual(
+    std::vector<SUFLOAT> const &a,
+    std::vector<SUFLOAT> const &b,
+    long start,
+    long end,
+    double delay)
+{
+  double ab = 0, aa = 0, bb = 0, err = 0, gain;
+  std::vector<double> shifted(end - start);
+
+  for (long n = start; n < end; ++n) {
+    double x = interpolate(a, n, delay);
+
+    shifted[n - start] = x;
+    ab += x * b[n];
+    aa += x * x;
+    bb += b[n] * b[n];
+  }
+
+  gain = aa > 0 ? ab / aa : 0;
+
+  for (long n = start; n < end; ++n) {
+    double e = b[n] - gain * shifted[n - start];
+    err += e * e;
+  }
+
+  return 10 * std::log10(bb / err);
+}
+
+//
+// SNR of a against the reference b, in dB, after the best alignment
+// (b[n] against a[n + delay]) and scaling. The delay is found to the
+// sample by correlation, and then refined to a fraction of a sample:
+// audio near the Nyquist rate is far from aligned with whole samples.
+//
+static double
+compare(
+    std::vector<SUFLOAT> const &a,
+    std::vector<SUFLOAT> const &b,
+    SUFLOAT rate,
+    double &delay)
+{
+  long maxLag = static_cast<long>(COMPARE_MAX_LAG * rate) + COMPARE_INTERP_HALF;
+  long start  = static_cast<long>(COMPARE_SETTLE * rate) + maxLag;
+  long end    = static_cast<long>(std::min(a.size(), b.size())) - maxLag;
+  double best = -1, lo, hi;
+  long bestLag = 0;
+
+  if (end <= start)
+    return NAN;
+
+  for (long lag = -maxLag + COMPARE_INTERP_HALF;
+       lag <= maxLag - COMPARE_INTERP_HALF;
+       ++lag) {
+    double c = 0, p = 0;
+
+    for (long n = start; n < end; ++n) {
+      c += a[n + lag] * b[n];
+      p += a[n + lag] * a[n + lag];
+    }
+
+    c = p > 0 ? c * c / p : 0;
+
+    if (c > best) {
+      best    = c;
+      bestLag = lag;
+    }
+  }
+
+  // Golden section search of the best SNR around it
+  lo = bestLag - 1;
+  hi = bestLag + 1;
+
+  for (int i = 0; i < COMPARE_REFINE_STEPS; ++i) {
+    double m1 = hi - (hi - lo) / M_PHI;
+    double m2 = lo + (hi - lo) / M_PHI;
+
+    if (residual(a, b, start, end, m1) > residual(a, b, start, end, m2))
+      hi = m2;
+    else
+      lo = m1;
+  }
+
+  delay = .5 * (lo + hi);
+
+  return residual(a, b, start, end, delay);
+}
+
+static void
+usage(const char *name)
+{
+  std::fprintf(
+        stderr,
+        "Usage: %s [-i iq.raw] [-r rate] [-f offset] [-b bandwidth]\n"
+        "       [-d usb|lsb|am|fm] [-g pfb spacing | -o ols resolution]\n"
+        "       [-e inspector.raw -R inspector rate]\n\n"
+        "IQ and inspector files are complex float32 (audio in the real\n"
+        "part). Without -i, a test signal is synthesized.\n",
+        name);
+}
+
+int
+main(int argc, char **argv)
+{
+  CompareOptions o;
+  std::vector<SUCOMPLEX> x;
+  std::vector<SUFLOAT> engine, reference, inspector;
+  SUFLOAT outRate = 0;
+  double delay;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "i:r:f:b:d:g:o:e:R:")) != -1) {
+    switch (opt) {
+      case 'i': o.iqFile = optarg; break;
+      case 'r': o.rate = std::atof(optarg); break;
+      case 'f': o.offset = std::atof(optarg); break;
+      case 'b': o.bandwidth = std::atof(optarg); break;
+      case 'g': o.spacing = std::atof(optarg); break;
+      case 'o': o.resolution = std::atof(optarg); break;
+      case 'e': o.inspectorFile = optarg; break;
+      case 'R': o.inspectorRate = std::atof(optarg); break;
+
+      case 'd':
+        if (!parseType(optarg, o.type)) {
+          usage(argv[0]);
+          return EXIT_FAILURE;
+        }
+        break;
+
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (o.rate <= 0
+      || o.bandwidth <= 0
+      || (!o.inspectorFile.empty() && o.inspectorRate <= 0)) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (o.iqFile.empty()) {
+    synthesize(o, x);
+  } else if (!readSamples(o.iqFile, x)) {
+    std::fprintf(stderr, "Cannot read %s\n", o.iqFile.c_str());
+    return EXIT_FAILURE;
+  }
+
+  if (!runEngine(o, x, engine, outRate)) {
+    std::fprintf(stderr, "The channel does not fit in the engine\n");
+    return EXIT_FAILURE;
+  }
+
+  runReference(o, x, outRate, reference);
+
+  std::printf("engine:    %s, output rate %g sps\n",
+      o.resolution > 0 ? "OLS" : "PFB",
+      outRate);
+  std::printf("reference: SNR %6.1f dB",
+      compare(engine, reference, outRate, delay));
+  std::printf(" (delay %.2f samples)\n", delay);
+
+  if (!o.inspectorFile.empty()) {
+    if (!readInspector(o, outRate, inspector)) {
+      std::fprintf(stderr, "Cannot read %s\n", o.inspectorFile.c_str());
+      return EXIT_FAILURE;
+    }
+
+    std::printf("inspector: SNR %6.1f dB",
+        compare(engine, inspector, outRate, delay));
+    std::printf(" (delay %.2f samples)\n", delay);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+# Compares the audio of a channelizer engine against a reference
+# demodulation (and, optionally, against a recording of the audio of an
+# inspector) on synthetic or recorded IQ. Needs the same libraries as the
+# plugin:
+#
+#   % qmake ChannelizerCompare.pro && make && ./ChannelizerCompare -h
+
+QT += core
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ChannelizerCompare.cpp \
+    ../../Affinity.cpp \
+    ../../Channelizer.cpp \
+    ../../ConsumerPool.cpp \
+    ../../Demodulator.cpp \
+    ../../MultiChannelForwarder.cpp \
+    ../../Resampler.cpp \
+    ../../SpectrumMonitor.cpp \
+    ../../UdpConsumer.cpp \
+    ../../WorkerPool.cpp \
+    ../../ZeroMQSink.cpp
+
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += suscan sigutils fftw3 cppzmq
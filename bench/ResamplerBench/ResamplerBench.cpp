@@ -0,0 +1,257 @@
+//
+//    ResamplerBench.cpp: Throughput of the resamplers
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+//
+// Standalone benchmark of Resampler and HalfBandDecimator. Feeds a few
+// seconds of a complex tone in blocks of the usual inspector size and
+// reports the input rate each of them sustains on one core.
+//
+// It also measures the response with single tones. Tones in the passband
+// (up to BENCH_PASSBAND of the narrower rate, both signs) give the ripple
+// of the gain and the worst SNR of the tone at the output, which includes
+// the images left by interpolation. When decimating, tones that would
+// alias into the passband (from the output rate minus the passband up to
+// the input Nyquist) give the worst alias level, relative to the input.
+// Ratios too close to 1 have no such tones, and no alias level.
+//
+
+#include <Resampler.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_PASSBAND   .35  // Of the narrower rate
+#define BENCH_TONES      8    // Per side of the passband, and in the stopband
+#define BENCH_FIT_SIZE   8192 // Output samples per tone
+
+struct BenchCase {
+  SUFLOAT inRate;
+  SUFLOAT outRate;
+};
+
+static const BenchCase g_cases[] = {
+  {  48000,  44100 },
+  { 250000,  48000 },
+  { 250000,  44100 },
+  {   8000,  48000 },
+  {  1e6,    10500 },
+};
+
+// Tone at a tenth of the sample rate
+static void
+makeInput(std::vector<SUCOMPLEX> &input)
+{
+  double omega = 2 * M_PI * .1;
+
+  for (size_t i = 0; i < input.size(); ++i)
+    input[i] = SUCOMPLEX(std::cos(omega * i), std::sin(omega * i));
+}
+
+// Output of a unit tone, compared to the same tone at the output rate
+struct ToneFit {
+  double gain;     // Amplitude of the tone at the output
+  double power;    // Mean output power
+  double residual; // Mean power of everything else
+};
+
+// Feeds a unit tone of the given frequency (Hz) to a fresh copy of the
+// block, skipping the first settle outputs
+template<class T> static ToneFit
+fitTone(
+    T const &proto,
+    double inRate,
+    double outRate,
+    double freq,
+    SUSCOUNT settle)
+{
+  T block(proto);
+  std::vector<SUCOMPLEX> input(BENCH_BLOCK_SIZE);
+  std::vector<SUCOMPLEX> output;
+  double omega = 2 * M_PI * freq / inRate;
+  SUCOMPLEX amp = 0;
+  size_t n = 0;
+  ToneFit fit;
+
+  while (output.size() < settle + BENCH_FIT_SIZE) {
+    for (size_t i = 0; i < input.size(); ++i, ++n)
+      input[i] = SUCOMPLEX(std::cos(omega * n), std::sin(omega * n));
+
+    block.process(input.data(), input.size());
+    output.insert(output.end(), block.output(), block.output() + block.size());
+  }
+
+  omega = 2 * M_PI * freq / outRate;
+
+  for (size_t i = 0; i < BENCH_FIT_SIZE; ++i)
+    amp += output[settle + i]
+        * SUCOMPLEX(std::cos(omega * i), -std::sin(omega * i));
+
+  amp /= static_cast<SUFLOAT>(BENCH_FIT_SIZE);
+
+  fit.gain     = std::abs(amp);
+  fit.power    = 0;
+  fit.residual = 0;
+
+  for (size_t i = 0; i < BENCH_FIT_SIZE; ++i) {
+    SUCOMPLEX y = output[settle + i];
+    SUCOMPLEX tone = amp * SUCOMPLEX(std::cos(omega * i), std::sin(omega * i));
+
+    fit.power    += std::norm(y);
+    fit.residual += std::norm(y - tone);
+  }
+
+  fit.power    /= BENCH_FIT_SIZE;
+  fit.residual /= BENCH_FIT_SIZE;
+
+  return fit;
+}
+
+struct Quality {
+  double ripple; // dB, peak to peak
+  double snr;    // dB, worst
+  double alias;  // dB, worst (NAN if nothing can alias into the passband)
+};
+
+template<class T> static Quality
+measure(T const &proto, double inRate, double outRate, unsigned int taps)
+{
+  double narrow = std::min(inRate, outRate);
+  double minGain = HUGE_VAL, maxGain = 0, snr = HUGE_VAL, alias = NAN;
+  SUSCOUNT settle = static_cast<SUSCOUNT>(taps * outRate / inRate) + 1;
+  Quality q;
+
+  for (int k = -BENCH_TONES; k <= BENCH_TONES; ++k) {
+    double freq = BENCH_PASSBAND * narrow * k / BENCH_TONES;
+    ToneFit fit = fitTone(proto, inRate, outRate, freq, settle);
+
+    minGain = std::min(minGain, fit.gain);
+    maxGain = std::max(maxGain, fit.gain);
+    snr     = std::min(snr, fit.gain * fit.gain / (fit.residual + 1e-30));
+  }
+
+  if ((1 - BENCH_PASSBAND) * outRate < .49 * inRate) {
+    double first = (1 - BENCH_PASSBAND) * outRate;
+    double last  = .49 * inRate;
+
+    alias = 0;
+    for (int k = 0; k < BENCH_TONES; ++k) {
+      double freq = first + (last - first) * k / (BENCH_TONES - 1);
+      alias = std::max(
+            alias,
+            fitTone(proto, inRate, outRate, freq, settle).power);
+    }
+
+    alias = 10 * std::log10(alias + 1e-30);
+  }
+
+  q.ripple = 20 * std::log10(maxGain / minGain);
+  q.snr    = 10 * std::log10(snr);
+  q.alias  = alias;
+
+  return q;
+}
+
+template<class T> static double
+feedAll(T &block, std::vector<SUCOMPLEX> const &input, SUSCOUNT &produced)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  produced = 0;
+
+  for (size_t i = 0; i < input.size(); i += BENCH_BLOCK_SIZE) {
+    SUSCOUNT size = std::min<size_t>(BENCH_BLOCK_SIZE, input.size() - i);
+    block.process(input.data() + i, size);
+    produced += block.size();
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  return elapsed.count();
+}
+
+int
+main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? std::atof(argv[1]) : 2;
+  std::vector<SUCOMPLEX> input;
+  SUSCOUNT produced;
+  double elapsed;
+
+  if (seconds <= 0) {
+    std::fprintf(stderr, "Usage: %s [seconds of input per case]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  Quality q;
+
+  std::printf("%10s %10s %6s %12s %10s %8s %10s %8s %9s\n",
+      "in", "out", "taps", "in Msps", "out", "x real",
+      "ripple dB", "SNR dB", "alias dB");
+
+  for (auto const &c : g_cases) {
+    Resampler resampler(c.inRate, c.outRate);
+
+    input.resize(static_cast<size_t>(seconds * c.inRate));
+    makeInput(input);
+
+    q = measure(Resampler(c.inRate, c.outRate), c.inRate, c.outRate,
+        resampler.taps());
+    elapsed = feedAll(resampler, input, produced);
+
+    std::printf("%10g %10g %6u %12.3f %10lu %8.1f %10.4f %8.1f %9.1f\n",
+        c.inRate,
+        c.outRate,
+        resampler.taps(),
+        input.size() / elapsed * 1e-6,
+        static_cast<unsigned long>(produced),
+        seconds / elapsed,
+        q.ripple,
+        q.snr,
+        q.alias);
+  }
+
+  {
+    HalfBandDecimator decimator;
+    SUFLOAT rate = 1e6;
+
+    input.resize(static_cast<size_t>(seconds * rate));
+    makeInput(input);
+
+    q = measure(HalfBandDecimator(), rate, rate / 2, HALFBAND_TAPS);
+    elapsed = feedAll(decimator, input, produced);
+
+    std::printf("%10g %10g %6u %12.3f %10lu %8.1f %10.4f %8.1f %9.1f\n",
+        rate,
+        rate / 2,
+        HALFBAND_TAPS,
+        input.size() / elapsed * 1e-6,
+        static_cast<unsigned long>(produced),
+        seconds / elapsed,
+        q.ripple,
+        q.snr,
+        q.alias);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+# Standalone benchmark of the resamplers. Only needs sigutils:
+#
+#   % qmake ResamplerBench.pro && make && ./ResamplerBench [seconds]
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    ResamplerBench.cpp \
+    ../../Resampler.cpp
+
+HEADERS += \
+    ../../Resampler.h
+
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += sigutils
@@ -0,0 +1,159 @@
+//
+//    TreeModelBench.cpp: Channel tree updates with many channels
+//    Copyright (C) 2023 Gonzalo José Carracedo Carballal
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU Lesser General Public License as
+//    published by the Free Software Foundation, either version 3 of the
+//    License, or (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful, but
+//    WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU Lesser General Public License for more details.
+//
+//    You should have received a copy of the GNU Lesser General Public
+//    License along with this program.  If not, see
+//    <http://www.gnu.org/licenses/>
+//
+
+//
+// Standalone benchmark of MultiChannelTreeModel. Builds a plan of 10k
+// channels (100 masters of 100 channels by default, nothing is opened),
+// and times the incremental updates of the tree against a full rebuild,
+// a walk through every index and the removal of every channel in random
+// order.
+//
+
+#include <MultiChannelForwarder.h>
+#include <MultiChannelTreeModel.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+class NullConsumer : public ChannelConsumer {
+public:
+  void
+  opened(
+      Suscan::Analyzer *,
+      Suscan::Handle,
+      ChannelDescription const &,
+      Suscan::Config const &) override
+  {
+  }
+
+  void samples(const SUCOMPLEX *, SUSCOUNT) override { }
+  void closed() override { }
+  void enableStateChanged(bool) override { }
+};
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double
+since(BenchClock::time_point start)
+{
+  std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+  return elapsed.count();
+}
+
+static void
+report(const char *what, double seconds, unsigned int count)
+{
+  std::printf(
+        "%-24s %10.3f ms %10.3f us/item\n",
+        what,
+        seconds * 1e3,
+        seconds * 1e6 / count);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned int masters = argc > 1 ? std::atoi(argv[1]) : 100;
+  unsigned int perMaster = argc > 2 ? std::atoi(argv[2]) : 100;
+  MultiChannelForwarder forwarder(1);
+  MultiChannelTreeModel model(&forwarder);
+  std::vector<ChannelDescription *> channels;
+  BenchClock::time_point start;
+  double modelTime = 0;
+  unsigned int rows = 0;
+
+  if (masters == 0 || perMaster == 0) {
+    std::fprintf(stderr, "Usage: %s [masters] [channels per master]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // Channels 1 kHz wide, 1.5 kHz apart
+  for (unsigned int m = 0; m < masters; ++m) {
+    std::string name = "master" + std::to_string(m);
+    SUFREQ freq = 100e6 + m * 2e6;
+    SUFLOAT bw  = 1.5e3f * (perMaster + 1);
+    MasterChannel *master = forwarder.makeMaster(name.c_str(), freq, bw);
+
+    start = BenchClock::now();
+    model.addMaster(master);
+    modelTime += since(start);
+
+    for (unsigned int c = 0; c < perMaster; ++c) {
+      std::string chName = name + "." + std::to_string(c);
+      ChannelDescription *channel = forwarder.makeChannel(
+            chName.c_str(),
+            freq - bw / 2 + 1.5e3 * (c + 1),
+            1e3,
+            "raw",
+            new NullConsumer);
+
+      if (channel == nullptr) {
+        std::fprintf(stderr, "%s", forwarder.getErrors().c_str());
+        return EXIT_FAILURE;
+      }
+
+      channels.push_back(channel);
+
+      start = BenchClock::now();
+      model.addChannel(channel);
+      modelTime += since(start);
+    }
+  }
+
+  report("incremental add", modelTime, channels.size());
+
+  start = BenchClock::now();
+  model.rebuildStructure();
+  report("full rebuild", since(start), channels.size());
+
+  start = BenchClock::now();
+  for (int i = 0; i < model.rowCount(); ++i) {
+    QModelIndex master = model.index(i, 0);
+
+    for (int j = 0; j < model.rowCount(master); ++j) {
+      QModelIndex channel = model.index(j, 0, master);
+      rows += model.parent(channel).row() == i;
+    }
+  }
+  report("index walk", since(start), channels.size());
+
+  if (rows != channels.size()) {
+    std::fprintf(stderr, "Inconsistent tree: %u rows\n", rows);
+    return EXIT_FAILURE;
+  }
+
+  std::shuffle(channels.begin(), channels.end(), std::mt19937(1));
+
+  modelTime = 0;
+  for (auto channel : channels) {
+    start = BenchClock::now();
+    model.removeChannel(channel);
+    modelTime += since(start);
+
+    forwarder.removeChannel(channel);
+  }
+  report("incremental removal", modelTime, channels.size());
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+# Standalone benchmark of the channel tree model. Needs the same
+# libraries as the plugin:
+#
+#   % qmake TreeModelBench.pro && make && ./TreeModelBench [masters] [channels]
+
+QT += core gui widgets
+
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+isEmpty(SUWIDGETS_PREFIX) {
+  SUWIDGETS_INSTALL_HEADERS=$$[QT_INSTALL_HEADERS]/SuWidgets
+  SUWIDGETS_INSTALL_LIBS=$$[QT_INSTALL_LIBS]
+} else {
+  SUWIDGETS_INSTALL_HEADERS=$$SUWIDGETS_PREFIX/include/SuWidgets
+  SUWIDGETS_INSTALL_LIBS=$$SUWIDGETS_PREFIX/lib
+}
+
+INCLUDEPATH += ../.. $$SUWIDGETS_INSTALL_HEADERS
+
+SOURCES += \
+    TreeModelBench.cpp \
+    ../../Affinity.cpp \
+    ../../Channelizer.cpp \
+    ../../ConsumerPool.cpp \
+    ../../Demodulator.cpp \
+    ../../MultiChannelForwarder.cpp \
+    ../../MultiChannelTreeModel.cpp \
+    ../../Resampler.cpp \
+    ../../SpectrumMonitor.cpp \
+    ../../UdpConsumer.cpp \
+    ../../WorkerPool.cpp \
+    ../../ZeroMQSink.cpp
+
+HEADERS += \
+    ../../MultiChannelTreeModel.h
+
+LIBS += -L$$SUWIDGETS_INSTALL_LIBS -lsuwidgets
+
+unix: CONFIG += link_pkgconfig
+unix: PKGCONFIG += suscan sigutils fftw3 cppzmq